@@ -3,6 +3,8 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
+#pragma comment(lib, "Synchronization.lib")
+
 int atomic_increment(int* address)
 {
 	return InterlockedIncrement(address) - 1;
@@ -27,3 +29,33 @@ void atomic_store(int* address, int value)
 {
 	*(volatile int*)address = value;
 }
+
+void* atomic_compare_and_exchange_pointer(void** dest, void* compare, void* exchange)
+{
+	return InterlockedCompareExchangePointer(dest, exchange, compare);
+}
+
+void* atomic_exchange_pointer(void** dest, void* exchange)
+{
+	return InterlockedExchangePointer(dest, exchange);
+}
+
+int atomic_exchange(int* address, int value)
+{
+	return InterlockedExchange(address, value);
+}
+
+void atomic_wait(int* address, int value)
+{
+	WaitOnAddress(address, &value, sizeof(value), INFINITE);
+}
+
+void atomic_wake_all(int* address)
+{
+	WakeByAddressAll(address);
+}
+
+void atomic_wake_one(int* address)
+{
+	WakeByAddressSingle(address);
+}
@@ -27,3 +27,30 @@ int atomic_load(int* address);
 // Writes an integer.
 // Paired with an atomic_load, can guarantee ordering and visibility.
 void atomic_store(int* address, int value);
+
+// Compare two pointers atomically and assign if equal.
+// Returns the old value of the pointer.
+// Performs the following operation atomically:
+//   void* old_value = *dest; if (*dest == compare) *dest = exchange; return old_value;
+void* atomic_compare_and_exchange_pointer(void** dest, void* compare, void* exchange);
+
+// Assign a pointer atomically.
+// Returns the old value of the pointer.
+// Performs the following operation atomically:
+//   void* old_value = *dest; *dest = exchange; return old_value;
+void* atomic_exchange_pointer(void** dest, void* exchange);
+
+// Assign an integer atomically.
+// Returns the old value of the number.
+// Acts as a full memory barrier.
+int atomic_exchange(int* address, int value);
+
+// Blocks the calling thread while the integer at address equals value.
+// May return spuriously, so callers re-check their condition in a loop.
+void atomic_wait(int* address, int value);
+
+// Wakes every thread blocked in atomic_wait on address.
+void atomic_wake_all(int* address);
+
+// Wakes at most one thread blocked in atomic_wait on address.
+void atomic_wake_one(int* address);
@@ -0,0 +1,55 @@
+#pragma once
+
+// Engine micro-benchmarks.
+// Each benchmark prints its results with debug_print().
+// Run the executable with -bench to run them all instead of the game.
+
+// Multi-threaded heap_alloc/heap_free throughput.
+// Reports the alloc/free hot path cost at each heap_tracking_t level.
+// Reports leak-tracking cost per alloc/free with 1K, 10K and 100K live allocations.
+// Compares the per-thread cached heap against a single mutex around TLSF at 1, 2, 4 and 8 threads.
+void heap_bench_run();
+
+// Fixed-size object_pool_t alloc/free throughput against heap_alloc.
+// Uses the sizes of fs_work_t, packet_t, model_command_t and trace events.
+void object_pool_bench_run();
+
+// queue_t push/pop throughput for SPSC, MPSC and MPMC, plus single-item round-trip latency.
+// Compares the lock-free ring against the semaphore-based queue it replaced,
+// and spsc_queue_t on the single-producer, single-consumer cases.
+// Reports per-item cost of queue_push_n/queue_pop_n at batch sizes 1, 8, 64 and 512.
+void queue_bench_run();
+
+// Job system fork/join scaling from one worker up to one per core.
+// Runs a flat fan-out of leaf jobs and a recursive binary split that waits inside jobs.
+void jobs_bench_run();
+
+// ECS query throughput over a mixed scene of 1K, 10K and 100K entities.
+// Compares sparse against archetype storage, and a serial query loop against
+// ecs_query_for_each_parallel on every core.
+// Reports the cost of a query with a handful of matches among all those entities.
+// Reports ecs_update cost with a few entities respawned every frame.
+void ecs_bench_run();
+
+// Broad-phase grid cost per frame with 1K, 4K and 16K colliders all moving.
+// Reports broadphase_move over every collider and broadphase_find_pairs against a brute-force
+// test of every pair, and checks that both find the same number of pairs.
+void broadphase_bench_run();
+
+// Nanoseconds per box for collision_set_overlap against frogger's old per-corner test,
+// testing one box against sets of 64, 512 and 4096.
+void collision_bench_run();
+
+// Nanoseconds per call of mat4f_mul, mat4f_transform and mat4f_invert against their SIMD
+// versions, and per point of mat4f_transform_n against a mat4f_transform loop.
+void mat4f_bench_run();
+
+// Matrices per second from transform_to_matrix_n against transform_to_matrix, and the same
+// comparison for transform_multiply_n and quatf_rotate_vec_n.
+// Runs over 1K transforms, which stay in cache, and 64K, which do not.
+void transform_bench_run();
+
+// Nanoseconds per trace_duration_push and trace_duration_pop pair while capturing, from 1,
+// 4 and 8 threads recording at once, and how long trace_capture_stop then takes to write
+// what was not streamed out during the capture.
+void trace_bench_run();
@@ -0,0 +1,315 @@
+#include "broadphase.h"
+
+#include "heap.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+enum
+{
+	// Hash buckets for grid cells, a power of two.
+	// Cells that hash to the same bucket share it, entries record which cell they belong to.
+	k_broadphase_bucket_count = 1 << 14,
+};
+
+typedef struct broadphase_proxy_t
+{
+	broadphase_aabb_t aabb;
+	void* user;
+	uint32_t category;
+	uint32_t collide_mask;
+
+	// Range of cells the box was last inserted into.
+	int min_cell_x;
+	int min_cell_y;
+	int max_cell_x;
+	int max_cell_y;
+
+	// Next proxy on the free list once removed.
+	int next_free;
+	bool active;
+} broadphase_proxy_t;
+
+typedef struct broadphase_entry_t
+{
+	int proxy;
+	int cell_x;
+	int cell_y;
+} broadphase_entry_t;
+
+typedef struct broadphase_bucket_t
+{
+	broadphase_entry_t* entries;
+	int count;
+	int capacity;
+	// Position in the occupied list while count is non-zero.
+	int occupied_index;
+} broadphase_bucket_t;
+
+typedef struct broadphase_t
+{
+	heap_t* heap;
+	float inv_cell_size;
+
+	broadphase_proxy_t* proxies;
+	int proxy_count;
+	int proxy_capacity;
+	int free_head;
+
+	broadphase_bucket_t* buckets;
+
+	// Indices of the buckets holding any entries, so finding pairs skips the empty ones.
+	int* occupied;
+	int occupied_count;
+
+	broadphase_pair_t* pairs;
+	int pair_capacity;
+} broadphase_t;
+
+broadphase_t* broadphase_create(heap_t* heap, float cell_size)
+{
+	broadphase_t* broadphase = heap_alloc(heap, sizeof(broadphase_t), 8);
+	broadphase->heap = heap;
+	broadphase->inv_cell_size = 1.0f / cell_size;
+	broadphase->proxies = NULL;
+	broadphase->proxy_count = 0;
+	broadphase->proxy_capacity = 0;
+	broadphase->free_head = -1;
+	broadphase->buckets = heap_alloc(heap, sizeof(broadphase_bucket_t) * k_broadphase_bucket_count, 8);
+	memset(broadphase->buckets, 0, sizeof(broadphase_bucket_t) * k_broadphase_bucket_count);
+	broadphase->occupied = heap_alloc(heap, sizeof(int) * k_broadphase_bucket_count, 8);
+	broadphase->occupied_count = 0;
+	broadphase->pairs = NULL;
+	broadphase->pair_capacity = 0;
+	return broadphase;
+}
+
+void broadphase_destroy(broadphase_t* broadphase)
+{
+	for (int i = 0; i < k_broadphase_bucket_count; ++i)
+	{
+		heap_free(broadphase->heap, broadphase->buckets[i].entries);
+	}
+	heap_free(broadphase->heap, broadphase->buckets);
+	heap_free(broadphase->heap, broadphase->occupied);
+	heap_free(broadphase->heap, broadphase->proxies);
+	heap_free(broadphase->heap, broadphase->pairs);
+	heap_free(broadphase->heap, broadphase);
+}
+
+static int broadphase_get_cell(broadphase_t* broadphase, float coordinate)
+{
+	return (int)floorf(coordinate * broadphase->inv_cell_size);
+}
+
+static broadphase_bucket_t* broadphase_get_bucket(broadphase_t* broadphase, int cell_x, int cell_y)
+{
+	unsigned int hash = ((unsigned int)cell_x * 73856093u) ^ ((unsigned int)cell_y * 19349663u);
+	return &broadphase->buckets[hash & (k_broadphase_bucket_count - 1)];
+}
+
+static void broadphase_insert(broadphase_t* broadphase, int proxy_index)
+{
+	broadphase_proxy_t* proxy = &broadphase->proxies[proxy_index];
+	for (int y = proxy->min_cell_y; y <= proxy->max_cell_y; ++y)
+	{
+		for (int x = proxy->min_cell_x; x <= proxy->max_cell_x; ++x)
+		{
+			broadphase_bucket_t* bucket = broadphase_get_bucket(broadphase, x, y);
+			if (bucket->count == 0)
+			{
+				bucket->occupied_index = broadphase->occupied_count;
+				broadphase->occupied[broadphase->occupied_count++] = (int)(bucket - broadphase->buckets);
+			}
+			if (bucket->count == bucket->capacity)
+			{
+				int new_capacity = __max(bucket->capacity * 2, 4);
+				broadphase_entry_t* new_entries = heap_alloc(broadphase->heap, sizeof(broadphase_entry_t) * new_capacity, 8);
+				memcpy(new_entries, bucket->entries, sizeof(broadphase_entry_t) * bucket->count);
+				heap_free(broadphase->heap, bucket->entries);
+				bucket->entries = new_entries;
+				bucket->capacity = new_capacity;
+			}
+			bucket->entries[bucket->count++] = (broadphase_entry_t){ proxy_index, x, y };
+		}
+	}
+}
+
+static void broadphase_erase(broadphase_t* broadphase, int proxy_index)
+{
+	broadphase_proxy_t* proxy = &broadphase->proxies[proxy_index];
+	for (int y = proxy->min_cell_y; y <= proxy->max_cell_y; ++y)
+	{
+		for (int x = proxy->min_cell_x; x <= proxy->max_cell_x; ++x)
+		{
+			broadphase_bucket_t* bucket = broadphase_get_bucket(broadphase, x, y);
+			for (int i = 0; i < bucket->count; ++i)
+			{
+				broadphase_entry_t* entry = &bucket->entries[i];
+				if (entry->proxy == proxy_index && entry->cell_x == x && entry->cell_y == y)
+				{
+					*entry = bucket->entries[--bucket->count];
+					if (bucket->count == 0)
+					{
+						//Swap the last occupied bucket into this one's place
+						int moved = broadphase->occupied[--broadphase->occupied_count];
+						broadphase->occupied[bucket->occupied_index] = moved;
+						broadphase->buckets[moved].occupied_index = bucket->occupied_index;
+					}
+					break;
+				}
+			}
+		}
+	}
+}
+
+int broadphase_add(broadphase_t* broadphase, const broadphase_aabb_t* aabb, uint32_t category, uint32_t collide_mask, void* user)
+{
+	int proxy_index = broadphase->free_head;
+	if (proxy_index >= 0)
+	{
+		broadphase->free_head = broadphase->proxies[proxy_index].next_free;
+	}
+	else
+	{
+		if (broadphase->proxy_count == broadphase->proxy_capacity)
+		{
+			int new_capacity = __max(broadphase->proxy_capacity * 2, 64);
+			broadphase_proxy_t* new_proxies = heap_alloc(broadphase->heap, sizeof(broadphase_proxy_t) * new_capacity, 8);
+			memcpy(new_proxies, broadphase->proxies, sizeof(broadphase_proxy_t) * broadphase->proxy_count);
+			heap_free(broadphase->heap, broadphase->proxies);
+			broadphase->proxies = new_proxies;
+			broadphase->proxy_capacity = new_capacity;
+		}
+		proxy_index = broadphase->proxy_count++;
+	}
+
+	broadphase_proxy_t* proxy = &broadphase->proxies[proxy_index];
+	proxy->aabb = *aabb;
+	proxy->user = user;
+	proxy->category = category;
+	proxy->collide_mask = collide_mask;
+	proxy->min_cell_x = broadphase_get_cell(broadphase, aabb->min_x);
+	proxy->min_cell_y = broadphase_get_cell(broadphase, aabb->min_y);
+	proxy->max_cell_x = broadphase_get_cell(broadphase, aabb->max_x);
+	proxy->max_cell_y = broadphase_get_cell(broadphase, aabb->max_y);
+	proxy->next_free = -1;
+	proxy->active = true;
+	broadphase_insert(broadphase, proxy_index);
+	return proxy_index;
+}
+
+static bool broadphase_is_active(broadphase_t* broadphase, int proxy_index)
+{
+	return proxy_index >= 0 && proxy_index < broadphase->proxy_count && broadphase->proxies[proxy_index].active;
+}
+
+void broadphase_remove(broadphase_t* broadphase, int proxy_index)
+{
+	if (!broadphase_is_active(broadphase, proxy_index))
+	{
+		return;
+	}
+
+	broadphase_proxy_t* proxy = &broadphase->proxies[proxy_index];
+	broadphase_erase(broadphase, proxy_index);
+	proxy->active = false;
+	proxy->next_free = broadphase->free_head;
+	broadphase->free_head = proxy_index;
+}
+
+void broadphase_move(broadphase_t* broadphase, int proxy_index, const broadphase_aabb_t* aabb)
+{
+	if (!broadphase_is_active(broadphase, proxy_index))
+	{
+		return;
+	}
+
+	broadphase_proxy_t* proxy = &broadphase->proxies[proxy_index];
+	proxy->aabb = *aabb;
+
+	int min_cell_x = broadphase_get_cell(broadphase, aabb->min_x);
+	int min_cell_y = broadphase_get_cell(broadphase, aabb->min_y);
+	int max_cell_x = broadphase_get_cell(broadphase, aabb->max_x);
+	int max_cell_y = broadphase_get_cell(broadphase, aabb->max_y);
+	if (min_cell_x == proxy->min_cell_x && min_cell_y == proxy->min_cell_y &&
+		max_cell_x == proxy->max_cell_x && max_cell_y == proxy->max_cell_y)
+	{
+		return;
+	}
+
+	broadphase_erase(broadphase, proxy_index);
+	proxy->min_cell_x = min_cell_x;
+	proxy->min_cell_y = min_cell_y;
+	proxy->max_cell_x = max_cell_x;
+	proxy->max_cell_y = max_cell_y;
+	broadphase_insert(broadphase, proxy_index);
+}
+
+static bool broadphase_aabb_overlap(const broadphase_aabb_t* a, const broadphase_aabb_t* b)
+{
+	return a->min_x <= b->max_x && b->min_x <= a->max_x && a->min_y <= b->max_y && b->min_y <= a->max_y;
+}
+
+int broadphase_find_pairs(broadphase_t* broadphase, const broadphase_pair_t** pairs)
+{
+	int pair_count = 0;
+	for (int b = 0; b < broadphase->occupied_count; ++b)
+	{
+		broadphase_bucket_t* bucket = &broadphase->buckets[broadphase->occupied[b]];
+		for (int i = 0; i < bucket->count; ++i)
+		{
+			broadphase_entry_t* entry_a = &bucket->entries[i];
+			broadphase_proxy_t* proxy_a = &broadphase->proxies[entry_a->proxy];
+			for (int j = i + 1; j < bucket->count; ++j)
+			{
+				broadphase_entry_t* entry_b = &bucket->entries[j];
+				if (entry_b->cell_x != entry_a->cell_x || entry_b->cell_y != entry_a->cell_y)
+				{
+					continue;
+				}
+
+				broadphase_proxy_t* proxy_b = &broadphase->proxies[entry_b->proxy];
+				if (!(proxy_a->category & proxy_b->collide_mask) || !(proxy_b->category & proxy_a->collide_mask))
+				{
+					continue;
+				}
+				if (!broadphase_aabb_overlap(&proxy_a->aabb, &proxy_b->aabb))
+				{
+					continue;
+				}
+
+				//Boxes that share several cells meet in each of them
+				//Only report the pair from the cell holding the corner of their intersection
+				float corner_x = __max(proxy_a->aabb.min_x, proxy_b->aabb.min_x);
+				float corner_y = __max(proxy_a->aabb.min_y, proxy_b->aabb.min_y);
+				if (broadphase_get_cell(broadphase, corner_x) != entry_a->cell_x ||
+					broadphase_get_cell(broadphase, corner_y) != entry_a->cell_y)
+				{
+					continue;
+				}
+
+				if (pair_count == broadphase->pair_capacity)
+				{
+					int new_capacity = __max(broadphase->pair_capacity * 2, 64);
+					broadphase_pair_t* new_pairs = heap_alloc(broadphase->heap, sizeof(broadphase_pair_t) * new_capacity, 8);
+					memcpy(new_pairs, broadphase->pairs, sizeof(broadphase_pair_t) * pair_count);
+					heap_free(broadphase->heap, broadphase->pairs);
+					broadphase->pairs = new_pairs;
+					broadphase->pair_capacity = new_capacity;
+				}
+				broadphase->pairs[pair_count++] = (broadphase_pair_t)
+				{
+					.proxy_a = entry_a->proxy,
+					.proxy_b = entry_b->proxy,
+					.user_a = proxy_a->user,
+					.user_b = proxy_b->user,
+				};
+			}
+		}
+	}
+
+	*pairs = broadphase->pairs;
+	return pair_count;
+}
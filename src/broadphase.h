@@ -0,0 +1,59 @@
+#pragma once
+
+// Broad-phase collision detection.
+// Finds pairs of axis-aligned boxes in a plane that overlap, as candidates for an
+// exact narrow-phase test.
+
+// Boxes are bucketed into a uniform grid of square cells. The grid is hashed, so it has
+// no bounds. Moving a box only touches the grid when it crosses into different cells.
+
+#include <stdint.h>
+
+typedef struct heap_t heap_t;
+
+// Handle to a broad-phase grid.
+typedef struct broadphase_t broadphase_t;
+
+// Axis-aligned box.
+typedef struct broadphase_aabb_t
+{
+	float min_x;
+	float min_y;
+	float max_x;
+	float max_y;
+} broadphase_aabb_t;
+
+// Two boxes that overlap, by proxy and the user pointer each was added with.
+typedef struct broadphase_pair_t
+{
+	int proxy_a;
+	int proxy_b;
+	void* user_a;
+	void* user_b;
+} broadphase_pair_t;
+
+// Create a broad-phase grid.
+// cell_size should be around the size of a typical box: much smaller and boxes span
+// many cells, much larger and many boxes share each cell.
+broadphase_t* broadphase_create(heap_t* heap, float cell_size);
+
+// Destroy a previously created broad-phase grid.
+void broadphase_destroy(broadphase_t* broadphase);
+
+// Add a box and return its proxy handle.
+// Two boxes are only paired if each one's category has a bit in the other's collide_mask.
+// user is returned with any pair the box is part of.
+int broadphase_add(broadphase_t* broadphase, const broadphase_aabb_t* aabb, uint32_t category, uint32_t collide_mask, void* user);
+
+// Remove a box. Its proxy handle may be reused by a later add.
+// Does nothing for a proxy that is not in the grid, such as -1 or one already removed.
+void broadphase_remove(broadphase_t* broadphase, int proxy);
+
+// Update the bounds of a box.
+// Does nothing for a proxy that is not in the grid, such as -1 or one already removed.
+void broadphase_move(broadphase_t* broadphase, int proxy, const broadphase_aabb_t* aabb);
+
+// Find every pair of boxes that overlap, touching edges included, and whose categories match.
+// Each pair is reported once. Returns the number of pairs and points pairs at them.
+// The pairs are valid until the next call.
+int broadphase_find_pairs(broadphase_t* broadphase, const broadphase_pair_t** pairs);
@@ -0,0 +1,175 @@
+#include "bench.h"
+
+#include "broadphase.h"
+#include "debug.h"
+#include "heap.h"
+#include "timer.h"
+
+#include <math.h>
+#include <stdbool.h>
+
+enum
+{
+	k_bench_frames = 60,
+
+	// Brute force is quadratic, so it is only timed over a few frames.
+	k_bench_brute_frames = 4,
+
+	// Each frame one body in this many is despawned and respawned, as frogger does with traffic.
+	k_bench_respawn_interval = 16,
+};
+
+typedef struct broadphase_bench_body_t
+{
+	float x;
+	float y;
+	float velocity_x;
+	float velocity_y;
+	float half_width;
+	float half_height;
+	int proxy;
+} broadphase_bench_body_t;
+
+static broadphase_aabb_t broadphase_bench_get_aabb(const broadphase_bench_body_t* body)
+{
+	return (broadphase_aabb_t)
+	{
+		.min_x = body->x - body->half_width,
+		.min_y = body->y - body->half_height,
+		.max_x = body->x + body->half_width,
+		.max_y = body->y + body->half_height,
+	};
+}
+
+//Moves every body and bounces it off the edges of the world
+static void broadphase_bench_step(broadphase_bench_body_t* bodies, int count, float world_size, float dt)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		broadphase_bench_body_t* body = &bodies[i];
+		body->x += body->velocity_x * dt;
+		body->y += body->velocity_y * dt;
+		if (body->x < 0.0f || body->x > world_size)
+		{
+			body->velocity_x = -body->velocity_x;
+		}
+		if (body->y < 0.0f || body->y > world_size)
+		{
+			body->velocity_y = -body->velocity_y;
+		}
+	}
+}
+
+static int broadphase_bench_brute_force(const broadphase_bench_body_t* bodies, int count)
+{
+	int pair_count = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		broadphase_aabb_t a = broadphase_bench_get_aabb(&bodies[i]);
+		for (int j = i + 1; j < count; ++j)
+		{
+			broadphase_aabb_t b = broadphase_bench_get_aabb(&bodies[j]);
+			if (a.min_x <= b.max_x && b.min_x <= a.max_x && a.min_y <= b.max_y && b.min_y <= a.max_y)
+			{
+				++pair_count;
+			}
+		}
+	}
+	return pair_count;
+}
+
+static void run_test(heap_t* heap, int count)
+{
+	//Same density at every count, about one body per 16 square units
+	float world_size = sqrtf((float)count * 16.0f);
+	float dt = 1.0f / 60.0f;
+
+	broadphase_bench_body_t* bodies = heap_alloc(heap, sizeof(broadphase_bench_body_t) * count, 8);
+	unsigned int seed = 0x12345678u;
+	for (int i = 0; i < count; ++i)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		float r0 = (float)(seed >> 8) / (float)(1 << 24);
+		seed = seed * 1664525u + 1013904223u;
+		float r1 = (float)(seed >> 8) / (float)(1 << 24);
+
+		broadphase_bench_body_t* body = &bodies[i];
+		body->x = r0 * world_size;
+		body->y = r1 * world_size;
+		body->velocity_x = (r1 - 0.5f) * 20.0f;
+		body->velocity_y = (r0 - 0.5f) * 20.0f;
+		body->half_width = 0.5f + r0;
+		body->half_height = 0.5f + r1;
+	}
+
+	broadphase_t* broadphase = broadphase_create(heap, 4.0f);
+	for (int i = 0; i < count; ++i)
+	{
+		broadphase_aabb_t aabb = broadphase_bench_get_aabb(&bodies[i]);
+		bodies[i].proxy = broadphase_add(broadphase, &aabb, 1, 1, &bodies[i]);
+	}
+
+	uint64_t move_ticks = 0;
+	uint64_t find_ticks = 0;
+	int pair_count = 0;
+	for (int frame = 0; frame < k_bench_frames; ++frame)
+	{
+		broadphase_bench_step(bodies, count, world_size, dt);
+
+		uint64_t t0 = timer_get_ticks();
+		//Despawned bodies keep being moved with a proxy of -1 until they respawn, which the grid ignores
+		for (int i = frame % k_bench_respawn_interval; i < count; i += k_bench_respawn_interval)
+		{
+			broadphase_remove(broadphase, bodies[i].proxy);
+			bodies[i].proxy = -1;
+		}
+		for (int i = 0; i < count; ++i)
+		{
+			broadphase_aabb_t aabb = broadphase_bench_get_aabb(&bodies[i]);
+			broadphase_move(broadphase, bodies[i].proxy, &aabb);
+		}
+		for (int i = frame % k_bench_respawn_interval; i < count; i += k_bench_respawn_interval)
+		{
+			broadphase_aabb_t aabb = broadphase_bench_get_aabb(&bodies[i]);
+			bodies[i].proxy = broadphase_add(broadphase, &aabb, 1, 1, &bodies[i]);
+		}
+		uint64_t t1 = timer_get_ticks();
+		const broadphase_pair_t* pairs;
+		pair_count = broadphase_find_pairs(broadphase, &pairs);
+		uint64_t t2 = timer_get_ticks();
+
+		move_ticks += t1 - t0;
+		find_ticks += t2 - t1;
+	}
+
+	uint64_t t0 = timer_get_ticks();
+	int brute_pair_count = 0;
+	for (int frame = 0; frame < k_bench_brute_frames; ++frame)
+	{
+		brute_pair_count = broadphase_bench_brute_force(bodies, count);
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	double move_ms = timer_ticks_to_us(move_ticks) / 1000.0 / k_bench_frames;
+	double find_ms = timer_ticks_to_us(find_ticks) / 1000.0 / k_bench_frames;
+	double brute_ms = timer_ticks_to_us(t1 - t0) / 1000.0 / k_bench_brute_frames;
+	debug_print(k_print_warning, "broadphase colliders=%d move ms=%.3f find_pairs ms=%.3f brute force ms=%.3f pairs=%d%s\n",
+		count, move_ms, find_ms, brute_ms, pair_count,
+		pair_count == brute_pair_count ? "" : " MISMATCH");
+
+	broadphase_destroy(broadphase);
+	heap_free(heap, bodies);
+}
+
+void broadphase_bench_run()
+{
+	heap_t* heap = heap_create(2 * 1024 * 1024, k_heap_tracking_none);
+
+	//About as many colliders as frogger, where empty grid cells must not dominate
+	run_test(heap, 32);
+	run_test(heap, 1000);
+	run_test(heap, 4000);
+	run_test(heap, 16000);
+
+	heap_destroy(heap);
+}
@@ -0,0 +1,167 @@
+#include "collision.h"
+
+#include "cpu.h"
+#include "heap.h"
+
+#include <immintrin.h>
+#include <intrin.h>
+#include <string.h>
+
+typedef struct collision_set_t
+{
+	heap_t* heap;
+
+	float* min_x;
+	float* min_y;
+	float* max_x;
+	float* max_y;
+	void** users;
+	int count;
+	int capacity;
+
+	int* hits;
+} collision_set_t;
+
+collision_set_t* collision_set_create(heap_t* heap)
+{
+	collision_set_t* set = heap_alloc(heap, sizeof(collision_set_t), 8);
+	memset(set, 0, sizeof(*set));
+	set->heap = heap;
+	return set;
+}
+
+static void collision_set_free_arrays(collision_set_t* set)
+{
+	heap_free(set->heap, set->min_x);
+	heap_free(set->heap, set->min_y);
+	heap_free(set->heap, set->max_x);
+	heap_free(set->heap, set->max_y);
+	heap_free(set->heap, set->users);
+	heap_free(set->heap, set->hits);
+}
+
+void collision_set_destroy(collision_set_t* set)
+{
+	collision_set_free_arrays(set);
+	heap_free(set->heap, set);
+}
+
+void collision_set_clear(collision_set_t* set)
+{
+	set->count = 0;
+}
+
+static float* collision_set_grow_array(collision_set_t* set, float* array, int new_capacity)
+{
+	float* new_array = heap_alloc(set->heap, sizeof(float) * new_capacity, 32);
+	memcpy(new_array, array, sizeof(float) * set->count);
+	heap_free(set->heap, array);
+	return new_array;
+}
+
+int collision_set_add(collision_set_t* set, const broadphase_aabb_t* aabb, void* user)
+{
+	if (set->count == set->capacity)
+	{
+		//Stays a multiple of eight, so every AVX batch loads whole registers from within the arrays
+		int new_capacity = __max(set->capacity * 2, 64);
+		set->min_x = collision_set_grow_array(set, set->min_x, new_capacity);
+		set->min_y = collision_set_grow_array(set, set->min_y, new_capacity);
+		set->max_x = collision_set_grow_array(set, set->max_x, new_capacity);
+		set->max_y = collision_set_grow_array(set, set->max_y, new_capacity);
+
+		void** new_users = heap_alloc(set->heap, sizeof(void*) * new_capacity, 8);
+		memcpy(new_users, set->users, sizeof(void*) * set->count);
+		heap_free(set->heap, set->users);
+		set->users = new_users;
+
+		heap_free(set->heap, set->hits);
+		set->hits = heap_alloc(set->heap, sizeof(int) * new_capacity, 8);
+		set->capacity = new_capacity;
+	}
+
+	int index = set->count++;
+	set->min_x[index] = aabb->min_x;
+	set->min_y[index] = aabb->min_y;
+	set->max_x[index] = aabb->max_x;
+	set->max_y[index] = aabb->max_y;
+	set->users[index] = user;
+	return index;
+}
+
+int collision_set_get_count(collision_set_t* set)
+{
+	return set->count;
+}
+
+void* collision_set_get_user(collision_set_t* set, int index)
+{
+	return set->users[index];
+}
+
+//Appends the index of every set bit in mask, offset by base
+static int collision_append_hits(int* hits, int hit_count, unsigned long mask, int base)
+{
+	unsigned long bit;
+	while (_BitScanForward(&bit, mask))
+	{
+		hits[hit_count++] = base + (int)bit;
+		mask &= mask - 1;
+	}
+	return hit_count;
+}
+
+int collision_set_overlap(collision_set_t* set, const broadphase_aabb_t* aabb, const int** hits)
+{
+	//Lanes past count read stale or unused slots within capacity, their bits are masked off
+	int hit_count = 0;
+	if (cpu_has_avx2())
+	{
+		__m256 box_min_x = _mm256_set1_ps(aabb->min_x);
+		__m256 box_min_y = _mm256_set1_ps(aabb->min_y);
+		__m256 box_max_x = _mm256_set1_ps(aabb->max_x);
+		__m256 box_max_y = _mm256_set1_ps(aabb->max_y);
+		for (int i = 0; i < set->count; i += 8)
+		{
+			__m256 overlap = _mm256_and_ps(
+				_mm256_cmp_ps(box_min_x, _mm256_load_ps(set->max_x + i), _CMP_LT_OQ),
+				_mm256_cmp_ps(_mm256_load_ps(set->min_x + i), box_max_x, _CMP_LT_OQ));
+			overlap = _mm256_and_ps(overlap, _mm256_and_ps(
+				_mm256_cmp_ps(box_min_y, _mm256_load_ps(set->max_y + i), _CMP_LT_OQ),
+				_mm256_cmp_ps(_mm256_load_ps(set->min_y + i), box_max_y, _CMP_LT_OQ)));
+
+			unsigned long mask = (unsigned long)_mm256_movemask_ps(overlap);
+			if (set->count - i < 8)
+			{
+				mask &= (1ul << (set->count - i)) - 1;
+			}
+			hit_count = collision_append_hits(set->hits, hit_count, mask, i);
+		}
+	}
+	else
+	{
+		__m128 box_min_x = _mm_set1_ps(aabb->min_x);
+		__m128 box_min_y = _mm_set1_ps(aabb->min_y);
+		__m128 box_max_x = _mm_set1_ps(aabb->max_x);
+		__m128 box_max_y = _mm_set1_ps(aabb->max_y);
+		for (int i = 0; i < set->count; i += 4)
+		{
+			__m128 overlap = _mm_and_ps(
+				_mm_cmplt_ps(box_min_x, _mm_load_ps(set->max_x + i)),
+				_mm_cmplt_ps(_mm_load_ps(set->min_x + i), box_max_x));
+			overlap = _mm_and_ps(overlap, _mm_and_ps(
+				_mm_cmplt_ps(box_min_y, _mm_load_ps(set->max_y + i)),
+				_mm_cmplt_ps(_mm_load_ps(set->min_y + i), box_max_y)));
+
+			unsigned long mask = (unsigned long)_mm_movemask_ps(overlap);
+			if (set->count - i < 4)
+			{
+				mask &= (1ul << (set->count - i)) - 1;
+			}
+			hit_count = collision_append_hits(set->hits, hit_count, mask, i);
+		}
+	}
+
+	*hits = set->hits;
+	return hit_count;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+// Narrow-phase collision tests.
+// A collision set holds boxes as separate min and max arrays, so one box can be tested
+// against four or eight of them per instruction with SSE or AVX2.
+
+#include "broadphase.h"
+
+typedef struct heap_t heap_t;
+
+// Handle to a set of boxes.
+typedef struct collision_set_t collision_set_t;
+
+// Create an empty collision set.
+collision_set_t* collision_set_create(heap_t* heap);
+
+// Destroy a previously created collision set.
+void collision_set_destroy(collision_set_t* set);
+
+// Remove every box from the set.
+void collision_set_clear(collision_set_t* set);
+
+// Add a box and return its index. user is returned by collision_set_get_user.
+int collision_set_add(collision_set_t* set, const broadphase_aabb_t* aabb, void* user);
+
+// Returns the number of boxes in the set.
+int collision_set_get_count(collision_set_t* set);
+
+// Returns the user pointer a box was added with.
+void* collision_set_get_user(collision_set_t* set, int index);
+
+// Find every box in the set that overlaps aabb. Boxes that only touch do not overlap.
+// Returns the number of boxes hit and points hits at their indices, in increasing order.
+// The indices are valid until the next call.
+int collision_set_overlap(collision_set_t* set, const broadphase_aabb_t* aabb, const int** hits);
@@ -0,0 +1,134 @@
+#include "bench.h"
+
+#include "collision.h"
+#include "cpu.h"
+#include "debug.h"
+#include "heap.h"
+#include "timer.h"
+
+#include <stdbool.h>
+
+enum
+{
+	// Box tests per measurement, split into queries over the whole set.
+	k_bench_tests = 1 << 22,
+};
+
+//One box against many the way frogger tested them before, one branchy check per corner
+static bool collision_bench_corner_test(const broadphase_aabb_t* a, const broadphase_aabb_t* b)
+{
+	if (a->min_x > b->min_x && a->min_x < b->max_x && a->max_y < b->max_y && a->max_y > b->min_y)
+	{
+		return true;
+	}
+	else if (a->min_x > b->min_x && a->min_x < b->max_x && a->min_y < b->max_y && a->min_y > b->min_y)
+	{
+		return true;
+	}
+	else if (a->max_x > b->min_x && a->max_x < b->max_x && a->max_y < b->max_y && a->max_y > b->min_y)
+	{
+		return true;
+	}
+	else if (a->max_x > b->min_x && a->max_x < b->max_x && a->min_y < b->max_y && a->min_y > b->min_y)
+	{
+		return true;
+	}
+	return false;
+}
+
+//Reference for collision_set_overlap, touching boxes do not overlap
+static bool collision_bench_overlap(const broadphase_aabb_t* a, const broadphase_aabb_t* b)
+{
+	return a->min_x < b->max_x && b->min_x < a->max_x && a->min_y < b->max_y && b->min_y < a->max_y;
+}
+
+//Checks every query's hit list against the scalar reference, index for index
+static bool collision_bench_verify(heap_t* heap, collision_set_t* set, const broadphase_aabb_t* boxes, int count, int queries)
+{
+	int* expected = heap_alloc(heap, sizeof(int) * count, 8);
+	bool match = true;
+	for (int q = 0; q < queries && match; ++q)
+	{
+		float y = (float)(q % 384);
+		broadphase_aabb_t box = { .min_x = y, .min_y = -1.5f, .max_x = y + 2.0f, .max_y = 0.5f };
+		int expected_count = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			if (collision_bench_overlap(&box, &boxes[i]))
+			{
+				expected[expected_count++] = i;
+			}
+		}
+
+		const int* hits;
+		int hit_count = collision_set_overlap(set, &box, &hits);
+		match = hit_count == expected_count;
+		for (int i = 0; i < hit_count && match; ++i)
+		{
+			match = hits[i] == expected[i];
+		}
+	}
+	heap_free(heap, expected);
+	return match;
+}
+
+static void run_test(heap_t* heap, int count)
+{
+	//Rows of cars like frogger traffic, with the query box sweeping along them
+	broadphase_aabb_t* boxes = heap_alloc(heap, sizeof(broadphase_aabb_t) * count, 8);
+	collision_set_t* set = collision_set_create(heap);
+	for (int i = 0; i < count; ++i)
+	{
+		float y = (float)(i % 64) * 6.0f;
+		float z = (float)(i / 64) * -5.0f;
+		boxes[i] = (broadphase_aabb_t){ .min_x = y, .min_y = z - 1.0f, .max_x = y + 4.0f, .max_y = z + 1.0f };
+		collision_set_add(set, &boxes[i], &boxes[i]);
+	}
+
+	int queries = k_bench_tests / count;
+	int scalar_hits = 0;
+	uint64_t t0 = timer_get_ticks();
+	for (int q = 0; q < queries; ++q)
+	{
+		float y = (float)(q % 384);
+		broadphase_aabb_t box = { .min_x = y, .min_y = -1.5f, .max_x = y + 2.0f, .max_y = 0.5f };
+		for (int i = 0; i < count; ++i)
+		{
+			scalar_hits += collision_bench_corner_test(&box, &boxes[i]);
+		}
+	}
+	uint64_t t1 = timer_get_ticks();
+	int simd_hits = 0;
+	for (int q = 0; q < queries; ++q)
+	{
+		float y = (float)(q % 384);
+		broadphase_aabb_t box = { .min_x = y, .min_y = -1.5f, .max_x = y + 2.0f, .max_y = 0.5f };
+		const int* hits;
+		simd_hits += collision_set_overlap(set, &box, &hits);
+	}
+	uint64_t t2 = timer_get_ticks();
+
+	bool match = collision_bench_verify(heap, set, boxes, count, queries);
+
+	double tests = (double)queries * count;
+	debug_print(k_print_warning, "collision boxes=%d ns/box corner test=%.3f collision_set_overlap=%.3f hits=%d/%d%s\n",
+		count, timer_ticks_to_us(t1 - t0) * 1000.0 / tests, timer_ticks_to_us(t2 - t1) * 1000.0 / tests,
+		scalar_hits, simd_hits, match ? "" : " MISMATCH");
+
+	collision_set_destroy(set);
+	heap_free(heap, boxes);
+}
+
+void collision_bench_run()
+{
+	heap_t* heap = heap_create(2 * 1024 * 1024, k_heap_tracking_none);
+
+	debug_print(k_print_warning, "collision_set_overlap uses %s\n", cpu_has_avx2() ? "AVX2" : "SSE");
+	//Not a multiple of the SIMD width, so the padded tail is checked too
+	run_test(heap, 61);
+	run_test(heap, 64);
+	run_test(heap, 512);
+	run_test(heap, 4096);
+
+	heap_destroy(heap);
+}
@@ -0,0 +1,33 @@
+#include "cpu.h"
+
+#include <immintrin.h>
+#include <intrin.h>
+
+static int s_has_avx2 = -1;
+
+bool cpu_has_avx2()
+{
+	//Racing threads compute the same answer, so no synchronization is needed
+	if (s_has_avx2 < 0)
+	{
+		int info[4];
+		__cpuid(info, 0);
+		int max_leaf = info[0];
+
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+
+		bool avx2 = false;
+		if (max_leaf >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+		}
+
+		//The OS must also preserve the upper halves of the YMM registers across context switches
+		bool ymm_enabled = osxsave && (_xgetbv(0) & 6) == 6;
+		s_has_avx2 = avx && avx2 && ymm_enabled;
+	}
+	return s_has_avx2 != 0;
+}
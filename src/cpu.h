@@ -0,0 +1,9 @@
+#pragma once
+
+// Processor feature detection.
+
+#include <stdbool.h>
+
+// Returns true if the processor and OS support AVX2 instructions and 256-bit registers.
+// SSE2 is assumed, every x64 processor has it.
+bool cpu_has_avx2();
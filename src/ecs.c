@@ -1,14 +1,32 @@
 #include "ecs.h"
 
+#include "atomic.h"
 #include "debug.h"
 #include "heap.h"
+#include "jobs.h"
+#include "mutex.h"
 
+#include <limits.h>
 #include <string.h>
 
 enum
 {
+	// One bit per type in a uint64_t component mask.
 	k_max_component_types = 64,
-	k_max_entities = 512,
+
+	// Entity slots are allocated a page at a time as the live entity count grows.
+	// Pages never move, so new entities can be added while other threads read existing ones.
+	k_ecs_page_shift = 10,
+	k_ecs_page_entities = 1 << k_ecs_page_shift,
+	k_ecs_max_pages = 4096,
+
+	// Archetype storage packs entities into chunks of about this many bytes.
+	k_ecs_chunk_bytes = 16 * 1024,
+	k_ecs_chunk_alignment = 64,
+	k_ecs_max_archetypes = 1024,
+
+	// Distinct component masks that can be queried.
+	k_ecs_max_query_caches = 256,
 };
 
 typedef enum entity_state_t
@@ -19,72 +37,565 @@ typedef enum entity_state_t
 	k_entity_pending_remove,
 } entity_state_t;
 
+typedef struct ecs_archetype_t ecs_archetype_t;
+
+// Fixed-size block of entities that share an archetype.
+// Followed in memory by the entity index of each row, then one array per component type.
+typedef struct ecs_chunk_t
+{
+	ecs_archetype_t* archetype;
+	struct ecs_chunk_t* next;
+	struct ecs_chunk_t* prev;
+	// Rows in use. Rows from active_count on hold pending adds, which queries skip.
+	int count;
+	int active_count;
+} ecs_chunk_t;
+
+// Every entity with exactly this component mask, in a list of chunks.
+// Only the last chunk has free rows; removal moves the last row into the hole.
+typedef struct ecs_archetype_t
+{
+	uint64_t mask;
+	int chunk_rows;
+	size_t chunk_bytes;
+	size_t entities_offset;
+	// Offset of each component type's array from the start of a chunk, 0 if not in the mask.
+	size_t component_offsets[k_max_component_types];
+	ecs_chunk_t* first_chunk;
+	ecs_chunk_t* last_chunk;
+} ecs_archetype_t;
+
+// Everything that currently matches one query mask, kept up to date as entities come and go,
+// so iterating a query costs time in proportion to its matches.
+typedef struct ecs_query_cache_t
+{
+	uint64_t mask;
+
+	// Sparse storage: active entities that match, in the order they became active.
+	// Retiring an entity only bumps stale_count; its entry is dropped the next time a query starts.
+	ecs_entity_ref_t* entities;
+	int entity_count;
+	int entity_capacity;
+	int stale_count;
+
+	// Archetype storage: indices of matching archetypes.
+	// Sized for every possible archetype, so it never moves while a parallel query reads it.
+	int* archetypes;
+	int archetype_count;
+} ecs_query_cache_t;
+
+typedef struct ecs_page_t
+{
+	int sequences[k_ecs_page_entities];
+	entity_state_t entity_states[k_ecs_page_entities];
+	uint64_t component_masks[k_ecs_page_entities];
+	// Next slot on the free list, only meaningful while a slot is unused.
+	int next_free[k_ecs_page_entities];
+
+	// Sparse storage: one array per component type, indexed by slot.
+	void* components[k_max_component_types];
+
+	// Archetype storage: where each slot's components live.
+	ecs_chunk_t* chunks[k_ecs_page_entities];
+	int rows[k_ecs_page_entities];
+} ecs_page_t;
+
 typedef struct ecs_t
 {
 	heap_t* heap;
+	ecs_storage_t storage;
 	int global_sequence;
 
-	int sequences[k_max_entities];
-	entity_state_t entity_states[k_max_entities];
-	uint64_t component_masks[k_max_entities];
+	// While a parallel query runs, adds and removes are serialized by the mutex,
+	// and removed entities only change state once the query completes.
+	mutex_t* structure_mutex;
+	bool in_parallel_query;
 
-	void* components[k_max_component_types];
+	// Entities added or removed since the last ecs_update, so it only touches what changed.
+	int* pending_adds;
+	int pending_add_count;
+	int pending_add_capacity;
+	int* pending_removes;
+	int pending_remove_count;
+	int pending_remove_capacity;
+
+	ecs_page_t* pages[k_ecs_max_pages];
+	int page_count;
+	// First unused entity slot, -1 if every page is full.
+	int free_head;
+
+	//Archetypes never move, so one can be created while a parallel query reads the others
+	ecs_archetype_t* archetypes[k_ecs_max_archetypes];
+	int archetype_count;
+
+	ecs_query_cache_t* query_caches[k_ecs_max_query_caches];
+	int query_cache_count;
+
+	int component_type_count;
 	size_t component_type_sizes[k_max_component_types];
+	size_t component_type_alignments[k_max_component_types];
 	char component_type_names[k_max_component_types][32];
 } ecs_t;
 
-ecs_t* ecs_create(heap_t* heap)
+static void ecs_append_entity(ecs_t* ecs, int** entities, int* count, int* capacity, int entity)
+{
+	if (*count == *capacity)
+	{
+		int new_capacity = __max(*capacity * 2, 64);
+		int* new_entities = heap_alloc(ecs->heap, sizeof(int) * new_capacity, 8);
+		memcpy(new_entities, *entities, sizeof(int) * *count);
+		heap_free(ecs->heap, *entities);
+		*entities = new_entities;
+		*capacity = new_capacity;
+	}
+	(*entities)[(*count)++] = entity;
+}
+
+static ecs_page_t* ecs_get_page(ecs_t* ecs, int entity)
+{
+	return ecs->pages[entity >> k_ecs_page_shift];
+}
+
+static int ecs_get_slot(int entity)
+{
+	return entity & (k_ecs_page_entities - 1);
+}
+
+//Read by parallel query jobs while ecs_entity_add may be adding a page, see ecs_add_page
+static int ecs_get_entity_capacity(ecs_t* ecs)
+{
+	return atomic_load(&ecs->page_count) * k_ecs_page_entities;
+}
+
+static int* ecs_chunk_get_entities(ecs_chunk_t* chunk)
+{
+	return (int*)((char*)chunk + chunk->archetype->entities_offset);
+}
+
+static void* ecs_chunk_get_component(ecs_t* ecs, ecs_chunk_t* chunk, int row, int component_type)
+{
+	return (char*)chunk + chunk->archetype->component_offsets[component_type] + ecs->component_type_sizes[component_type] * row;
+}
+
+static ecs_archetype_t* ecs_get_archetype(ecs_t* ecs, uint64_t mask)
+{
+	for (int i = 0; i < ecs->archetype_count; ++i)
+	{
+		if (ecs->archetypes[i]->mask == mask)
+		{
+			return ecs->archetypes[i];
+		}
+	}
+	if (ecs->archetype_count == k_ecs_max_archetypes)
+	{
+		return NULL;
+	}
+
+	ecs_archetype_t* archetype = heap_alloc(ecs->heap, sizeof(ecs_archetype_t), 8);
+	memset(archetype, 0, sizeof(*archetype));
+	archetype->mask = mask;
+
+	//Fit as many rows as the chunk size allows, leaving room to align each array
+	size_t header_size = (sizeof(ecs_chunk_t) + 7) & ~(size_t)7;
+	size_t row_size = sizeof(int);
+	size_t padding = 0;
+	for (int i = 0; i < ecs->component_type_count; ++i)
+	{
+		if (mask & (1ULL << i))
+		{
+			row_size += ecs->component_type_sizes[i];
+			padding += ecs->component_type_alignments[i] - 1;
+		}
+	}
+	size_t usable_size = k_ecs_chunk_bytes - header_size - padding;
+	archetype->chunk_rows = (int)__max(usable_size / row_size, 1);
+
+	size_t offset = header_size;
+	archetype->entities_offset = offset;
+	offset += sizeof(int) * archetype->chunk_rows;
+	for (int i = 0; i < ecs->component_type_count; ++i)
+	{
+		if (mask & (1ULL << i))
+		{
+			size_t alignment = ecs->component_type_alignments[i];
+			offset = (offset + (alignment - 1)) & ~(alignment - 1);
+			archetype->component_offsets[i] = offset;
+			offset += ecs->component_type_sizes[i] * archetype->chunk_rows;
+		}
+	}
+	archetype->chunk_bytes = offset;
+
+	ecs->archetypes[ecs->archetype_count] = archetype;
+	for (int i = 0; i < ecs->query_cache_count; ++i)
+	{
+		ecs_query_cache_t* cache = ecs->query_caches[i];
+		if ((mask & cache->mask) == cache->mask)
+		{
+			cache->archetypes[cache->archetype_count++] = ecs->archetype_count;
+		}
+	}
+	ecs->archetype_count++;
+	return archetype;
+}
+
+static ecs_chunk_t* ecs_add_chunk(ecs_t* ecs, ecs_archetype_t* archetype)
+{
+	ecs_chunk_t* chunk = heap_alloc(ecs->heap, archetype->chunk_bytes, k_ecs_chunk_alignment);
+	memset(chunk, 0, archetype->chunk_bytes);
+	chunk->archetype = archetype;
+	chunk->prev = archetype->last_chunk;
+
+	//Link last, queries on other threads may be walking the list
+	if (archetype->last_chunk)
+	{
+		archetype->last_chunk->next = chunk;
+	}
+	else
+	{
+		archetype->first_chunk = chunk;
+	}
+	archetype->last_chunk = chunk;
+	return chunk;
+}
+
+static bool ecs_archetype_add_entity(ecs_t* ecs, int entity, uint64_t mask)
+{
+	ecs_archetype_t* archetype = ecs_get_archetype(ecs, mask);
+	if (!archetype)
+	{
+		debug_print(k_print_warning, "Out of archetypes.");
+		return false;
+	}
+
+	ecs_chunk_t* chunk = archetype->last_chunk;
+	if (!chunk || chunk->count == archetype->chunk_rows)
+	{
+		chunk = ecs_add_chunk(ecs, archetype);
+	}
+	int row = chunk->count++;
+	ecs_chunk_get_entities(chunk)[row] = entity;
+
+	ecs_page_t* page = ecs_get_page(ecs, entity);
+	page->chunks[ecs_get_slot(entity)] = chunk;
+	page->rows[ecs_get_slot(entity)] = row;
+	return true;
+}
+
+static void ecs_archetype_remove_entity(ecs_t* ecs, int entity)
+{
+	ecs_page_t* page = ecs_get_page(ecs, entity);
+	ecs_chunk_t* chunk = page->chunks[ecs_get_slot(entity)];
+	int row = page->rows[ecs_get_slot(entity)];
+	ecs_archetype_t* archetype = chunk->archetype;
+
+	//Keep the archetype packed by moving its last row into the hole
+	ecs_chunk_t* last_chunk = archetype->last_chunk;
+	int last_row = last_chunk->count - 1;
+	if (chunk != last_chunk || row != last_row)
+	{
+		for (int i = 0; i < ecs->component_type_count; ++i)
+		{
+			if (archetype->mask & (1ULL << i))
+			{
+				memcpy(ecs_chunk_get_component(ecs, chunk, row, i), ecs_chunk_get_component(ecs, last_chunk, last_row, i), ecs->component_type_sizes[i]);
+			}
+		}
+		int moved_entity = ecs_chunk_get_entities(last_chunk)[last_row];
+		ecs_chunk_get_entities(chunk)[row] = moved_entity;
+		ecs_page_t* moved_page = ecs_get_page(ecs, moved_entity);
+		moved_page->chunks[ecs_get_slot(moved_entity)] = chunk;
+		moved_page->rows[ecs_get_slot(moved_entity)] = row;
+	}
+
+	last_chunk->count--;
+	last_chunk->active_count = __min(last_chunk->active_count, last_chunk->count);
+	if (last_chunk->count == 0)
+	{
+		archetype->last_chunk = last_chunk->prev;
+		if (archetype->last_chunk)
+		{
+			archetype->last_chunk->next = NULL;
+		}
+		else
+		{
+			archetype->first_chunk = NULL;
+		}
+		heap_free(ecs->heap, last_chunk);
+	}
+}
+
+static void ecs_page_alloc_components(ecs_t* ecs, ecs_page_t* page, int component_type)
+{
+	size_t size = ecs->component_type_sizes[component_type] * k_ecs_page_entities;
+	page->components[component_type] = heap_alloc(ecs->heap, size, ecs->component_type_alignments[component_type]);
+	memset(page->components[component_type], 0, size);
+}
+
+static bool ecs_add_page(ecs_t* ecs)
+{
+	if (ecs->page_count == k_ecs_max_pages)
+	{
+		return false;
+	}
+
+	ecs_page_t* page = heap_alloc(ecs->heap, sizeof(ecs_page_t), 8);
+	memset(page, 0, sizeof(*page));
+	for (int i = 0; i < ecs->component_type_count && ecs->storage == k_ecs_storage_sparse; ++i)
+	{
+		ecs_page_alloc_components(ecs, page, i);
+	}
+
+	//Thread the new slots onto the free list so they are handed out in order
+	int first_entity = ecs->page_count * k_ecs_page_entities;
+	for (int i = 0; i < k_ecs_page_entities - 1; ++i)
+	{
+		page->next_free[i] = first_entity + i + 1;
+	}
+	page->next_free[k_ecs_page_entities - 1] = ecs->free_head;
+	ecs->free_head = first_entity;
+
+	//Publish the page before the count that makes it reachable
+	ecs->pages[ecs->page_count] = page;
+	atomic_store(&ecs->page_count, ecs->page_count + 1);
+	return true;
+}
+
+static void ecs_query_cache_add_entity(ecs_t* ecs, ecs_query_cache_t* cache, int entity)
+{
+	if (cache->entity_count == cache->entity_capacity)
+	{
+		int capacity = __max(cache->entity_capacity * 2, 64);
+		ecs_entity_ref_t* entities = heap_alloc(ecs->heap, sizeof(ecs_entity_ref_t) * capacity, 8);
+		memcpy(entities, cache->entities, sizeof(ecs_entity_ref_t) * cache->entity_count);
+		heap_free(ecs->heap, cache->entities);
+		cache->entities = entities;
+		cache->entity_capacity = capacity;
+	}
+	cache->entities[cache->entity_count++] = (ecs_entity_ref_t) { .entity = entity, .sequence = ecs_get_page(ecs, entity)->sequences[ecs_get_slot(entity)] };
+}
+
+//Sparse storage: an entity has just become active or just been retired
+static void ecs_query_caches_on_activate(ecs_t* ecs, int entity)
+{
+	uint64_t mask = ecs_get_page(ecs, entity)->component_masks[ecs_get_slot(entity)];
+	for (int i = 0; i < ecs->query_cache_count; ++i)
+	{
+		if ((mask & ecs->query_caches[i]->mask) == ecs->query_caches[i]->mask)
+		{
+			ecs_query_cache_add_entity(ecs, ecs->query_caches[i], entity);
+		}
+	}
+}
+
+static void ecs_query_caches_on_retire(ecs_t* ecs, int entity)
+{
+	uint64_t mask = ecs_get_page(ecs, entity)->component_masks[ecs_get_slot(entity)];
+	for (int i = 0; i < ecs->query_cache_count; ++i)
+	{
+		if ((mask & ecs->query_caches[i]->mask) == ecs->query_caches[i]->mask)
+		{
+			ecs->query_caches[i]->stale_count++;
+		}
+	}
+}
+
+//Find or build the cache for a mask and drop any retired entries
+//Returns -1 if there are too many distinct query masks
+static int ecs_get_query_cache(ecs_t* ecs, uint64_t mask)
+{
+	bool lock = ecs->in_parallel_query;
+	if (lock)
+	{
+		mutex_lock(ecs->structure_mutex);
+	}
+
+	int index = 0;
+	while (index < ecs->query_cache_count && ecs->query_caches[index]->mask != mask)
+	{
+		++index;
+	}
+
+	if (index == ecs->query_cache_count && index < k_ecs_max_query_caches)
+	{
+		ecs_query_cache_t* cache = heap_alloc(ecs->heap, sizeof(ecs_query_cache_t), 8);
+		memset(cache, 0, sizeof(*cache));
+		cache->mask = mask;
+		if (ecs->storage == k_ecs_storage_archetype)
+		{
+			cache->archetypes = heap_alloc(ecs->heap, sizeof(int) * k_ecs_max_archetypes, 8);
+			for (int i = 0; i < ecs->archetype_count; ++i)
+			{
+				if ((ecs->archetypes[i]->mask & mask) == mask)
+				{
+					cache->archetypes[cache->archetype_count++] = i;
+				}
+			}
+		}
+		else
+		{
+			//One full scan when a mask is first queried, maintained incrementally after that
+			for (int p = 0; p < ecs->page_count; ++p)
+			{
+				ecs_page_t* page = ecs->pages[p];
+				for (int i = 0; i < k_ecs_page_entities; ++i)
+				{
+					if ((page->component_masks[i] & mask) == mask && page->entity_states[i] >= k_entity_active)
+					{
+						ecs_query_cache_add_entity(ecs, cache, p * k_ecs_page_entities + i);
+					}
+				}
+			}
+		}
+		ecs->query_caches[index] = cache;
+		ecs->query_cache_count++;
+	}
+
+	if (index < ecs->query_cache_count)
+	{
+		ecs_query_cache_t* cache = ecs->query_caches[index];
+		if (cache->stale_count > 0)
+		{
+			int kept = 0;
+			for (int i = 0; i < cache->entity_count; ++i)
+			{
+				ecs_entity_ref_t ref = cache->entities[i];
+				ecs_page_t* page = ecs_get_page(ecs, ref.entity);
+				int slot = ecs_get_slot(ref.entity);
+				if (page->sequences[slot] == ref.sequence && page->entity_states[slot] >= k_entity_active)
+				{
+					cache->entities[kept++] = ref;
+				}
+			}
+			cache->entity_count = kept;
+			cache->stale_count = 0;
+		}
+	}
+	else
+	{
+		debug_print(k_print_warning, "Out of query caches.");
+		index = -1;
+	}
+
+	if (lock)
+	{
+		mutex_unlock(ecs->structure_mutex);
+	}
+	return index;
+}
+
+ecs_t* ecs_create(heap_t* heap, ecs_storage_t storage)
 {
 	ecs_t* ecs = heap_alloc(heap, sizeof(ecs_t), 8);
 	memset(ecs, 0, sizeof(*ecs));
 	ecs->heap = heap;
+	ecs->storage = storage;
 	ecs->global_sequence = 1;
+	ecs->structure_mutex = mutex_create();
+	ecs->free_head = -1;
 	return ecs;
 }
 
 void ecs_destroy(ecs_t* ecs)
 {
-	for (int i = 0; i < _countof(ecs->components); ++i)
+	for (int i = 0; i < ecs->page_count; ++i)
 	{
-		if (ecs->components[i])
+		for (int j = 0; j < ecs->component_type_count; ++j)
 		{
-			heap_free(ecs->heap, ecs->components[i]);
+			heap_free(ecs->heap, ecs->pages[i]->components[j]);
 		}
+		heap_free(ecs->heap, ecs->pages[i]);
 	}
+	for (int i = 0; i < ecs->archetype_count; ++i)
+	{
+		ecs_chunk_t* chunk = ecs->archetypes[i]->first_chunk;
+		while (chunk)
+		{
+			ecs_chunk_t* next = chunk->next;
+			heap_free(ecs->heap, chunk);
+			chunk = next;
+		}
+		heap_free(ecs->heap, ecs->archetypes[i]);
+	}
+	for (int i = 0; i < ecs->query_cache_count; ++i)
+	{
+		heap_free(ecs->heap, ecs->query_caches[i]->entities);
+		heap_free(ecs->heap, ecs->query_caches[i]->archetypes);
+		heap_free(ecs->heap, ecs->query_caches[i]);
+	}
+	heap_free(ecs->heap, ecs->pending_adds);
+	heap_free(ecs->heap, ecs->pending_removes);
+	mutex_destroy(ecs->structure_mutex);
 	heap_free(ecs->heap, ecs);
 }
 
 void ecs_update(ecs_t* ecs)
 {
-	for (int i = 0; i < _countof(ecs->entity_states); ++i)
+	for (int i = 0; i < ecs->pending_add_count; ++i)
 	{
-		if (ecs->entity_states[i] == k_entity_pending_add)
+		int entity = ecs->pending_adds[i];
+		ecs_page_t* page = ecs_get_page(ecs, entity);
+		int slot = ecs_get_slot(entity);
+		if (ecs->storage == k_ecs_storage_archetype)
+		{
+			//Pending rows are at the end of their archetype, so this makes every row active
+			//Rows of entities already removed again are retired below, like any other row
+			ecs_chunk_t* chunk = page->chunks[slot];
+			chunk->active_count = chunk->count;
+		}
+		if (page->entity_states[slot] == k_entity_pending_add)
+		{
+			page->entity_states[slot] = k_entity_active;
+			if (ecs->storage == k_ecs_storage_sparse)
+			{
+				ecs_query_caches_on_activate(ecs, entity);
+			}
+		}
+	}
+	ecs->pending_add_count = 0;
+
+	for (int i = 0; i < ecs->pending_remove_count; ++i)
+	{
+		int entity = ecs->pending_removes[i];
+		ecs_page_t* page = ecs_get_page(ecs, entity);
+		int slot = ecs_get_slot(entity);
+		//Skip entities removed more than once
+		if (page->entity_states[slot] != k_entity_pending_remove)
+		{
+			continue;
+		}
+		page->entity_states[slot] = k_entity_unused;
+		page->next_free[slot] = ecs->free_head;
+		ecs->free_head = entity;
+		if (ecs->storage == k_ecs_storage_archetype)
 		{
-			ecs->entity_states[i] = k_entity_active;
+			ecs_archetype_remove_entity(ecs, entity);
 		}
-		else if (ecs->entity_states[i] == k_entity_pending_remove)
+		else
 		{
-			ecs->entity_states[i] = k_entity_unused;
+			ecs_query_caches_on_retire(ecs, entity);
 		}
 	}
+	ecs->pending_remove_count = 0;
 }
 
 int ecs_register_component_type(ecs_t* ecs, const char* name, size_t size_per_component, size_t alignment)
 {
-	for (int i = 0; i < _countof(ecs->components); ++i)
+	if (ecs->component_type_count == k_max_component_types)
 	{
-		if (ecs->components[i] == NULL)
-		{
-			size_t aligned_size = (size_per_component + (alignment - 1)) & ~(alignment - 1);
-			strcpy_s(ecs->component_type_names[i], sizeof(ecs->component_type_names[i]), name);
-			ecs->component_type_sizes[i] = aligned_size;
-			ecs->components[i] = heap_alloc(ecs->heap, aligned_size * k_max_entities, alignment);
-			memset(ecs->components[i], 0, aligned_size * k_max_entities);
-			return i;
-		}
+		debug_print(k_print_warning, "Out of component types.");
+		return -1;
+	}
+
+	int i = ecs->component_type_count++;
+	size_t aligned_size = (size_per_component + (alignment - 1)) & ~(alignment - 1);
+	strcpy_s(ecs->component_type_names[i], sizeof(ecs->component_type_names[i]), name);
+	ecs->component_type_sizes[i] = aligned_size;
+	ecs->component_type_alignments[i] = alignment;
+	for (int p = 0; p < ecs->page_count && ecs->storage == k_ecs_storage_sparse; ++p)
+	{
+		ecs_page_alloc_components(ecs, ecs->pages[p], i);
 	}
-	debug_print(k_print_warning, "Out of component types.");
-	return -1;
+	return i;
 }
 
 size_t ecs_get_component_type_size(ecs_t* ecs, int component_type)
@@ -94,52 +605,99 @@ size_t ecs_get_component_type_size(ecs_t* ecs, int component_type)
 
 ecs_entity_ref_t ecs_entity_add(ecs_t* ecs, uint64_t component_mask)
 {
-	for (int i = 0; i < _countof(ecs->entity_states); ++i)
+	//New entities are pending until the next ecs_update, so a running query never sees them
+	//and only the slot search itself needs protecting
+	bool lock = ecs->in_parallel_query;
+	if (lock)
 	{
-		if (ecs->entity_states[i] == k_entity_unused)
+		mutex_lock(ecs->structure_mutex);
+	}
+
+	ecs_entity_ref_t ref = { .entity = -1, .sequence = -1 };
+	if (ecs->free_head >= 0 || ecs_add_page(ecs))
+	{
+		int entity = ecs->free_head;
+		ecs_page_t* page = ecs_get_page(ecs, entity);
+		int slot = ecs_get_slot(entity);
+		if (ecs->storage == k_ecs_storage_sparse || ecs_archetype_add_entity(ecs, entity, component_mask))
 		{
-			ecs->entity_states[i] = k_entity_pending_add;
-			ecs->sequences[i] = ecs->global_sequence++;
-			ecs->component_masks[i] = component_mask;
-			return (ecs_entity_ref_t) { .entity = i, .sequence = ecs->sequences[i] };
+			ecs->free_head = page->next_free[slot];
+			page->entity_states[slot] = k_entity_pending_add;
+			page->sequences[slot] = ecs->global_sequence++;
+			page->component_masks[slot] = component_mask;
+			ref = (ecs_entity_ref_t) { .entity = entity, .sequence = page->sequences[slot] };
+			ecs_append_entity(ecs, &ecs->pending_adds, &ecs->pending_add_count, &ecs->pending_add_capacity, entity);
 		}
 	}
-	debug_print(k_print_warning, "Out of entities.");
-	return (ecs_entity_ref_t) { .entity = -1, .sequence = -1 };
+
+	if (lock)
+	{
+		mutex_unlock(ecs->structure_mutex);
+	}
+	if (ref.entity < 0)
+	{
+		debug_print(k_print_warning, "Out of entities.");
+	}
+	return ref;
 }
 
 void ecs_entity_remove(ecs_t* ecs, ecs_entity_ref_t ref, bool allow_pending_add)
 {
-	if (ecs_is_entity_ref_valid(ecs, ref, allow_pending_add))
+	if (!ecs_is_entity_ref_valid(ecs, ref, allow_pending_add))
 	{
-		ecs->entity_states[ref.entity] = k_entity_pending_remove;
+		debug_print(k_print_warning, "Attempting to remove inactive entity.");
+		return;
 	}
-	else
+
+	if (ecs->in_parallel_query)
 	{
-		debug_print(k_print_warning, "Attempting to remove inactive entity.");
+		//Other chunks may be looking at this entity, so it changes state once they are all done
+		mutex_lock(ecs->structure_mutex);
+		ecs_append_entity(ecs, &ecs->pending_removes, &ecs->pending_remove_count, &ecs->pending_remove_capacity, ref.entity);
+		mutex_unlock(ecs->structure_mutex);
+		return;
 	}
+
+	ecs_get_page(ecs, ref.entity)->entity_states[ecs_get_slot(ref.entity)] = k_entity_pending_remove;
+	ecs_append_entity(ecs, &ecs->pending_removes, &ecs->pending_remove_count, &ecs->pending_remove_capacity, ref.entity);
 }
 
 bool ecs_is_entity_ref_valid(ecs_t* ecs, ecs_entity_ref_t ref, bool allow_pending_add)
 {
-	return ref.entity >= 0 &&
-		ecs->sequences[ref.entity] == ref.sequence &&
-		ecs->entity_states[ref.entity] >= (allow_pending_add ? k_entity_pending_add : k_entity_active);
+	if (ref.entity < 0 || ref.entity >= ecs_get_entity_capacity(ecs))
+	{
+		return false;
+	}
+	ecs_page_t* page = ecs_get_page(ecs, ref.entity);
+	int slot = ecs_get_slot(ref.entity);
+	return page->sequences[slot] == ref.sequence &&
+		page->entity_states[slot] >= (allow_pending_add ? k_entity_pending_add : k_entity_active);
 }
 
 void* ecs_entity_get_component(ecs_t* ecs, ecs_entity_ref_t ref, int component_type, bool allow_pending_add)
 {
-	if (ecs_is_entity_ref_valid(ecs, ref, allow_pending_add) && ecs->components[component_type])
+	if (!ecs_is_entity_ref_valid(ecs, ref, allow_pending_add) || component_type < 0 || component_type >= ecs->component_type_count)
 	{
-		char* components = ecs->components[component_type];
-		return &components[ecs->component_type_sizes[component_type] * ref.entity];
+		return NULL;
 	}
-	return NULL;
+
+	ecs_page_t* page = ecs_get_page(ecs, ref.entity);
+	int slot = ecs_get_slot(ref.entity);
+	if (ecs->storage == k_ecs_storage_archetype)
+	{
+		if (!(page->component_masks[slot] & (1ULL << component_type)))
+		{
+			return NULL;
+		}
+		return ecs_chunk_get_component(ecs, page->chunks[slot], page->rows[slot], component_type);
+	}
+	char* components = page->components[component_type];
+	return &components[ecs->component_type_sizes[component_type] * slot];
 }
 
 ecs_query_t ecs_query_create(ecs_t* ecs, uint64_t mask)
 {
-	ecs_query_t query = { .component_mask = mask, .entity = -1 };
+	ecs_query_t query = { .component_mask = mask, .entity = -1, .cache = ecs_get_query_cache(ecs, mask), .index = -1, .end_index = INT_MAX, .row = -1 };
 	ecs_query_next(ecs, &query);
 	return query;
 }
@@ -149,26 +707,250 @@ bool ecs_query_is_valid(ecs_t* ecs, ecs_query_t* query)
 	return query->entity >= 0;
 }
 
-void ecs_query_next(ecs_t* ecs, ecs_query_t* query)
+static void ecs_query_next_archetype(ecs_t* ecs, ecs_query_t* query)
 {
-	for (int i = query->entity + 1; i < _countof(ecs->component_masks); ++i)
+	ecs_query_cache_t* cache = ecs->query_caches[query->cache];
+	ecs_chunk_t* chunk = query->chunk;
+	int row = query->row + 1;
+	while (true)
 	{
-		if ((ecs->component_masks[i] & query->component_mask) == query->component_mask && ecs->entity_states[i] >= k_entity_active)
+		if (chunk && row < (query->single_chunk ? __min(chunk->active_count, query->end_index) : chunk->active_count))
 		{
-			query->entity = i;
+			query->chunk = chunk;
+			query->row = row;
+			query->entity = ecs_chunk_get_entities(chunk)[row];
 			return;
 		}
+		if (chunk && query->single_chunk)
+		{
+			break;
+		}
+		if (chunk && chunk->next)
+		{
+			chunk = chunk->next;
+			row = 0;
+			continue;
+		}
+		if (query->index + 1 >= cache->archetype_count)
+		{
+			break;
+		}
+		query->index++;
+		chunk = ecs->archetypes[cache->archetypes[query->index]]->first_chunk;
+		row = 0;
 	}
+	query->chunk = NULL;
 	query->entity = -1;
 }
 
+void ecs_query_next(ecs_t* ecs, ecs_query_t* query)
+{
+	if (query->cache < 0)
+	{
+		query->entity = -1;
+		return;
+	}
+	if (ecs->storage == k_ecs_storage_archetype)
+	{
+		ecs_query_next_archetype(ecs, query);
+		return;
+	}
+
+	ecs_query_cache_t* cache = ecs->query_caches[query->cache];
+	int end = __min(query->end_index, cache->entity_count);
+	if (query->index + 1 < end)
+	{
+		query->index++;
+		query->entity = cache->entities[query->index].entity;
+	}
+	else
+	{
+		query->entity = -1;
+	}
+}
+
 void* ecs_query_get_component(ecs_t* ecs, ecs_query_t* query, int component_type)
 {
-	char* components = ecs->components[component_type];
-	return &components[ecs->component_type_sizes[component_type] * query->entity];
+	if (ecs->storage == k_ecs_storage_archetype)
+	{
+		return ecs_chunk_get_component(ecs, query->chunk, query->row, component_type);
+	}
+	char* components = ecs_get_page(ecs, query->entity)->components[component_type];
+	return &components[ecs->component_type_sizes[component_type] * ecs_get_slot(query->entity)];
 }
 
 ecs_entity_ref_t ecs_query_get_entity(ecs_t* ecs, ecs_query_t* query)
 {
-	return (ecs_entity_ref_t) { .entity = query->entity, .sequence = ecs->sequences[query->entity] };
+	return (ecs_entity_ref_t) { .entity = query->entity, .sequence = ecs_get_page(ecs, query->entity)->sequences[ecs_get_slot(query->entity)] };
+}
+
+typedef struct ecs_query_chunk_t
+{
+	ecs_t* ecs;
+	uint64_t mask;
+	int cache;
+	// Sparse storage: range of positions in the query cache.
+	// Archetype storage: range of rows in storage_chunk.
+	int begin_index;
+	int end_index;
+	ecs_chunk_t* storage_chunk;
+	int chunk_index;
+	ecs_query_chunk_func_t function;
+	void* user;
+} ecs_query_chunk_t;
+
+static void ecs_query_chunk_job(void* data)
+{
+	ecs_query_chunk_t* chunk = data;
+	bool archetype = chunk->ecs->storage == k_ecs_storage_archetype;
+	ecs_query_t query =
+	{
+		.component_mask = chunk->mask,
+		.entity = -1,
+		.cache = chunk->cache,
+		.index = archetype ? -1 : chunk->begin_index - 1,
+		.end_index = chunk->end_index,
+		.chunk = chunk->storage_chunk,
+		.row = archetype ? chunk->begin_index - 1 : -1,
+		.single_chunk = true,
+		.chunk_index = chunk->chunk_index,
+	};
+	ecs_query_next(chunk->ecs, &query);
+	if (ecs_query_is_valid(chunk->ecs, &query))
+	{
+		chunk->function(chunk->ecs, &query, chunk->user);
+	}
+}
+
+static int ecs_query_cache_chunk_count(ecs_t* ecs, ecs_query_cache_t* cache, int chunk_size)
+{
+	int chunk_count = 0;
+	if (ecs->storage == k_ecs_storage_archetype)
+	{
+		//Each storage chunk is split on its own so a query chunk never spans two
+		for (int i = 0; i < cache->archetype_count; ++i)
+		{
+			for (ecs_chunk_t* chunk = ecs->archetypes[cache->archetypes[i]]->first_chunk; chunk; chunk = chunk->next)
+			{
+				chunk_count += (chunk->active_count + chunk_size - 1) / chunk_size;
+			}
+		}
+	}
+	else
+	{
+		chunk_count = (cache->entity_count + chunk_size - 1) / chunk_size;
+	}
+	return chunk_count;
+}
+
+int ecs_query_get_chunk_count(ecs_t* ecs, uint64_t mask, int chunk_size)
+{
+	int cache_index = ecs_get_query_cache(ecs, mask);
+	return cache_index >= 0 ? ecs_query_cache_chunk_count(ecs, ecs->query_caches[cache_index], chunk_size) : 0;
+}
+
+//Runs the chunk as a job, or right away when there are no jobs
+static void ecs_query_start_chunk(jobs_t* jobs, ecs_query_chunk_t* chunk, jobs_counter_t* counter)
+{
+	if (jobs)
+	{
+		jobs_run(jobs, ecs_query_chunk_job, chunk, counter);
+	}
+	else
+	{
+		ecs_query_chunk_job(chunk);
+	}
+}
+
+void ecs_query_for_each_parallel(ecs_t* ecs, jobs_t* jobs, uint64_t mask, int chunk_size, ecs_query_chunk_func_t function, void* user)
+{
+	int cache_index = ecs_get_query_cache(ecs, mask);
+	if (cache_index < 0)
+	{
+		return;
+	}
+	ecs_query_cache_t* cache = ecs->query_caches[cache_index];
+
+	int chunk_count = ecs_query_cache_chunk_count(ecs, cache, chunk_size);
+	if (chunk_count <= 1)
+	{
+		jobs = NULL;
+	}
+
+	//On the calling thread each chunk finishes before the next starts, so one will do
+	ecs_query_chunk_t serial_chunk;
+	ecs_query_chunk_t* chunks = NULL;
+	int first_deferred_remove = ecs->pending_remove_count;
+	if (jobs)
+	{
+		chunks = heap_alloc(ecs->heap, sizeof(ecs_query_chunk_t) * chunk_count, 8);
+		ecs->in_parallel_query = true;
+	}
+
+	jobs_counter_t counter = { 0 };
+	if (ecs->storage == k_ecs_storage_archetype)
+	{
+		int chunk_index = 0;
+		for (int i = 0; i < cache->archetype_count; ++i)
+		{
+			for (ecs_chunk_t* storage_chunk = ecs->archetypes[cache->archetypes[i]]->first_chunk; storage_chunk; storage_chunk = storage_chunk->next)
+			{
+				//Rows added since the chunk count was taken are left for the next query
+				int active_count = storage_chunk->active_count;
+				for (int row = 0; row < active_count; row += chunk_size)
+				{
+					ecs_query_chunk_t* chunk = chunks ? &chunks[chunk_index] : &serial_chunk;
+					*chunk = (ecs_query_chunk_t)
+					{
+						.ecs = ecs,
+						.mask = mask,
+						.cache = cache_index,
+						.begin_index = row,
+						.end_index = __min(row + chunk_size, active_count),
+						.storage_chunk = storage_chunk,
+						.chunk_index = chunk_index,
+						.function = function,
+						.user = user,
+					};
+					ecs_query_start_chunk(jobs, chunk, &counter);
+					++chunk_index;
+				}
+			}
+		}
+	}
+	else
+	{
+		int entity_count = cache->entity_count;
+		for (int i = 0; i < chunk_count; ++i)
+		{
+			ecs_query_chunk_t* chunk = chunks ? &chunks[i] : &serial_chunk;
+			*chunk = (ecs_query_chunk_t)
+			{
+				.ecs = ecs,
+				.mask = mask,
+				.cache = cache_index,
+				.begin_index = i * chunk_size,
+				.end_index = __min((i + 1) * chunk_size, entity_count),
+				.chunk_index = i,
+				.function = function,
+				.user = user,
+			};
+			ecs_query_start_chunk(jobs, chunk, &counter);
+		}
+	}
+
+	if (!jobs)
+	{
+		return;
+	}
+	jobs_wait(jobs, &counter);
+
+	ecs->in_parallel_query = false;
+	for (int i = first_deferred_remove; i < ecs->pending_remove_count; ++i)
+	{
+		int entity = ecs->pending_removes[i];
+		ecs_get_page(ecs, entity)->entity_states[ecs_get_slot(entity)] = k_entity_pending_remove;
+	}
+
+	heap_free(ecs->heap, chunks);
 }
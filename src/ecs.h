@@ -7,6 +7,7 @@
 #include <stdint.h>
 
 typedef struct heap_t heap_t;
+typedef struct jobs_t jobs_t;
 
 // Handle to an entity component system interface.
 typedef struct ecs_t ecs_t;
@@ -18,20 +19,57 @@ typedef struct ecs_entity_ref_t
 	int sequence;
 } ecs_entity_ref_t;
 
+// How an entity component system lays out component data.
+typedef enum ecs_storage_t
+{
+	// One array per component type, indexed by entity.
+	// Queries test every entity's mask.
+	k_ecs_storage_sparse,
+	// Entities with the same component mask are packed together in fixed-size chunks,
+	// one array per component type in each chunk.
+	// Queries skip whole archetypes that do not match and walk the rest contiguously.
+	// Removing an entity moves another entity's data into its place during ecs_update.
+	k_ecs_storage_archetype,
+} ecs_storage_t;
+
 // Working data for an active entity query.
+// Queries walk a cache of matches for their mask, so iterating costs time in proportion to
+// the number of matches rather than the number of entities.
 typedef struct ecs_query_t
 {
 	uint64_t component_mask;
 	int entity;
+	// Match cache for the mask, and position in it.
+	// Sparse storage caches entities, archetype storage caches archetypes.
+	int cache;
+	int index;
+	// Sparse storage: iteration stops before this cache position.
+	// Archetype storage with single_chunk: iteration stops before this row.
+	int end_index;
+	// Archetype storage: current storage chunk and row within it.
+	void* chunk;
+	int row;
+	// Archetype storage: iteration stops at the end of the current storage chunk.
+	bool single_chunk;
+	// Parallel queries: which of the query's chunks this is, zero otherwise.
+	int chunk_index;
 } ecs_query_t;
 
-// Create an entity component system.
-ecs_t* ecs_create(heap_t* heap);
+// Callback run on one chunk of a parallel query.
+// The query is positioned at the chunk's first matching entity, if any, and
+// ecs_query_next stops at the end of the chunk. Its chunk_index orders the chunks as
+// they appear in the query, for callbacks that gather results to combine afterwards.
+typedef void (*ecs_query_chunk_func_t)(ecs_t* ecs, ecs_query_t* query, void* user);
+
+// Create an entity component system that stores components as described by storage.
+ecs_t* ecs_create(heap_t* heap, ecs_storage_t storage);
 
 // Destroy an entity component system.
 void ecs_destroy(ecs_t* ecs);
 
 // Per-frame entity component system update.
+// Makes entities added since the last update active and retires removed ones.
+// Only touches entities that were added or removed, not the whole entity table.
 void ecs_update(ecs_t* ecs);
 
 // Register a type of component with the entity system.
@@ -41,6 +79,7 @@ int ecs_register_component_type(ecs_t* ecs, const char* name, size_t size_per_co
 size_t ecs_get_component_type_size(ecs_t* ecs, int component_type);
 
 // Spawn an entity with the masked components and return a reference to it.
+// Storage grows with the number of live entities, up to about four million.
 ecs_entity_ref_t ecs_entity_add(ecs_t* ecs, uint64_t component_mask);
 
 // Destroy an entity.
@@ -57,6 +96,7 @@ bool ecs_is_entity_ref_valid(ecs_t* ecs, ecs_entity_ref_t ref, bool allow_pendin
 void* ecs_entity_get_component(ecs_t* ecs, ecs_entity_ref_t ref, int component_type, bool allow_pending_add);
 
 // Creates a new entity query by component type mask.
+// The first query for a mask scans every entity once to build its match cache.
 ecs_query_t ecs_query_create(ecs_t* ecs, uint64_t mask);
 
 // Determines if the query points at a valid entity.
@@ -70,3 +110,16 @@ void* ecs_query_get_component(ecs_t* ecs, ecs_query_t* query, int component_type
 
 // Get a entity reference for the current query location.
 ecs_entity_ref_t ecs_query_get_entity(ecs_t* ecs, ecs_query_t* query);
+
+// Run function over every entity matching mask, split into chunks of chunk_size matches
+// that run in parallel on the job system. Returns once every chunk has completed.
+// Chunks may run on any thread, so function must only write components of the entities in its chunk.
+// ecs_entity_add and ecs_entity_remove are safe to call from function:
+// added entities are not seen by this query, removals take effect once every chunk has completed.
+// In archetype storage chunks never span storage chunks, so some may hold fewer than chunk_size matches.
+// If jobs is NULL, or everything fits in one chunk, the chunks run in order on the calling thread.
+void ecs_query_for_each_parallel(ecs_t* ecs, jobs_t* jobs, uint64_t mask, int chunk_size, ecs_query_chunk_func_t function, void* user);
+
+// Number of chunks ecs_query_for_each_parallel splits the matches of mask into.
+// Every chunk_index it passes is below this count.
+int ecs_query_get_chunk_count(ecs_t* ecs, uint64_t mask, int chunk_size);
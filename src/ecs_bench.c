@@ -0,0 +1,195 @@
+#include "bench.h"
+
+#include "debug.h"
+#include "ecs.h"
+#include "heap.h"
+#include "jobs.h"
+#include "mat4f.h"
+#include "timer.h"
+#include "transform.h"
+
+enum
+{
+	k_bench_chunk_size = 256,
+	k_bench_repeats = 16,
+
+	// A handful of matches among many entities that do not match, like players among scenery.
+	k_bench_few_matches = 16,
+	k_bench_few_match_queries = 1000,
+
+	// Entities respawned every frame, like frogger traffic.
+	k_bench_churn_per_frame = 16,
+	k_bench_churn_frames = 1000,
+};
+
+typedef struct ecs_bench_t
+{
+	ecs_t* ecs;
+	int transform_type;
+	int velocity_type;
+	int matrix_type;
+	int name_type;
+	float dt;
+} ecs_bench_t;
+
+typedef struct ecs_bench_name_t
+{
+	char name[32];
+} ecs_bench_name_t;
+
+// Typical per-entity system work: integrate a velocity and rebuild the world matrix.
+static void update_chunk(ecs_t* ecs, ecs_query_t* chunk_query, void* user)
+{
+	ecs_bench_t* bench = user;
+	for (ecs_query_t query = *chunk_query; ecs_query_is_valid(ecs, &query); ecs_query_next(ecs, &query))
+	{
+		transform_t* transform = ecs_query_get_component(ecs, &query, bench->transform_type);
+		vec3f_t* velocity = ecs_query_get_component(ecs, &query, bench->velocity_type);
+		mat4f_t* matrix = ecs_query_get_component(ecs, &query, bench->matrix_type);
+		transform->translation = vec3f_add(transform->translation, vec3f_scale(*velocity, bench->dt));
+		transform_to_matrix(transform, matrix);
+	}
+}
+
+static void run_test(heap_t* heap, jobs_t* jobs, ecs_storage_t storage, int entity_count)
+{
+	ecs_bench_t bench;
+	bench.ecs = ecs_create(heap, storage);
+	bench.transform_type = ecs_register_component_type(bench.ecs, "transform", sizeof(transform_t), _Alignof(transform_t));
+	bench.velocity_type = ecs_register_component_type(bench.ecs, "velocity", sizeof(vec3f_t), _Alignof(vec3f_t));
+	bench.matrix_type = ecs_register_component_type(bench.ecs, "matrix", sizeof(mat4f_t), _Alignof(mat4f_t));
+	bench.name_type = ecs_register_component_type(bench.ecs, "name", sizeof(ecs_bench_name_t), _Alignof(ecs_bench_name_t));
+	bench.dt = 0.016f;
+
+	//A mix of entity kinds, like a real scene: every fourth entity is static scenery the query skips,
+	//and half carry an extra component so matches are split across archetypes
+	uint64_t mask = (1ULL << bench.transform_type) | (1ULL << bench.velocity_type) | (1ULL << bench.matrix_type);
+	uint64_t static_mask = (1ULL << bench.transform_type) | (1ULL << bench.matrix_type) | (1ULL << bench.name_type);
+	int match_count = 0;
+	for (int i = 0; i < entity_count; ++i)
+	{
+		uint64_t entity_mask = (i % 4 == 3) ? static_mask : (i % 2) ? mask | (1ULL << bench.name_type) : mask;
+		ecs_entity_ref_t ref = ecs_entity_add(bench.ecs, entity_mask);
+		transform_t* transform = ecs_entity_get_component(bench.ecs, ref, bench.transform_type, true);
+		transform_identity(transform);
+		if ((entity_mask & mask) == mask)
+		{
+			vec3f_t* velocity = ecs_entity_get_component(bench.ecs, ref, bench.velocity_type, true);
+			*velocity = (vec3f_t) { (float)(i % 7), 1.0f, -1.0f };
+			++match_count;
+		}
+	}
+	ecs_update(bench.ecs);
+
+	uint64_t t0 = timer_get_ticks();
+	for (int r = 0; r < k_bench_repeats; ++r)
+	{
+		ecs_query_t query = ecs_query_create(bench.ecs, mask);
+		if (ecs_query_is_valid(bench.ecs, &query))
+		{
+			update_chunk(bench.ecs, &query, &bench);
+		}
+	}
+	uint64_t t1 = timer_get_ticks();
+	for (int r = 0; r < k_bench_repeats; ++r)
+	{
+		ecs_query_for_each_parallel(bench.ecs, jobs, mask, k_bench_chunk_size, update_chunk, &bench);
+	}
+	uint64_t t2 = timer_get_ticks();
+
+	double serial_ns = timer_ticks_to_us(t1 - t0) * 1000.0 / ((double)k_bench_repeats * match_count);
+	double parallel_ns = timer_ticks_to_us(t2 - t1) * 1000.0 / ((double)k_bench_repeats * match_count);
+	debug_print(k_print_warning, "ecs query %s entities=%d matches=%d workers=%d serial ns/match=%.2f parallel ns/match=%.2f speedup=%.2f\n",
+		storage == k_ecs_storage_archetype ? "archetype" : "sparse", entity_count, match_count,
+		jobs_get_worker_count(jobs), serial_ns, parallel_ns, serial_ns / parallel_ns);
+
+	ecs_destroy(bench.ecs);
+}
+
+static void run_few_matches_test(heap_t* heap, ecs_storage_t storage, int entity_count)
+{
+	ecs_t* ecs = ecs_create(heap, storage);
+	int transform_type = ecs_register_component_type(ecs, "transform", sizeof(transform_t), _Alignof(transform_t));
+	int player_type = ecs_register_component_type(ecs, "player", sizeof(int), _Alignof(int));
+
+	uint64_t scenery_mask = (1ULL << transform_type);
+	uint64_t player_mask = (1ULL << transform_type) | (1ULL << player_type);
+	for (int i = 0; i < entity_count; ++i)
+	{
+		ecs_entity_add(ecs, (i % (entity_count / k_bench_few_matches) == 0) ? player_mask : scenery_mask);
+	}
+	ecs_update(ecs);
+
+	int match_count = 0;
+	uint64_t t0 = timer_get_ticks();
+	for (int r = 0; r < k_bench_few_match_queries; ++r)
+	{
+		for (ecs_query_t query = ecs_query_create(ecs, player_mask); ecs_query_is_valid(ecs, &query); ecs_query_next(ecs, &query))
+		{
+			++match_count;
+		}
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	debug_print(k_print_warning, "ecs query %s entities=%d matches=%d us/query=%.3f\n",
+		storage == k_ecs_storage_archetype ? "archetype" : "sparse", entity_count, match_count / k_bench_few_match_queries,
+		(double)timer_ticks_to_us(t1 - t0) / k_bench_few_match_queries);
+
+	ecs_destroy(ecs);
+}
+
+static void run_churn_test(heap_t* heap, ecs_storage_t storage, int entity_count)
+{
+	ecs_t* ecs = ecs_create(heap, storage);
+	int transform_type = ecs_register_component_type(ecs, "transform", sizeof(transform_t), _Alignof(transform_t));
+	uint64_t mask = (1ULL << transform_type);
+
+	ecs_entity_ref_t* refs = heap_alloc(heap, sizeof(ecs_entity_ref_t) * entity_count, 8);
+	for (int i = 0; i < entity_count; ++i)
+	{
+		refs[i] = ecs_entity_add(ecs, mask);
+	}
+	ecs_update(ecs);
+
+	uint64_t update_ticks = 0;
+	int next = 0;
+	for (int f = 0; f < k_bench_churn_frames; ++f)
+	{
+		for (int i = 0; i < k_bench_churn_per_frame; ++i)
+		{
+			ecs_entity_remove(ecs, refs[next], false);
+			refs[next] = ecs_entity_add(ecs, mask);
+			next = (next + 1) % entity_count;
+		}
+		uint64_t t0 = timer_get_ticks();
+		ecs_update(ecs);
+		update_ticks += timer_get_ticks() - t0;
+	}
+
+	debug_print(k_print_warning, "ecs update %s entities=%d churn/frame=%d us/update=%.3f\n",
+		storage == k_ecs_storage_archetype ? "archetype" : "sparse", entity_count, k_bench_churn_per_frame,
+		(double)timer_ticks_to_us(update_ticks) / k_bench_churn_frames);
+
+	heap_free(heap, refs);
+	ecs_destroy(ecs);
+}
+
+void ecs_bench_run()
+{
+	heap_t* heap = heap_create(2 * 1024 * 1024, k_heap_tracking_none);
+	jobs_t* jobs = jobs_create(heap, 0, NULL);
+
+	int counts[] = { 1000, 10000, 100000 };
+	for (int i = 0; i < _countof(counts); ++i)
+	{
+		run_test(heap, jobs, k_ecs_storage_sparse, counts[i]);
+		run_test(heap, jobs, k_ecs_storage_archetype, counts[i]);
+		run_few_matches_test(heap, k_ecs_storage_sparse, counts[i]);
+		run_few_matches_test(heap, k_ecs_storage_archetype, counts[i]);
+		run_churn_test(heap, k_ecs_storage_sparse, counts[i]);
+		run_churn_test(heap, k_ecs_storage_archetype, counts[i]);
+	}
+
+	jobs_destroy(jobs);
+	heap_destroy(heap);
+}
@@ -0,0 +1,119 @@
+#include "frame_arena.h"
+
+#include "heap.h"
+
+#include <stdint.h>
+#include <string.h>
+
+//Block from the heap used once a frame outgrows its region, released on reset
+typedef struct frame_arena_overflow_t
+{
+	struct frame_arena_overflow_t* next;
+} frame_arena_overflow_t;
+
+typedef struct frame_arena_region_t
+{
+	char* base;
+	size_t used;
+	size_t overflow_bytes;
+	frame_arena_overflow_t* overflow;
+} frame_arena_region_t;
+
+typedef struct frame_arena_t
+{
+	heap_t* heap;
+	size_t region_size;
+	int region_count;
+	frame_arena_region_t* current;
+	frame_arena_region_t* regions;
+	frame_arena_stats_t stats;
+} frame_arena_t;
+
+frame_arena_t* frame_arena_create(heap_t* heap, int region_count, size_t region_size)
+{
+	frame_arena_t* arena = heap_alloc(heap, sizeof(frame_arena_t), 8);
+	arena->heap = heap;
+	arena->region_size = region_size;
+	arena->region_count = region_count;
+	arena->regions = heap_alloc(heap, sizeof(frame_arena_region_t) * region_count, 8);
+	for (int i = 0; i < region_count; ++i)
+	{
+		arena->regions[i].base = heap_alloc(heap, region_size, 16);
+		arena->regions[i].used = 0;
+		arena->regions[i].overflow_bytes = 0;
+		arena->regions[i].overflow = NULL;
+	}
+	arena->current = &arena->regions[0];
+	memset(&arena->stats, 0, sizeof(arena->stats));
+	return arena;
+}
+
+static void release_overflow(frame_arena_t* arena, frame_arena_region_t* region)
+{
+	while (region->overflow)
+	{
+		frame_arena_overflow_t* next = region->overflow->next;
+		heap_free(arena->heap, region->overflow);
+		region->overflow = next;
+	}
+	region->overflow_bytes = 0;
+}
+
+void frame_arena_destroy(frame_arena_t* arena)
+{
+	for (int i = 0; i < arena->region_count; ++i)
+	{
+		release_overflow(arena, &arena->regions[i]);
+		heap_free(arena->heap, arena->regions[i].base);
+	}
+	heap_free(arena->heap, arena->regions);
+	heap_free(arena->heap, arena);
+}
+
+void frame_arena_reset(frame_arena_t* arena, int frame)
+{
+	frame_arena_region_t* region = &arena->regions[frame % arena->region_count];
+
+	size_t frame_bytes = region->used + region->overflow_bytes;
+	arena->stats.last_frame_bytes = frame_bytes;
+	arena->stats.high_water_bytes = __max(arena->stats.high_water_bytes, frame_bytes);
+	if (region->overflow)
+	{
+		arena->stats.overflow_frames++;
+	}
+
+	release_overflow(arena, region);
+	region->used = 0;
+	arena->current = region;
+}
+
+void* frame_arena_alloc(frame_arena_t* arena, size_t size, size_t alignment)
+{
+	frame_arena_region_t* region = arena->current;
+
+	uintptr_t base = (uintptr_t)region->base;
+	uintptr_t address = (base + region->used + (alignment - 1)) & ~(uintptr_t)(alignment - 1);
+	if (address + size <= base + arena->region_size)
+	{
+		region->used = address + size - base;
+		return (void*)address;
+	}
+
+	//Out of room, keep the frame going on the heap and count it so the region can be resized
+	size_t header_size = (sizeof(frame_arena_overflow_t) + (alignment - 1)) & ~(alignment - 1);
+	frame_arena_overflow_t* overflow = heap_alloc(arena->heap, header_size + size, __max(alignment, 8));
+	overflow->next = region->overflow;
+	region->overflow = overflow;
+	region->overflow_bytes += size;
+	return (char*)overflow + header_size;
+}
+
+int frame_arena_get_region_count(frame_arena_t* arena)
+{
+	return arena->region_count;
+}
+
+void frame_arena_get_stats(frame_arena_t* arena, frame_arena_stats_t* stats)
+{
+	*stats = arena->stats;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+
+// Frame Arena
+//
+// Linear allocator for data that only lives for a frame or two.
+// Memory is split into one region per in-flight frame. Allocating bumps a
+// pointer in the current frame's region, and resetting a frame reclaims its
+// whole region at once. Nothing is ever freed individually.
+//
+// A single thread allocates and resets. Other threads may read the memory
+// until the frame that allocated it is reset.
+
+// Handle to a frame arena.
+typedef struct frame_arena_t frame_arena_t;
+
+typedef struct heap_t heap_t;
+
+// Usage counters for a frame arena.
+typedef struct frame_arena_stats_t
+{
+	// Bytes allocated by the most recently reset frame.
+	size_t last_frame_bytes;
+	// Most bytes any single frame has allocated.
+	size_t high_water_bytes;
+	// Number of frames that outgrew their region and fell back to the heap.
+	int overflow_frames;
+} frame_arena_stats_t;
+
+// Create a frame arena with region_count regions of region_size bytes each.
+// region_count is usually the number of frames in flight, see gpu_get_frame_count().
+frame_arena_t* frame_arena_create(heap_t* heap, int region_count, size_t region_size);
+
+// Destroy a frame arena and all memory allocated from it.
+void frame_arena_destroy(frame_arena_t* arena);
+
+// Begin allocating for a frame.
+// Reclaims everything previously allocated in that frame's region.
+// The caller must ensure nothing still reads memory from frame - region_count.
+void frame_arena_reset(frame_arena_t* arena, int frame);
+
+// Allocate memory that stays valid until the current frame's region is reset.
+// If the region is full, memory comes from the heap and is released on reset.
+void* frame_arena_alloc(frame_arena_t* arena, size_t size, size_t alignment);
+
+// Get the number of regions (frames) in the arena.
+int frame_arena_get_region_count(frame_arena_t* arena);
+
+// Get usage counters for the arena.
+void frame_arena_get_stats(frame_arena_t* arena, frame_arena_stats_t* stats);
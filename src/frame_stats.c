@@ -0,0 +1,273 @@
+#include "frame_stats.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "fs.h"
+#include "heap.h"
+#include "timer.h"
+
+#include <intrin.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+enum
+{
+	// Each power of two of microseconds is split into this many buckets.
+	k_frame_stats_sub_bucket_bits = 4,
+	k_frame_stats_sub_bucket_count = 1 << k_frame_stats_sub_bucket_bits,
+
+	// Values below the sub bucket count get a bucket each, then every power of two up to 2^31 gets its sub buckets.
+	k_frame_stats_bucket_count = (32 - k_frame_stats_sub_bucket_bits + 1) * k_frame_stats_sub_bucket_count,
+
+	// CSV reports that can be waiting on the file system at once.
+	k_frame_stats_max_pending_writes = 4,
+
+	k_frame_stats_max_path = 260,
+	k_frame_stats_max_report = 1024,
+};
+
+static const char* k_frame_stat_names[k_frame_stat_count] =
+{
+	"frame",
+	"game_update",
+	"render_wait",
+	"gpu_wait",
+};
+
+typedef struct frame_stats_histogram_t
+{
+	int counts[k_frame_stats_bucket_count];
+	int max_us;
+} frame_stats_histogram_t;
+
+typedef struct frame_stats_summary_t
+{
+	int count;
+	int p50_us;
+	int p95_us;
+	int p99_us;
+	int max_us;
+} frame_stats_summary_t;
+
+typedef struct frame_stats_t
+{
+	heap_t* heap;
+	fs_t* fs;
+
+	// Recorded into from any thread, emptied by each report.
+	frame_stats_histogram_t interval[k_frame_stat_count];
+
+	// Everything taken out of the interval histograms, for the report of the whole run.
+	frame_stats_histogram_t run[k_frame_stat_count];
+
+	char csv_path[k_frame_stats_max_path];
+	bool use_csv;
+	fs_work_t* pending_works[k_frame_stats_max_pending_writes];
+	char* pending_buffers[k_frame_stats_max_pending_writes];
+	int pending_count;
+} frame_stats_t;
+
+static void frame_stats_write_csv(frame_stats_t* stats, const char* text, bool create);
+
+frame_stats_t* frame_stats_create(heap_t* heap, fs_t* fs, const char* csv_path)
+{
+	frame_stats_t* stats = heap_alloc(heap, sizeof(frame_stats_t), 8);
+	memset(stats, 0, sizeof(*stats));
+	stats->heap = heap;
+	stats->fs = fs;
+
+	if (csv_path)
+	{
+		strcpy_s(stats->csv_path, sizeof(stats->csv_path), csv_path);
+		stats->use_csv = true;
+		frame_stats_write_csv(stats, "ms,window,stat,count,p50_ms,p95_ms,p99_ms,max_ms\n", true);
+	}
+	return stats;
+}
+
+static int frame_stats_bucket_index(int us)
+{
+	if (us < k_frame_stats_sub_bucket_count)
+	{
+		return us;
+	}
+	unsigned long msb;
+	_BitScanReverse(&msb, (unsigned long)us);
+	int shift = (int)msb - k_frame_stats_sub_bucket_bits;
+	return (shift + 1) * k_frame_stats_sub_bucket_count + ((us >> shift) - k_frame_stats_sub_bucket_count);
+}
+
+//Largest value that lands in the bucket
+static int frame_stats_bucket_upper(int index)
+{
+	if (index < k_frame_stats_sub_bucket_count)
+	{
+		return index;
+	}
+	int shift = index / k_frame_stats_sub_bucket_count - 1;
+	int64_t sub = index % k_frame_stats_sub_bucket_count + k_frame_stats_sub_bucket_count;
+	return (int)__min(((sub + 1) << shift) - 1, INT_MAX);
+}
+
+void frame_stats_record(frame_stats_t* stats, frame_stat_t stat, uint64_t ticks)
+{
+	if (!stats)
+	{
+		return;
+	}
+
+	int us = (int)__min(timer_ticks_to_us(ticks), INT_MAX);
+	frame_stats_histogram_t* histogram = &stats->interval[stat];
+	atomic_increment(&histogram->counts[frame_stats_bucket_index(us)]);
+
+	int max_us = atomic_load(&histogram->max_us);
+	while (us > max_us)
+	{
+		int old_max_us = atomic_compare_and_exchange(&histogram->max_us, max_us, us);
+		if (old_max_us == max_us)
+		{
+			break;
+		}
+		max_us = old_max_us;
+	}
+}
+
+//Empties the interval histograms into snapshot and adds them to the run
+//Timings recorded meanwhile land in either this interval or the next, none are lost
+static void frame_stats_take_interval(frame_stats_t* stats, frame_stats_histogram_t* snapshot)
+{
+	for (int stat = 0; stat < k_frame_stat_count; ++stat)
+	{
+		frame_stats_histogram_t* interval = &stats->interval[stat];
+		frame_stats_histogram_t* run = &stats->run[stat];
+		for (int i = 0; i < k_frame_stats_bucket_count; ++i)
+		{
+			snapshot[stat].counts[i] = atomic_exchange(&interval->counts[i], 0);
+			run->counts[i] += snapshot[stat].counts[i];
+		}
+		snapshot[stat].max_us = atomic_exchange(&interval->max_us, 0);
+		run->max_us = __max(run->max_us, snapshot[stat].max_us);
+	}
+}
+
+static int frame_stats_percentile(const frame_stats_histogram_t* histogram, int count, int percent)
+{
+	//Nearest rank, reported as the top of its bucket so percentiles never read low
+	int64_t rank = __max(((int64_t)count * percent + 99) / 100, 1);
+	int64_t seen = 0;
+	for (int i = 0; i < k_frame_stats_bucket_count; ++i)
+	{
+		seen += histogram->counts[i];
+		if (seen >= rank)
+		{
+			return __min(frame_stats_bucket_upper(i), histogram->max_us);
+		}
+	}
+	return histogram->max_us;
+}
+
+static frame_stats_summary_t frame_stats_summarize(const frame_stats_histogram_t* histogram)
+{
+	frame_stats_summary_t summary = { 0 };
+	for (int i = 0; i < k_frame_stats_bucket_count; ++i)
+	{
+		summary.count += histogram->counts[i];
+	}
+	if (summary.count)
+	{
+		summary.p50_us = frame_stats_percentile(histogram, summary.count, 50);
+		summary.p95_us = frame_stats_percentile(histogram, summary.count, 95);
+		summary.p99_us = frame_stats_percentile(histogram, summary.count, 99);
+		summary.max_us = histogram->max_us;
+	}
+	return summary;
+}
+
+static void frame_stats_wait_oldest_write(frame_stats_t* stats)
+{
+	fs_work_t* work = stats->pending_works[0];
+	if (fs_work_get_result(work) != 0)
+	{
+		debug_print(k_print_error, "Failed to write frame stats to %s.\n", stats->csv_path);
+	}
+	fs_work_destroy(work);
+	heap_free(stats->heap, stats->pending_buffers[0]);
+
+	--stats->pending_count;
+	memmove(stats->pending_works, stats->pending_works + 1, sizeof(fs_work_t*) * stats->pending_count);
+	memmove(stats->pending_buffers, stats->pending_buffers + 1, sizeof(char*) * stats->pending_count);
+}
+
+//Creating the file truncates any previous run, every later report is appended in order
+static void frame_stats_write_csv(frame_stats_t* stats, const char* text, bool create)
+{
+	while (stats->pending_count && fs_work_is_done(stats->pending_works[0]))
+	{
+		frame_stats_wait_oldest_write(stats);
+	}
+	if (stats->pending_count == k_frame_stats_max_pending_writes)
+	{
+		frame_stats_wait_oldest_write(stats);
+	}
+
+	size_t size = strlen(text);
+	char* buffer = heap_alloc(stats->heap, size, 8);
+	memcpy(buffer, text, size);
+	stats->pending_works[stats->pending_count] = create ?
+		fs_write(stats->fs, stats->csv_path, buffer, size, false) :
+		fs_append(stats->fs, stats->csv_path, buffer, size);
+	stats->pending_buffers[stats->pending_count] = buffer;
+	stats->pending_count++;
+}
+
+static void frame_stats_print(frame_stats_t* stats, const char* window, const frame_stats_histogram_t* histograms)
+{
+	uint32_t time_ms = timer_ticks_to_ms(timer_get_ticks());
+
+	char json[k_frame_stats_max_report];
+	char csv[k_frame_stats_max_report];
+	int json_length = snprintf(json, sizeof(json), "{\"frame_stats\":{\"window\":\"%s\",\"ms\":%u", window, time_ms);
+	int csv_length = 0;
+	for (int stat = 0; stat < k_frame_stat_count; ++stat)
+	{
+		frame_stats_summary_t summary = frame_stats_summarize(&histograms[stat]);
+		json_length += snprintf(json + json_length, sizeof(json) - json_length,
+			",\"%s\":{\"count\":%d,\"p50\":%.3f,\"p95\":%.3f,\"p99\":%.3f,\"max\":%.3f}",
+			k_frame_stat_names[stat], summary.count, summary.p50_us / 1000.0, summary.p95_us / 1000.0,
+			summary.p99_us / 1000.0, summary.max_us / 1000.0);
+		csv_length += snprintf(csv + csv_length, sizeof(csv) - csv_length, "%u,%s,%s,%d,%.3f,%.3f,%.3f,%.3f\n",
+			time_ms, window, k_frame_stat_names[stat], summary.count, summary.p50_us / 1000.0,
+			summary.p95_us / 1000.0, summary.p99_us / 1000.0, summary.max_us / 1000.0);
+	}
+	debug_print(k_print_info, "%s}}\n", json);
+
+	if (stats->use_csv)
+	{
+		frame_stats_write_csv(stats, csv, false);
+	}
+}
+
+void frame_stats_report(frame_stats_t* stats)
+{
+	frame_stats_histogram_t* snapshot = heap_alloc(stats->heap, sizeof(frame_stats_histogram_t) * k_frame_stat_count, 8);
+	frame_stats_take_interval(stats, snapshot);
+	frame_stats_print(stats, "interval", snapshot);
+	heap_free(stats->heap, snapshot);
+}
+
+void frame_stats_destroy(frame_stats_t* stats)
+{
+	//Frames since the last report count towards the run
+	frame_stats_histogram_t* snapshot = heap_alloc(stats->heap, sizeof(frame_stats_histogram_t) * k_frame_stat_count, 8);
+	frame_stats_take_interval(stats, snapshot);
+	heap_free(stats->heap, snapshot);
+	frame_stats_print(stats, "run", stats->run);
+
+	while (stats->pending_count)
+	{
+		frame_stats_wait_oldest_write(stats);
+	}
+	heap_free(stats->heap, stats);
+}
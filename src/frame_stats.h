@@ -0,0 +1,49 @@
+#pragma once
+
+// Frame time statistics.
+// Collects per-frame timings into histograms and reports their percentiles, so the
+// distribution of frame times can be watched without capturing a trace.
+
+// Each timing goes into one of a fixed set of log-scale buckets, about 6% wide, so
+// recording is a couple of atomic operations and memory does not grow with frame count.
+// Reports cover the frames since the previous report. Destroying the statistics reports
+// the whole run. Reports are printed as a single line of JSON and, optionally, appended
+// to a CSV file for tracking regressions between runs.
+
+#include <stdint.h>
+
+// Handle to frame time statistics.
+typedef struct frame_stats_t frame_stats_t;
+
+typedef struct fs_t fs_t;
+typedef struct heap_t heap_t;
+
+// The timings collected each frame.
+typedef enum frame_stat_t
+{
+	// Main loop, from the start of one frame to the start of the next.
+	k_frame_stat_frame,
+	// Game update, including any wait on the render thread.
+	k_frame_stat_game_update,
+	// Game thread blocked on the render thread to free room for the next frame's commands.
+	k_frame_stat_render_wait,
+	// Render thread ending a GPU frame: acquiring an image, waiting on its fence and presenting.
+	k_frame_stat_gpu_wait,
+
+	k_frame_stat_count,
+} frame_stat_t;
+
+// Create frame time statistics.
+// If csv_path is not NULL, every report is also written to that file through fs.
+frame_stats_t* frame_stats_create(heap_t* heap, fs_t* fs, const char* csv_path);
+
+// Destroy frame time statistics.
+// Reports the whole run, then waits for the CSV file to be written.
+void frame_stats_destroy(frame_stats_t* stats);
+
+// Record a timing in ticks.
+// May be called from any thread. Does nothing for NULL statistics.
+void frame_stats_record(frame_stats_t* stats, frame_stat_t stat, uint64_t ticks);
+
+// Report p50, p95, p99 and max of each timing since the previous report, in milliseconds.
+void frame_stats_report(frame_stats_t* stats);
@@ -1,9 +1,14 @@
+#include "broadphase.h"
+#include "collision.h"
 #include "ecs.h"
 #include "fs.h"
 #include "gpu.h"
 #include "heap.h"
+#include "jobs.h"
+#include "mutex.h"
 #include "render.h"
 #include "timer_object.h"
+#include "trace.h"
 #include "transform.h"
 #include "wm.h"
 #include "frogger_game.h"
@@ -16,6 +21,15 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+enum
+{
+	// Entity slots per job when iterating the ECS in parallel.
+	k_frogger_query_chunk_size = 64,
+
+	// Broad-phase categories, players only collide with traffic.
+	k_frogger_collide_player = 1 << 0,
+	k_frogger_collide_traffic = 1 << 1,
+};
 
 typedef struct transform_component_t
 {
@@ -51,6 +65,9 @@ typedef struct collider_component_t
 	float z_cord;
 	float width;
 	float height;
+	//Owning entity and its broad-phase proxy, -1 once removed
+	ecs_entity_ref_t entity;
+	int proxy;
 } collider_component_t;
 
 typedef struct traffic_component_t
@@ -61,12 +78,27 @@ typedef struct traffic_component_t
 	float speed;
 } traffic_component_t;
 
+typedef struct draw_models_slot_t draw_models_slot_t;
+
 typedef struct frogger_game_t
 {
 	heap_t* heap;
 	fs_t* fs;
 	wm_window_t* window;
 	render_t* render;
+	jobs_t* jobs;
+	trace_t* trace;
+
+	//Filled by draw_models jobs, one slot per chunk, then pushed to render in chunk order
+	draw_models_slot_t* draw_slots;
+	int draw_slot_capacity;
+
+	//Colliders register here, update_collisions only tests the pairs it reports
+	broadphase_t* broadphase;
+	//Serializes broadphase adds and removes from update_traffic jobs
+	mutex_t* collision_mutex;
+	//Boxes paired with one player, tested against it in a single pass
+	collision_set_t* collision_set;
 
 	timer_object_t* timer;
 
@@ -100,22 +132,30 @@ static void unload_resources(frogger_game_t* game);
 static void spawn_player(frogger_game_t* game, int index);
 static void spawn_traffic(frogger_game_t* game, int row, int index, bool start);
 static void spawn_camera(frogger_game_t* game);
+static void despawn(frogger_game_t* game, ecs_entity_ref_t entity);
 static void update_players(frogger_game_t* game);
 static void update_traffic(frogger_game_t* game);
 static void update_collisions(frogger_game_t* game);
 static void draw_models(frogger_game_t* game);
 
-frogger_game_t* frogger_game_create(heap_t* heap, fs_t* fs, wm_window_t* window, render_t* render)
+frogger_game_t* frogger_game_create(heap_t* heap, fs_t* fs, wm_window_t* window, render_t* render, jobs_t* jobs, trace_t* trace)
 {
 	frogger_game_t* game = heap_alloc(heap, sizeof(frogger_game_t), 8);
 	game->heap = heap;
 	game->fs = fs;
 	game->window = window;
 	game->render = render;
+	game->jobs = jobs;
+	game->trace = trace;
+	game->draw_slots = NULL;
+	game->draw_slot_capacity = 0;
+	game->broadphase = broadphase_create(heap, 4.0f);
+	game->collision_mutex = mutex_create();
+	game->collision_set = collision_set_create(heap);
 
 	game->timer = timer_object_create(heap, NULL);
 
-	game->ecs = ecs_create(heap);
+	game->ecs = ecs_create(heap, k_ecs_storage_sparse);
 	game->transform_type = ecs_register_component_type(game->ecs, "transform", sizeof(transform_component_t), _Alignof(transform_component_t));
 	game->camera_type = ecs_register_component_type(game->ecs, "camera", sizeof(camera_component_t), _Alignof(camera_component_t));
 	game->model_type = ecs_register_component_type(game->ecs, "model", sizeof(model_component_t), _Alignof(model_component_t));
@@ -160,18 +200,24 @@ void frogger_game_destroy(frogger_game_t* game)
 	heap_free(game->heap, game->p_x_audio2);
 	heap_free(game->heap, game->p_master_voice);
 	heap_free(game->heap, game->p_source_voice_back);
+	collision_set_destroy(game->collision_set);
+	mutex_destroy(game->collision_mutex);
+	broadphase_destroy(game->broadphase);
+	heap_free(game->heap, game->draw_slots);
 	heap_free(game->heap, game);
 }
 
 void frogger_game_update(frogger_game_t* game)
 {
-	timer_object_update(game->timer);
-	ecs_update(game->ecs);
-	update_players(game);
-	update_traffic(game);
-	update_collisions(game);
-	draw_models(game);
-	render_push_done(game->render);
+	TRACE_PUSH(game->trace, "frogger_game_update");
+	TRACE_SCOPE(game->trace, "timer_object_update") timer_object_update(game->timer);
+	TRACE_SCOPE(game->trace, "ecs_update") ecs_update(game->ecs);
+	TRACE_SCOPE(game->trace, "update_players") update_players(game);
+	TRACE_SCOPE(game->trace, "update_traffic") update_traffic(game);
+	TRACE_SCOPE(game->trace, "update_collisions") update_collisions(game);
+	TRACE_SCOPE(game->trace, "draw_models") draw_models(game);
+	TRACE_SCOPE(game->trace, "render_push_done") render_push_done(game->render);
+	TRACE_POP(game->trace);
 }
 
 static void load_resources(frogger_game_t* game)
@@ -250,6 +296,28 @@ static void unload_resources(frogger_game_t* game)
 	fs_work_destroy(game->vertex_shader_work);
 }
 
+//Colliders are boxes centered on their entity in the y-z plane the game is played in
+static broadphase_aabb_t collider_get_aabb(const collider_component_t* collider_comp)
+{
+	return (broadphase_aabb_t)
+	{
+		.min_x = collider_comp->y_cord - collider_comp->width * 0.5f,
+		.min_y = collider_comp->z_cord - collider_comp->height * 0.5f,
+		.max_x = collider_comp->y_cord + collider_comp->width * 0.5f,
+		.max_y = collider_comp->z_cord + collider_comp->height * 0.5f,
+	};
+}
+
+//The broadphase keeps a pointer to the component, which stays put with sparse ECS storage
+static void collider_register(frogger_game_t* game, collider_component_t* collider_comp, ecs_entity_ref_t entity, uint32_t category, uint32_t collide_mask)
+{
+	broadphase_aabb_t aabb = collider_get_aabb(collider_comp);
+	collider_comp->entity = entity;
+	mutex_lock(game->collision_mutex);
+	collider_comp->proxy = broadphase_add(game->broadphase, &aabb, category, collide_mask, collider_comp);
+	mutex_unlock(game->collision_mutex);
+}
+
 static void spawn_player(frogger_game_t* game, int index)
 {
 	uint64_t k_player_ent_mask =
@@ -279,6 +347,7 @@ static void spawn_player(frogger_game_t* game, int index)
 	//Base mesh of cube is 2 units wide and 2 units tall
 	collider_comp->width = 2;
 	collider_comp->height = 2;
+	collider_register(game, collider_comp, game->player_ent, k_frogger_collide_player, k_frogger_collide_traffic);
 
 	model_component_t* model_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->model_type, true);
 	model_comp->mesh_info = &game->cube_mesh;
@@ -326,6 +395,7 @@ static void spawn_traffic(frogger_game_t* game, int row, int index, bool start)
 	collider_comp->z_cord = transform_comp->transform.translation.z;
 	collider_comp->width = car_widths[row];
 	collider_comp->height = 2.0f;
+	collider_register(game, collider_comp, game->traffic_ent[row][index], k_frogger_collide_traffic, k_frogger_collide_player);
 
 	model_component_t* model_comp = ecs_entity_get_component(game->ecs, game->traffic_ent[row][index], game->model_type, true);
 	model_comp->mesh_info = &game->prism_mesh;
@@ -352,6 +422,20 @@ static void spawn_camera(frogger_game_t* game)
 	mat4f_make_lookat(&camera_comp->view, &eye_pos, &forward, &up);
 }
 
+//Removes an entity along with its collider's broadphase proxy
+static void despawn(frogger_game_t* game, ecs_entity_ref_t entity)
+{
+	collider_component_t* collider_comp = ecs_entity_get_component(game->ecs, entity, game->collider_type, true);
+	if (collider_comp && collider_comp->proxy >= 0)
+	{
+		mutex_lock(game->collision_mutex);
+		broadphase_remove(game->broadphase, collider_comp->proxy);
+		mutex_unlock(game->collision_mutex);
+		collider_comp->proxy = -1;
+	}
+	ecs_entity_remove(game->ecs, entity, false);
+}
+
 static void update_players(frogger_game_t* game)
 {
 	float dt = (float)timer_object_get_delta_ms(game->timer) * 0.001f;
@@ -369,7 +453,8 @@ static void update_players(frogger_game_t* game)
 
 		if (transform_comp->transform.translation.z < -14.5f)
 		{
-			ecs_entity_remove(game->ecs, ecs_query_get_entity(game->ecs, &query), false);
+			despawn(game, ecs_query_get_entity(game->ecs, &query));
+			TRACE_INSTANT(game->trace, "player reached goal");
 			PlaySound(TEXT("audio/victory.wav"), NULL, SND_ASYNC);
 			spawn_player(game, 0);
 		}
@@ -394,6 +479,7 @@ static void update_players(frogger_game_t* game)
 		}
 		if (transform_comp->transform.translation.y > 14.0f || transform_comp->transform.translation.y < -14.0f) {
 			if (transform_comp->barrier == false) {
+				TRACE_INSTANT(game->trace, "player hit barrier");
 				PlaySound(TEXT("audio/barrier.wav"), NULL, SND_ASYNC);
 				transform_comp->barrier = true;
 			}
@@ -405,13 +491,21 @@ static void update_players(frogger_game_t* game)
 	}
 }
 
-static void update_traffic(frogger_game_t* game)
+typedef struct update_traffic_data_t
 {
-	float dt = (float)timer_object_get_delta_ms(game->timer) * 0.001f;
+	frogger_game_t* game;
+	float dt;
+} update_traffic_data_t;
 
-	uint64_t k_query_mask = (1ULL << game->transform_type) | (1ULL << game->traffic_type);
+//Runs on a job, once per chunk of traffic entities
+static void update_traffic_chunk(ecs_t* ecs, ecs_query_t* chunk_query, void* user)
+{
+	update_traffic_data_t* data = user;
+	frogger_game_t* game = data->game;
+	float dt = data->dt;
+	TRACE_PUSH(game->trace, "update_traffic_chunk");
 
-	for (ecs_query_t query = ecs_query_create(game->ecs, k_query_mask);
+	for (ecs_query_t query = *chunk_query;
 		ecs_query_is_valid(game->ecs, &query);
 		ecs_query_next(game->ecs, &query))
 	{
@@ -421,7 +515,7 @@ static void update_traffic(frogger_game_t* game)
 		//If the traffic entity reaches the edge of the screen destroy it and respawn it at the other edge of the screen
 		if (transform_comp->transform.translation.y > 28.5f || transform_comp->transform.translation.y < -28.5f)
 		{
-			ecs_entity_remove(game->ecs, ecs_query_get_entity(game->ecs, &query), false);
+			despawn(game, ecs_query_get_entity(game->ecs, &query));
 			spawn_traffic(game, traffic_comp->row, traffic_comp->index, false);
 		}
 
@@ -431,82 +525,157 @@ static void update_traffic(frogger_game_t* game)
 		move.translation = vec3f_add(move.translation, vec3f_scale(vec3f_right(), dt * traffic_comp->speed));
 		transform_multiply(&transform_comp->transform, &move);
 	}
+
+	TRACE_POP(game->trace);
+}
+
+static void update_traffic(frogger_game_t* game)
+{
+	update_traffic_data_t data =
+	{
+		.game = game,
+		.dt = (float)timer_object_get_delta_ms(game->timer) * 0.001f,
+	};
+	uint64_t k_query_mask = (1ULL << game->transform_type) | (1ULL << game->traffic_type);
+	ecs_query_for_each_parallel(game->ecs, game->jobs, k_query_mask, k_frogger_query_chunk_size, update_traffic_chunk, &data);
 }
 
 static void update_collisions(frogger_game_t* game)
 {
-	//Masks for getting player and traffic entities
-	uint64_t k_query_mask_player = (1ULL << game->player_type);
-	uint64_t k_query_mask_traffic = (1ULL << game->transform_type) | (1ULL << game->collider_type) | (1ULL << game->traffic_type);
+	//Refreshes each collider from its transform once, the broadphase only rebuckets those that changed cells
+	uint64_t k_query_mask = (1ULL << game->transform_type) | (1ULL << game->collider_type);
+	for (ecs_query_t query = ecs_query_create(game->ecs, k_query_mask);
+		ecs_query_is_valid(game->ecs, &query);
+		ecs_query_next(game->ecs, &query))
+	{
+		transform_component_t* transform_comp = ecs_query_get_component(game->ecs, &query, game->transform_type);
+		collider_component_t* collider_comp = ecs_query_get_component(game->ecs, &query, game->collider_type);
+		//Despawned entities stay in the query until the next ecs_update, but their proxy is already gone
+		if (collider_comp->proxy < 0)
+		{
+			continue;
+		}
+		collider_comp->y_cord = transform_comp->transform.translation.y;
+		collider_comp->z_cord = transform_comp->transform.translation.z;
+		broadphase_aabb_t aabb = collider_get_aabb(collider_comp);
+		broadphase_move(game->broadphase, collider_comp->proxy, &aabb);
+	}
+
+	const broadphase_pair_t* pairs;
+	int pair_count = broadphase_find_pairs(game->broadphase, &pairs);
 
 	//Loops for all player entities
+	uint64_t k_query_mask_player = (1ULL << game->player_type) | (1ULL << game->collider_type);
 	for (ecs_query_t query = ecs_query_create(game->ecs, k_query_mask_player);
 		ecs_query_is_valid(game->ecs, &query);
 		ecs_query_next(game->ecs, &query))
 	{
-		player_component_t*  player_comp = ecs_query_get_component(game->ecs, &query, game->player_type);
-		collider_component_t*  player_collider_comp = ecs_query_get_component(game->ecs, &query, game->collider_type);
-		transform_component_t* transform_comp = ecs_query_get_component(game->ecs, &query, game->transform_type);
-		//Updates player collider comp with its current transform comp values
-		player_collider_comp->y_cord = transform_comp->transform.translation.y;
-		player_collider_comp->z_cord = transform_comp->transform.translation.z;
-		ecs_query_t player_query = query;
-
-		//Loops for all traffic entities
-		for (ecs_query_t query = ecs_query_create(game->ecs, k_query_mask_traffic);
-			ecs_query_is_valid(game->ecs, &query);
-			ecs_query_next(game->ecs, &query))
+		collider_component_t* player_collider_comp = ecs_query_get_component(game->ecs, &query, game->collider_type);
+
+		//Gathers the traffic the broadphase paired with this player and tests them all at once
+		collision_set_clear(game->collision_set);
+		for (int i = 0; i < pair_count; ++i)
 		{
-			transform_component_t* transform_comp = ecs_query_get_component(game->ecs, &query, game->transform_type);
-			collider_component_t* collider_comp = ecs_query_get_component(game->ecs, &query, game->collider_type);
-			//Updates traffic collider comp with its current transform comp values
-			collider_comp->y_cord = transform_comp->transform.translation.y;
-			collider_comp->z_cord = transform_comp->transform.translation.z;
-
-			float y1 = player_collider_comp->y_cord - (player_collider_comp->width * 0.5f);
-			float z1 = player_collider_comp->z_cord + (player_collider_comp->height * 0.5f);
-			float y2 = y1 + player_collider_comp->width;
-			float z2 = z1 - player_collider_comp->height;
-			float y3 = collider_comp->y_cord - (collider_comp->width * 0.5f);
-			float z3 = collider_comp->z_cord + (collider_comp->height * 0.5f);
-			float y4 = y3 + collider_comp->width;
-			float z4 = z3 - collider_comp->height;
-			//Boolean to keep track if a collision was found
-			bool dead = false;
-
-			if (y1 > y3 && y1 < y4 && z1 < z3 && z1 > z4) {
-				dead = true;
-			}
-			else if (y1 > y3 && y1 < y4 && z2 < z3 && z2 > z4) {
-				dead = true;
+			collider_component_t* collider_comp =
+				pairs[i].user_a == player_collider_comp ? pairs[i].user_b :
+				pairs[i].user_b == player_collider_comp ? pairs[i].user_a :
+				NULL;
+			if (collider_comp)
+			{
+				broadphase_aabb_t aabb = collider_get_aabb(collider_comp);
+				collision_set_add(game->collision_set, &aabb, collider_comp);
 			}
-			else if (y2 > y3 && y2 < y4 && z1 < z3 && z1 > z4) {
-				dead = true;
+		}
+
+		broadphase_aabb_t player_aabb = collider_get_aabb(player_collider_comp);
+		const int* hits;
+		if (collision_set_overlap(game->collision_set, &player_aabb, &hits) > 0)
+		{
+			collider_component_t* collider_comp = collision_set_get_user(game->collision_set, hits[0]);
+			broadphase_aabb_t traffic_aabb = collider_get_aabb(collider_comp);
+			debug_print(
+				k_print_info,
+				"You DIED!\nPlayer = y:%.3f to %.3f  z:%.3f to %.3f\nTraffic = y:%.3f to %.3f  z:%.3f to %.3f\n",
+				player_aabb.min_x, player_aabb.max_x, player_aabb.min_y, player_aabb.max_y,
+				traffic_aabb.min_x, traffic_aabb.max_x, traffic_aabb.min_y, traffic_aabb.max_y);
+			TRACE_INSTANT(game->trace, "player died");
+			if (collider_comp->z_cord == 0) {
+				PlaySound(TEXT("audio/hit.wav"), NULL, SND_ASYNC);
 			}
-			else if (y2 > y3 && y2 < y4 && z2 < z3 && z2 > z4) {
-				dead = true;
+			else if (collider_comp->z_cord == -10) {
+				PlaySound(TEXT("audio/shoot.wav"), NULL, SND_ASYNC);
 			}
-			if (dead) {
-				debug_print(
-					k_print_info,
-					"You DIED!\nPlayer = y1:%.3f  z1:%.3f  y2:%.3f  z2:%.3f\nTraffic = y3:%.3f  z3:%.3f  y4:%.3f  z4:%.3f\n",
-					y1, z1, y2, z2, y3, z3, y4, z4);
-				if (collider_comp->z_cord == 0) {
-					PlaySound(TEXT("audio/hit.wav"), NULL, SND_ASYNC);
-				}
-				else if (collider_comp->z_cord == -10) {
-					PlaySound(TEXT("audio/shoot.wav"), NULL, SND_ASYNC);
-				}
-				else {
-					PlaySound(TEXT("audio/explosion.wav"), NULL, SND_ASYNC);
-				}
-				ecs_entity_remove(game->ecs, ecs_query_get_entity(game->ecs, &player_query), false);
-				spawn_player(game, 0);
+			else {
+				PlaySound(TEXT("audio/explosion.wav"), NULL, SND_ASYNC);
 			}
+			despawn(game, ecs_query_get_entity(game->ecs, &query));
+			spawn_player(game, 0);
 		}
 	}
 }
 
+typedef struct draw_model_t
+{
+	ecs_entity_ref_t entity_ref;
+	model_component_t* model_comp;
+	struct
+	{
+		mat4f_t projection;
+		mat4f_t model;
+		mat4f_t view;
+	} uniform_data;
+} draw_model_t;
+
+//One per query chunk, which never holds more than the chunk size, whether run on jobs or not
+typedef struct draw_models_slot_t
+{
+	draw_model_t draws[k_frogger_query_chunk_size];
+	int draw_count;
+} draw_models_slot_t;
+
+typedef struct draw_models_data_t
+{
+	frogger_game_t* game;
+	camera_component_t* camera_comp;
+} draw_models_data_t;
+
+//Runs on a job, once per chunk of model entities
+//Matrices are built in parallel into the chunk's own slot, render is only pushed to from the game thread
+static void draw_models_chunk(ecs_t* ecs, ecs_query_t* chunk_query, void* user)
+{
+	draw_models_data_t* data = user;
+	frogger_game_t* game = data->game;
+	TRACE_PUSH(game->trace, "draw_models_chunk");
+
+	draw_model_t* draws = game->draw_slots[chunk_query->chunk_index].draws;
+	transform_t transforms[k_frogger_query_chunk_size];
+	int draw_count = 0;
+	for (ecs_query_t query = *chunk_query;
+		ecs_query_is_valid(game->ecs, &query);
+		ecs_query_next(game->ecs, &query))
+	{
+		transform_component_t* transform_comp = ecs_query_get_component(game->ecs, &query, game->transform_type);
+		transforms[draw_count] = transform_comp->transform;
+		draw_model_t* draw = &draws[draw_count++];
+		draw->entity_ref = ecs_query_get_entity(game->ecs, &query);
+		draw->model_comp = ecs_query_get_component(game->ecs, &query, game->model_type);
+		draw->uniform_data.projection = data->camera_comp->projection;
+		draw->uniform_data.view = data->camera_comp->view;
+	}
+
+	//Gathered so the whole chunk's matrices are built in one batch
+	mat4f_t models[k_frogger_query_chunk_size];
+	transform_to_matrix_n(transforms, models, draw_count);
+	for (int i = 0; i < draw_count; ++i)
+	{
+		draws[i].uniform_data.model = models[i];
+	}
+
+	game->draw_slots[chunk_query->chunk_index].draw_count = draw_count;
+
+	TRACE_POP(game->trace);
+}
+
 static void draw_models(frogger_game_t* game)
 {
 	uint64_t k_camera_query_mask = (1ULL << game->camera_type);
@@ -514,29 +683,37 @@ static void draw_models(frogger_game_t* game)
 		ecs_query_is_valid(game->ecs, &camera_query);
 		ecs_query_next(game->ecs, &camera_query))
 	{
-		camera_component_t* camera_comp = ecs_query_get_component(game->ecs, &camera_query, game->camera_type);
-
+		draw_models_data_t data =
+		{
+			.game = game,
+			.camera_comp = ecs_query_get_component(game->ecs, &camera_query, game->camera_type),
+		};
 		uint64_t k_model_query_mask = (1ULL << game->transform_type) | (1ULL << game->model_type);
-		for (ecs_query_t query = ecs_query_create(game->ecs, k_model_query_mask);
-			ecs_query_is_valid(game->ecs, &query);
-			ecs_query_next(game->ecs, &query))
+		int chunk_count = ecs_query_get_chunk_count(game->ecs, k_model_query_mask, k_frogger_query_chunk_size);
+		if (chunk_count > game->draw_slot_capacity)
+		{
+			heap_free(game->heap, game->draw_slots);
+			game->draw_slots = heap_alloc(game->heap, sizeof(draw_models_slot_t) * chunk_count, 8);
+			game->draw_slot_capacity = chunk_count;
+		}
+		//Chunks with no matches never run, so their slots must read as empty
+		for (int i = 0; i < chunk_count; ++i)
 		{
-			transform_component_t* transform_comp = ecs_query_get_component(game->ecs, &query, game->transform_type);
-			model_component_t* model_comp = ecs_query_get_component(game->ecs, &query, game->model_type);
-			ecs_entity_ref_t entity_ref = ecs_query_get_entity(game->ecs, &query);
+			game->draw_slots[i].draw_count = 0;
+		}
+
+		ecs_query_for_each_parallel(game->ecs, game->jobs, k_model_query_mask, k_frogger_query_chunk_size, draw_models_chunk, &data);
 
-			struct
+		//Pushed in chunk order, so draws are submitted in the same order every frame
+		for (int i = 0; i < chunk_count; ++i)
+		{
+			draw_models_slot_t* slot = &game->draw_slots[i];
+			for (int j = 0; j < slot->draw_count; ++j)
 			{
-				mat4f_t projection;
-				mat4f_t model;
-				mat4f_t view;
-			} uniform_data;
-			uniform_data.projection = camera_comp->projection;
-			uniform_data.view = camera_comp->view;
-			transform_to_matrix(&transform_comp->transform, &uniform_data.model);
-			gpu_uniform_buffer_info_t uniform_info = { .data = &uniform_data, sizeof(uniform_data) };
-
-			render_push_model(game->render, &entity_ref, model_comp->mesh_info, model_comp->shader_info, &uniform_info);
+				draw_model_t* draw = &slot->draws[j];
+				gpu_uniform_buffer_info_t uniform_info = { .data = &draw->uniform_data, sizeof(draw->uniform_data) };
+				render_push_model(game->render, &draw->entity_ref, draw->model_comp->mesh_info, draw->model_comp->shader_info, &uniform_info);
+			}
 		}
 	}
 }
@@ -6,11 +6,15 @@ typedef struct frogger_game_t frogger_game_t;
 
 typedef struct fs_t fs_t;
 typedef struct heap_t heap_t;
+typedef struct jobs_t jobs_t;
 typedef struct render_t render_t;
+typedef struct trace_t trace_t;
 typedef struct wm_window_t wm_window_t;
 
 // Create an instance of frogger test game.
-frogger_game_t* frogger_game_create(heap_t* heap, fs_t* fs, wm_window_t* window, render_t* render);
+// Per-entity updates and draws are split across the job system.
+// Player deaths, goals and barrier hits are traced as instant events.
+frogger_game_t* frogger_game_create(heap_t* heap, fs_t* fs, wm_window_t* window, render_t* render, jobs_t* jobs, trace_t* trace);
 
 // Destroy an instance of frogger test game.
 void frogger_game_destroy(frogger_game_t* game);
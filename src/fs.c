@@ -7,6 +7,7 @@
 #include "thread.h"
 #include "debug.h"
 #include "mutex.h"
+#include "trace.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -17,6 +18,7 @@
 typedef struct fs_t
 {
 	heap_t* heap;
+	trace_t* trace;
 	queue_t* file_queue;
 	queue_t* compression_queue;
 	thread_t* file_thread;
@@ -27,6 +29,7 @@ typedef enum fs_work_op_t
 {
 	k_fs_work_op_read,
 	k_fs_work_op_write,
+	k_fs_work_op_append,
 } fs_work_op_t;
 
 typedef struct fs_work_t
@@ -46,10 +49,11 @@ typedef struct fs_work_t
 static int file_thread_func(void* user);
 static int compression_thread_func(void* user);
 
-fs_t* fs_create(heap_t* heap, int queue_capacity)
+fs_t* fs_create(heap_t* heap, int queue_capacity, trace_t* trace)
 {
 	fs_t* fs = heap_alloc(heap, sizeof(fs_t), 8);
 	fs->heap = heap;
+	fs->trace = trace;
 	fs->file_queue = queue_create(heap, queue_capacity);
 	fs->compression_queue = queue_create(heap, queue_capacity);
 	fs->file_thread = thread_create(file_thread_func, fs);
@@ -109,6 +113,22 @@ fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size,
 	return work;
 }
 
+fs_work_t* fs_append(fs_t* fs, const char* path, const void* buffer, size_t size)
+{
+	fs_work_t* work = heap_alloc(fs->heap, sizeof(fs_work_t), 8);
+	work->heap = fs->heap;
+	work->op = k_fs_work_op_append;
+	strcpy_s(work->path, sizeof(work->path), path);
+	work->buffer = (void*)buffer;
+	work->size = size;
+	work->done = event_create();
+	work->result = 0;
+	work->null_terminate = false;
+	work->use_compression = false;
+	queue_push(fs->file_queue, work);
+	return work;
+}
+
 bool fs_work_is_done(fs_work_t* work)
 {
 	return work ? event_is_raised(work->done) : true;
@@ -218,8 +238,10 @@ static void file_write(fs_work_t* work)
 		return;
 	}
 
-	HANDLE handle = CreateFile(wide_path, GENERIC_WRITE, FILE_SHARE_WRITE, NULL,
-		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	//Append access writes every buffer at the current end of the file
+	bool append = work->op == k_fs_work_op_append;
+	HANDLE handle = CreateFile(wide_path, append ? FILE_APPEND_DATA : GENERIC_WRITE, FILE_SHARE_WRITE, NULL,
+		append ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (handle == INVALID_HANDLE_VALUE)
 	{
 		work->result = GetLastError();
@@ -263,6 +285,7 @@ static void compress_wrap(fs_work_t* work) {
 static int file_thread_func(void* user)
 {
 	fs_t* fs = user;
+	TRACE_THREAD_NAME(fs->trace, "fs file");
 	while (true)
 	{
 		fs_work_t* work = queue_pop(fs->file_queue);
@@ -274,19 +297,22 @@ static int file_thread_func(void* user)
 		switch (work->op)
 		{
 		case k_fs_work_op_read:
-			file_read(work, user);
+			TRACE_SCOPE(fs->trace, "file_read") file_read(work, user);
 			break;
 		case k_fs_work_op_write:
-			file_write(work);
+		case k_fs_work_op_append:
+			TRACE_SCOPE(fs->trace, "file_write") file_write(work);
 			break;
 		}
 	}
+	heap_thread_cache_flush(fs->heap);
 	return 0;
 }
 
 static int compression_thread_func(void* user)
 {
 	fs_t* fs = user;
+	TRACE_THREAD_NAME(fs->trace, "fs compression");
 	while (true)
 	{
 		fs_work_t* work = queue_pop(fs->compression_queue);
@@ -300,18 +326,19 @@ static int compression_thread_func(void* user)
 		case k_fs_work_op_read:
 			//decompress
 			mutex_lock(work->mutex);
-			decompress_wrap(work);
+			TRACE_SCOPE(fs->trace, "decompress") decompress_wrap(work);
 			mutex_unlock(work->mutex);
 			event_signal(work->done);
 			break;
 		case k_fs_work_op_write:
 			//compress
 			mutex_lock(work->mutex);
-			compress_wrap(work);
+			TRACE_SCOPE(fs->trace, "compress") compress_wrap(work);
 			mutex_unlock(work->mutex);
 			queue_push(fs->file_queue, work);
 			break;
 		}
 	}
+	heap_thread_cache_flush(fs->heap);
 	return 0;
 }
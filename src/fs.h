@@ -11,11 +11,13 @@ typedef struct fs_t fs_t;
 typedef struct fs_work_t fs_work_t;
 
 typedef struct heap_t heap_t;
+typedef struct trace_t trace_t;
 
 // Create a new file system.
 // Provided heap will be used to allocate space for queue and work buffers.
 // Provided queue size defines number of in-flight file operations.
-fs_t* fs_create(heap_t* heap, int queue_capacity);
+// File and compression work is traced to trace, which may be NULL.
+fs_t* fs_create(heap_t* heap, int queue_capacity, trace_t* trace);
 
 // Destroy a previously created file system.
 void fs_destroy(fs_t* fs);
@@ -32,6 +34,14 @@ fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate
 // Returns a work object.
 fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression);
 
+// Queue an append to a file.
+// The buffer is written after the end of the file at the specified path, which is
+// created if it does not exist. Work is done in the order it is queued, so a
+// file can be streamed out with one fs_write followed by any number of appends.
+// The buffer must stay valid until the work is complete.
+// Returns a work object.
+fs_work_t* fs_append(fs_t* fs, const char* path, const void* buffer, size_t size);
+
 // If true, the file work is complete.
 bool fs_work_is_done(fs_work_t* work);
 
@@ -2,6 +2,7 @@
 
 #include "debug.h"
 #include "heap.h"
+#include "trace.h"
 #include "wm.h"
 
 #define VK_USE_PLATFORM_WIN32_KHR
@@ -67,6 +68,7 @@ typedef struct gpu_frame_t
 typedef struct gpu_t
 {
 	heap_t* heap;
+	trace_t* trace;
 	VkInstance instance;
 	VkPhysicalDevice physical_device;
 	VkDevice logical_device;
@@ -105,11 +107,12 @@ static void create_mesh_layouts(gpu_t* gpu);
 static void destroy_mesh_layouts(gpu_t* gpu);
 static uint32_t get_memory_type_index(gpu_t* gpu, uint32_t bits, VkMemoryPropertyFlags properties);
 
-gpu_t* gpu_create(heap_t* heap, wm_window_t* window)
+gpu_t* gpu_create(heap_t* heap, wm_window_t* window, trace_t* trace)
 {
 	gpu_t* gpu = heap_alloc(heap, sizeof(gpu_t), 8);
 	memset(gpu, 0, sizeof(*gpu));
 	gpu->heap = heap;
+	gpu->trace = trace;
 
 	//////////////////////////////////////////////////////
 	// Create VkInstance
@@ -1271,6 +1274,8 @@ gpu_cmd_buffer_t* gpu_frame_begin(gpu_t* gpu)
 
 void gpu_frame_end(gpu_t* gpu)
 {
+	TRACE_PUSH(gpu->trace, "gpu_frame_end");
+
 	gpu_frame_t* frame = &gpu->frames[gpu->frame_index];
 	gpu->frame_index = (gpu->frame_index + 1) % gpu->frame_count;
 
@@ -1282,13 +1287,19 @@ void gpu_frame_end(gpu_t* gpu)
 	}
 
 	uint32_t image_index;
-	result = vkAcquireNextImageKHR(gpu->logical_device, gpu->swap_chain, UINT64_MAX, gpu->present_complete_sema, VK_NULL_HANDLE, &image_index);
+	TRACE_SCOPE(gpu->trace, "vkAcquireNextImageKHR")
+	{
+		result = vkAcquireNextImageKHR(gpu->logical_device, gpu->swap_chain, UINT64_MAX, gpu->present_complete_sema, VK_NULL_HANDLE, &image_index);
+	}
 	if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
 	{
 		debug_print(k_print_error, "vkAcquireNextImageKHR failed: %d\n", result);
 	}
 
-	result = vkWaitForFences(gpu->logical_device, 1, &frame->fence, VK_TRUE, UINT64_MAX);
+	TRACE_SCOPE(gpu->trace, "vkWaitForFences")
+	{
+		result = vkWaitForFences(gpu->logical_device, 1, &frame->fence, VK_TRUE, UINT64_MAX);
+	}
 	if (result)
 	{
 		debug_print(k_print_error, "vkWaitForFences failed: %d\n", result);
@@ -1311,7 +1322,10 @@ void gpu_frame_end(gpu_t* gpu)
 		.pWaitSemaphores = &gpu->present_complete_sema,
 		.pSignalSemaphores = &gpu->render_complete_sema,
 	};
-	result = vkQueueSubmit(gpu->queue, 1, &submit_info, frame->fence);
+	TRACE_SCOPE(gpu->trace, "vkQueueSubmit")
+	{
+		result = vkQueueSubmit(gpu->queue, 1, &submit_info, frame->fence);
+	}
 	if (result)
 	{
 		debug_print(k_print_error, "vkQueueSubmit failed: %d\n", result);
@@ -1326,11 +1340,16 @@ void gpu_frame_end(gpu_t* gpu)
 		.pWaitSemaphores = &gpu->render_complete_sema,
 		.waitSemaphoreCount = 1,
 	};
-	result = vkQueuePresentKHR(gpu->queue, &present_info);
+	TRACE_SCOPE(gpu->trace, "vkQueuePresentKHR")
+	{
+		result = vkQueuePresentKHR(gpu->queue, &present_info);
+	}
 	if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
 	{
 		debug_print(k_print_error, "vkQueuePresentKHR failed: %d\n", result);
 	}
+
+	TRACE_POP(gpu->trace);
 }
 
 void gpu_cmd_pipeline_bind(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, gpu_pipeline_t* pipeline)
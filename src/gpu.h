@@ -11,6 +11,7 @@ typedef struct gpu_shader_t gpu_shader_t;
 typedef struct gpu_uniform_buffer_t gpu_uniform_buffer_t;
 
 typedef struct heap_t heap_t;
+typedef struct trace_t trace_t;
 typedef struct wm_window_t wm_window_t;
 
 typedef struct gpu_descriptor_info_t
@@ -59,7 +60,8 @@ typedef struct gpu_uniform_buffer_info_t
 } gpu_uniform_buffer_info_t;
 
 // Create an instance of Vulkan on the provided window.
-gpu_t* gpu_create(heap_t* heap, wm_window_t* window);
+// Frame submission and its waits are traced to trace, which may be NULL.
+gpu_t* gpu_create(heap_t* heap, wm_window_t* window, trace_t* trace);
 
 // Destroy the previously created Vulkan.
 void gpu_destroy(gpu_t* gpu);
@@ -4,72 +4,131 @@
 #include "mutex.h"
 #include "tlsf/tlsf.h"
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <DbgHelp.h>
 
-typedef struct arena_t
+enum
 {
-	int size;
-	void* address;
-	char* callstack;
-	int freed;
+	// Allocations up to this size are served from per-thread caches.
+	k_heap_cache_min_size = 16,
+	k_heap_cache_class_count = 8,
+	k_heap_cache_max_size = k_heap_cache_min_size << (k_heap_cache_class_count - 1),
+
+	// Each size class holds at most this many free blocks per thread.
+	// Blocks move to and from the shared TLSF heap half a magazine at a time.
+	k_heap_cache_capacity = 32,
+	k_heap_cache_batch = k_heap_cache_capacity / 2,
+
+	// Number of return addresses kept for each live allocation.
+	k_heap_callstack_depth = 7,
+
+	// With k_heap_tracking_sampled_stacks, one allocation in this many gets a callstack.
+	k_heap_sample_interval = 64,
 
+	// Allocations this size and larger bypass TLSF and get their own OS mapping.
+	k_heap_large_alloc_size = 256 * 1024,
+	k_heap_page_size = 4096,
+
+	// Set in the word before a large allocation, a bit TLSF never sets on a block it has handed out.
+	k_heap_large_tag = 1,
+};
+
+//Memory obtained from the OS and handed to TLSF as a pool
+//Placed at the start of an arena_alignment boundary within a larger reservation starting at base
+typedef struct arena_t
+{
+	void* base;
 	pool_t pool;
+	size_t size;
+	size_t used_bytes;
 	struct arena_t* next;
-	struct sub_arena_t* sub;
 } arena_t;
 
-//Sub-arena structure is for an allocation that did not require the creation of a new arena so that information could be stored
-typedef struct sub_arena_t
+//Header placed directly before every large allocation
+//TLSF keeps a block's size in the word directly before the address it returns, with bit 0 clear
+//while the block is in use. The tag sits in that same word with bit 0 set, which is how heap_free
+//tells the two kinds of allocation apart without any lookup.
+typedef struct heap_large_t
 {
-	int size;
-	void* address;
-	char* callstack;
-	int freed;
+	struct heap_large_t* prev;
+	struct heap_large_t* next;
+	void* base;
+	size_t map_size;
+	size_t size;
+	void* callstack[k_heap_callstack_depth];
+	size_t tag;
+} heap_large_t;
+
+//Leak-tracking record stored in the last bytes of every block when stacks are tracked
+//Written on allocation and only read again if the block leaks, so free does no tracking work at all
+typedef struct heap_alloc_record_t
+{
+	size_t size;
+	void* callstack[k_heap_callstack_depth];
+} heap_alloc_record_t;
+
+//Allocation counters, owned either by a thread cache or by the heap under its mutex
+typedef struct heap_counters_t
+{
+	int64_t allocation_count;
+	int64_t live_count;
+	int64_t live_bytes;
+} heap_counters_t;
 
-	struct sub_arena_t* sub;
-} sub_arena_t;
+//Magazine of free blocks for a single size class
+typedef struct heap_magazine_t
+{
+	int count;
+	void* blocks[k_heap_cache_capacity];
+} heap_magazine_t;
+
+//Per-thread cache, only ever touched by its owning thread until heap_destroy
+typedef struct heap_thread_cache_t
+{
+	heap_magazine_t magazines[k_heap_cache_class_count];
+	heap_counters_t counters;
+	struct heap_thread_cache_t* next;
+} heap_thread_cache_t;
 
 typedef struct heap_t
 {
 	tlsf_t tlsf;
 	size_t grow_increment;
 	arena_t* arena;
-	mutex_t* mutex;
-	unsigned int allocated;
-} heap_t;
-
-//Function that gets the stack information and formats it as needed for the output
-char* printStack() {
-	char* callstack = (char*)calloc(150, sizeof(char));
-	char* tmp = (char*)calloc(50, sizeof(char));
 
-	HANDLE process = GetCurrentProcess();
-	SymInitialize(process, NULL, TRUE);
+	//Power of two no pool can span, so masking a block's address finds the pool it belongs to
+	size_t arena_alignment;
+	mutex_t* mutex;
 
-	void* stack[64];
-	unsigned short frames = CaptureStackBackTrace(0, 5, stack, NULL);
+	DWORD cache_tls_index;
+	heap_thread_cache_t* caches;
 
-	SYMBOL_INFO* symbol = (SYMBOL_INFO*)calloc(sizeof(SYMBOL_INFO) + 256 * sizeof(char), 1);
-	symbol->MaxNameLen = 255;
-	symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+	heap_tracking_t tracking;
+	size_t record_size;
+	heap_counters_t counters;
 
-	for (int i = 2; i < frames; i++) {
-		SymFromAddr(process, (DWORD64)(stack[i]), 0, symbol);
-		sprintf_s(tmp, 50*sizeof(char), "[%d] %s\n", i-2, symbol->Name);
-		strcat_s(callstack, 150*sizeof(char), tmp);
-	}
+	//TLSF-level usage, always maintained under the mutex
+	size_t bytes_in_use;
+	size_t peak_bytes_in_use;
+	int pool_count;
+	size_t pool_bytes;
 
-	free(symbol);
+	//Pools with nothing allocated from them, one is kept around to avoid remapping at a boundary
+	int empty_pool_count;
 
-	return callstack;
-}
+	//Allocations mapped directly from the OS
+	heap_large_t* large;
+	int large_count;
+	size_t large_bytes;
+} heap_t;
 
-heap_t* heap_create(size_t grow_increment)
+heap_t* heap_create(size_t grow_increment, heap_tracking_t tracking)
 {
 	heap_t* heap = VirtualAlloc(NULL, sizeof(heap_t) + tlsf_size(),
 		MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
@@ -85,180 +144,631 @@ heap_t* heap_create(size_t grow_increment)
 	heap->grow_increment = grow_increment;
 	heap->tlsf = tlsf_create(heap + 1);
 	heap->arena = NULL;
+	heap->cache_tls_index = TlsAlloc();
+	heap->caches = NULL;
+#if HEAP_TRACKING
+	heap->tracking = tracking;
+#else
+	heap->tracking = k_heap_tracking_none;
+#endif
+	heap->record_size = heap->tracking >= k_heap_tracking_sampled_stacks ? sizeof(heap_alloc_record_t) : 0;
+
+	//Requests this large go to heap_large_alloc, so no pool is bigger than this
+	size_t max_arena_size =
+		__max(grow_increment, (k_heap_large_alloc_size + heap->record_size) * 2) +
+		2 * sizeof(arena_t) + tlsf_pool_overhead();
+	heap->arena_alignment = k_heap_page_size;
+	while (heap->arena_alignment < max_arena_size)
+	{
+		heap->arena_alignment <<= 1;
+	}
+	memset(&heap->counters, 0, sizeof(heap->counters));
+	heap->bytes_in_use = 0;
+	heap->peak_bytes_in_use = 0;
+	heap->pool_count = 0;
+	heap->pool_bytes = 0;
+	heap->empty_pool_count = 0;
+	heap->large = NULL;
+	heap->large_count = 0;
+	heap->large_bytes = 0;
 
 	return heap;
 }
 
-void* heap_alloc(heap_t* heap, size_t size, size_t alignment)
+//The record always sits at the very end of the block, so it can be found from the address alone
+static heap_alloc_record_t* heap_record_for_block(void* address, size_t block_size)
 {
-	mutex_lock(heap->mutex);
+	return (heap_alloc_record_t*)((char*)address + block_size - sizeof(heap_alloc_record_t));
+}
+
+#if HEAP_TRACKING
+//Updates counters and, when the level asks for it, captures the caller's callstack into the block's record
+//Must be called directly from heap_alloc so the skipped frames are heap internals only
+static void heap_track_alloc(heap_t* heap, heap_counters_t* counters, void* address, size_t size)
+{
+	size_t block_size = tlsf_block_size(address);
+	counters->allocation_count++;
+	counters->live_count++;
+	counters->live_bytes += block_size;
+
+	if (heap->record_size)
+	{
+		heap_alloc_record_t* record = heap_record_for_block(address, block_size);
+		record->size = size;
+		int frames = 0;
+		if (heap->tracking == k_heap_tracking_full_stacks ||
+			counters->allocation_count % k_heap_sample_interval == 0)
+		{
+			frames = CaptureStackBackTrace(2, k_heap_callstack_depth, record->callstack, NULL);
+		}
+		memset(&record->callstack[frames], 0, sizeof(void*) * (k_heap_callstack_depth - frames));
+	}
+}
 
-	size_t size_plus_callstack = size + 64;
+static void heap_track_free(heap_counters_t* counters, void* address)
+{
+	counters->live_count--;
+	counters->live_bytes -= tlsf_block_size(address);
+}
+#endif
 
-	void* address = tlsf_memalign(heap->tlsf, alignment, size_plus_callstack);
+//Finds the pool a TLSF block was carved from
+//Each pool starts on an arena_alignment boundary and ends before the next one
+static arena_t* heap_arena_for_block(heap_t* heap, void* address)
+{
+	return (arena_t*)((size_t)address & ~(heap->arena_alignment - 1));
+}
+
+//Allocates straight from TLSF with room for a record, heap->mutex must be held
+static void* heap_backend_alloc(heap_t* heap, size_t size, size_t alignment)
+{
+	size_t size_plus_record = size + heap->record_size;
+
+	void* address = tlsf_memalign(heap->tlsf, alignment, size_plus_record);
 	if (!address)
 	{
 		size_t arena_size =
-			__max(heap->grow_increment, size_plus_callstack * 2) +
+			__max(heap->grow_increment, size_plus_record * 2) +
 			sizeof(arena_t);
-		arena_t* arena = VirtualAlloc(NULL,
-			arena_size + tlsf_pool_overhead(),
-			MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		size_t map_size = arena_size + tlsf_pool_overhead();
+
+		//Reserve enough address space to align the pool, only the pool itself is committed
+		char* base = VirtualAlloc(NULL, map_size + heap->arena_alignment, MEM_RESERVE, PAGE_NOACCESS);
+		arena_t* arena = NULL;
+		if (base)
+		{
+			char* aligned = (char*)(((size_t)base + heap->arena_alignment - 1) & ~(heap->arena_alignment - 1));
+			arena = VirtualAlloc(aligned, map_size, MEM_COMMIT, PAGE_READWRITE);
+		}
 		if (!arena)
 		{
+			if (base)
+			{
+				VirtualFree(base, 0, MEM_RELEASE);
+			}
 			debug_print(
 				k_print_error,
 				"OUT OF MEMORY!\n");
 			return NULL;
 		}
 
+		arena->base = base;
 		arena->pool = tlsf_add_pool(heap->tlsf, arena + 1, arena_size);
+		arena->size = arena_size;
+		arena->used_bytes = 0;
 
 		arena->next = heap->arena;
 		heap->arena = arena;
+		heap->pool_count++;
+		heap->pool_bytes += arena_size;
+		heap->empty_pool_count++;
+
+		address = tlsf_memalign(heap->tlsf, alignment, size_plus_record);
+	}
 
-		address = tlsf_memalign(heap->tlsf, alignment, size_plus_callstack);
+	if (address)
+	{
+		size_t block_size = tlsf_block_size(address);
+		arena_t* arena = heap_arena_for_block(heap, address);
+		if (arena->used_bytes == 0)
+		{
+			heap->empty_pool_count--;
+		}
+		arena->used_bytes += block_size;
 
-		//Initializes the arena_t variables to the needed values
-		arena->size = (int)size;
-		arena->address = address;
-		arena->freed = 0;
-		arena->callstack = printStack();
+		heap->bytes_in_use += block_size;
+		heap->peak_bytes_in_use = __max(heap->peak_bytes_in_use, heap->bytes_in_use);
+	}
+
+	return address;
+}
+
+//Removes an empty pool from TLSF and returns its memory to the OS, heap->mutex must be held
+static void heap_release_arena(heap_t* heap, arena_t* arena)
+{
+	arena_t** link = &heap->arena;
+	while (*link != arena)
+	{
+		link = &(*link)->next;
 	}
-	else {
-		//Sub arena is used when a new arena was not created by the allocate so that memory can still be tracked and save info
-		sub_arena_t* sub_arena = VirtualAlloc(NULL,
-			sizeof(sub_arena_t),
-			MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	*link = arena->next;
 
-		if (!sub_arena)
+	tlsf_remove_pool(heap->tlsf, arena->pool);
+	heap->pool_count--;
+	heap->pool_bytes -= arena->size;
+	VirtualFree(arena->base, 0, MEM_RELEASE);
+}
+
+//Returns memory straight to TLSF, heap->mutex must be held
+static void heap_backend_free(heap_t* heap, void* address)
+{
+	size_t block_size = tlsf_block_size(address);
+	arena_t* arena = heap_arena_for_block(heap, address);
+	arena->used_bytes -= block_size;
+	heap->bytes_in_use -= block_size;
+	tlsf_free(heap->tlsf, address);
+
+	if (arena->used_bytes == 0)
+	{
+		if (heap->empty_pool_count > 0)
 		{
-			debug_print(
-				k_print_error,
-				"OUT OF MEMORY!\n");
-			return NULL;
+			heap_release_arena(heap, arena);
 		}
+		else
+		{
+			heap->empty_pool_count++;
+		}
+	}
+}
 
-		sub_arena->size = (int)size;
-		sub_arena->address = address;
-		sub_arena->freed = 0;
-		sub_arena->callstack = printStack();
+//Maps a request size to the size class that serves it
+static int heap_cache_class_for_size(size_t size)
+{
+	int size_class = 0;
+	size_t class_size = k_heap_cache_min_size;
+	while (class_size < size)
+	{
+		class_size <<= 1;
+		size_class++;
+	}
+	return size_class;
+}
 
-		//Checks if the arena already has a sub, if it does it just makes a sub to the lowest sub existing
-		sub_arena_t* ptr = heap->arena->sub;
-		//If ptr is null that means arena has no sub so far
-		if (ptr == NULL) 
+//Maps a block back to the largest size class it can hold, or -1 if it should not be cached
+static int heap_cache_class_for_block(heap_t* heap, void* address)
+{
+	size_t usable = tlsf_block_size(address) - heap->record_size;
+	if (usable < k_heap_cache_min_size || usable >= k_heap_cache_max_size * 2)
+	{
+		return -1;
+	}
+	int size_class = 0;
+	size_t class_size = k_heap_cache_min_size;
+	while (size_class < k_heap_cache_class_count - 1 && class_size * 2 <= usable)
+	{
+		class_size <<= 1;
+		size_class++;
+	}
+	return size_class;
+}
+
+static heap_thread_cache_t* heap_get_thread_cache(heap_t* heap)
+{
+	if (heap->cache_tls_index == TLS_OUT_OF_INDEXES)
+	{
+		return NULL;
+	}
+	heap_thread_cache_t* cache = TlsGetValue(heap->cache_tls_index);
+	if (!cache)
+	{
+		mutex_lock(heap->mutex);
+		cache = heap_backend_alloc(heap, sizeof(heap_thread_cache_t), 8);
+		if (cache)
 		{
-			heap->arena->sub = sub_arena;
+			memset(cache, 0, sizeof(*cache));
+			cache->next = heap->caches;
+			heap->caches = cache;
 		}
-		//Go lower b/c arena has a sub
-		else 
+		mutex_unlock(heap->mutex);
+		TlsSetValue(heap->cache_tls_index, cache);
+	}
+	return cache;
+}
+
+//Moves blocks out of a magazine and back into TLSF until only keep_count remain, heap->mutex must be held
+static void heap_magazine_drain(heap_t* heap, heap_magazine_t* magazine, int keep_count)
+{
+	while (magazine->count > keep_count)
+	{
+		heap_backend_free(heap, magazine->blocks[--magazine->count]);
+	}
+}
+
+//Pops a block from the calling thread's magazine, refilling it from TLSF when empty
+static void* heap_cache_alloc(heap_t* heap, heap_thread_cache_t* cache, size_t size)
+{
+	int size_class = heap_cache_class_for_size(size);
+	size_t class_size = (size_t)k_heap_cache_min_size << size_class;
+	heap_magazine_t* magazine = &cache->magazines[size_class];
+	if (magazine->count == 0)
+	{
+		//Refill half a magazine with a single trip through the lock
+		mutex_lock(heap->mutex);
+		while (magazine->count < k_heap_cache_batch)
 		{
-			while (ptr != NULL)
+			void* block = heap_backend_alloc(heap, class_size, tlsf_align_size());
+			if (!block)
 			{
-				ptr = ptr->sub;
+				break;
 			}
-			ptr = sub_arena;
+			magazine->blocks[magazine->count++] = block;
+		}
+		mutex_unlock(heap->mutex);
+		if (magazine->count == 0)
+		{
+			return NULL;
 		}
 	}
+	return magazine->blocks[--magazine->count];
+}
 
-	if (address)
+static bool heap_is_large(void* address)
+{
+	return (((size_t*)address)[-1] & k_heap_large_tag) != 0;
+}
+
+static heap_large_t* heap_large_for_address(void* address)
+{
+	return (heap_large_t*)address - 1;
+}
+
+//Maps a large allocation directly from the OS
+//Must be called directly from heap_alloc so the skipped frames are heap internals only
+static void* heap_large_alloc(heap_t* heap, size_t size, size_t alignment)
+{
+	alignment = __max(alignment, sizeof(void*));
+	size_t map_size = (sizeof(heap_large_t) + alignment - 1 + size + k_heap_page_size - 1) & ~((size_t)k_heap_page_size - 1);
+	char* base = VirtualAlloc(NULL, map_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (!base)
 	{
-		void* callstack = (char*)address + size;
-		CaptureStackBackTrace(0, 8, callstack, NULL);
+		debug_print(
+			k_print_error,
+			"OUT OF MEMORY!\n");
+		return NULL;
 	}
 
+	char* address = (char*)(((size_t)base + sizeof(heap_large_t) + alignment - 1) & ~(alignment - 1));
+	heap_large_t* large = heap_large_for_address(address);
+	large->base = base;
+	large->map_size = map_size;
+	large->size = size;
+	large->tag = map_size | k_heap_large_tag;
+	large->prev = NULL;
+	memset(large->callstack, 0, sizeof(large->callstack));
+
+	mutex_lock(heap->mutex);
+	large->next = heap->large;
+	if (heap->large)
+	{
+		heap->large->prev = large;
+	}
+	heap->large = large;
+	heap->large_count++;
+	heap->large_bytes += map_size;
+	heap->bytes_in_use += map_size;
+	heap->peak_bytes_in_use = __max(heap->peak_bytes_in_use, heap->bytes_in_use);
+#if HEAP_TRACKING
+	if (heap->tracking != k_heap_tracking_none)
+	{
+		heap->counters.allocation_count++;
+		heap->counters.live_count++;
+		heap->counters.live_bytes += map_size;
+		if (heap->tracking == k_heap_tracking_full_stacks ||
+			(heap->tracking == k_heap_tracking_sampled_stacks && heap->counters.allocation_count % k_heap_sample_interval == 0))
+		{
+			CaptureStackBackTrace(2, k_heap_callstack_depth, large->callstack, NULL);
+		}
+	}
+#endif
 	mutex_unlock(heap->mutex);
 
 	return address;
 }
 
+//Unlinks a large allocation and unmaps it, heap->mutex must be held
+static void heap_large_free(heap_t* heap, heap_large_t* large)
+{
+	if (large->prev)
+	{
+		large->prev->next = large->next;
+	}
+	else
+	{
+		heap->large = large->next;
+	}
+	if (large->next)
+	{
+		large->next->prev = large->prev;
+	}
+	heap->large_count--;
+	heap->large_bytes -= large->map_size;
+	heap->bytes_in_use -= large->map_size;
+#if HEAP_TRACKING
+	if (heap->tracking != k_heap_tracking_none)
+	{
+		heap->counters.live_count--;
+		heap->counters.live_bytes -= large->map_size;
+	}
+#endif
+	VirtualFree(large->base, 0, MEM_RELEASE);
+}
+
+void* heap_alloc(heap_t* heap, size_t size, size_t alignment)
+{
+	if (size >= k_heap_large_alloc_size)
+	{
+		return heap_large_alloc(heap, size, alignment);
+	}
+
+	heap_thread_cache_t* cache = NULL;
+	if (size <= k_heap_cache_max_size && alignment <= tlsf_align_size())
+	{
+		cache = heap_get_thread_cache(heap);
+	}
+
+	void* address = NULL;
+	if (cache)
+	{
+		address = heap_cache_alloc(heap, cache, size);
+#if HEAP_TRACKING
+		if (address && heap->tracking != k_heap_tracking_none)
+		{
+			heap_track_alloc(heap, &cache->counters, address, size);
+		}
+#endif
+	}
+	else
+	{
+		mutex_lock(heap->mutex);
+		address = heap_backend_alloc(heap, size, alignment);
+#if HEAP_TRACKING
+		if (address && heap->tracking != k_heap_tracking_none)
+		{
+			heap_track_alloc(heap, &heap->counters, address, size);
+		}
+#endif
+		mutex_unlock(heap->mutex);
+	}
+	return address;
+}
+
 void heap_free(heap_t* heap, void* address)
 {
-	mutex_lock(heap->mutex);
-	tlsf_free(heap->tlsf, address);
-	arena_t* arena = heap->arena;
-	while (arena)
+	if (!address)
 	{
-		//Check if arena address matches
-		if (address == arena->address) {
-			arena->freed = 1;
-			return;
+		return;
+	}
+
+	if (heap_is_large(address))
+	{
+		mutex_lock(heap->mutex);
+		heap_large_free(heap, heap_large_for_address(address));
+		mutex_unlock(heap->mutex);
+		return;
+	}
+
+	int size_class = heap_cache_class_for_block(heap, address);
+	heap_thread_cache_t* cache = size_class >= 0 ? heap_get_thread_cache(heap) : NULL;
+	if (!cache)
+	{
+		mutex_lock(heap->mutex);
+#if HEAP_TRACKING
+		if (heap->tracking != k_heap_tracking_none)
+		{
+			heap_track_free(&heap->counters, address);
 		}
-		//Check if sub address matches until no more sub's
-		else
+#endif
+		heap_backend_free(heap, address);
+		mutex_unlock(heap->mutex);
+		return;
+	}
+
+#if HEAP_TRACKING
+	if (heap->tracking != k_heap_tracking_none)
+	{
+		heap_track_free(&cache->counters, address);
+	}
+#endif
+
+	heap_magazine_t* magazine = &cache->magazines[size_class];
+	if (magazine->count == k_heap_cache_capacity)
+	{
+		//Return the older half of the magazine with a single trip through the lock
+		mutex_lock(heap->mutex);
+		for (int i = 0; i < k_heap_cache_batch; ++i)
 		{
-			sub_arena_t* ptr = arena->sub;
-			while (ptr != NULL) {
-				if (address == ptr->address) {
-					ptr->freed = 1;
-					return;
-				}
-				ptr = ptr->sub;
-			}
+			heap_backend_free(heap, magazine->blocks[i]);
+		}
+		memmove(magazine->blocks, &magazine->blocks[k_heap_cache_batch],
+			sizeof(void*) * (k_heap_cache_capacity - k_heap_cache_batch));
+		magazine->count -= k_heap_cache_batch;
+		mutex_unlock(heap->mutex);
+	}
+	magazine->blocks[magazine->count++] = address;
+}
+
+void heap_thread_cache_flush(heap_t* heap)
+{
+	if (heap->cache_tls_index == TLS_OUT_OF_INDEXES)
+	{
+		return;
+	}
+	heap_thread_cache_t* cache = TlsGetValue(heap->cache_tls_index);
+	if (cache)
+	{
+		mutex_lock(heap->mutex);
+		for (int i = 0; i < k_heap_cache_class_count; ++i)
+		{
+			heap_magazine_drain(heap, &cache->magazines[i], 0);
 		}
-		arena = arena->next;
+		mutex_unlock(heap->mutex);
+	}
+}
+
+static void free_block_walker(void* ptr, size_t size, int used, void* user)
+{
+	if (!used)
+	{
+		size_t* free_totals = user;
+		free_totals[0] += size;
+		free_totals[1] = __max(free_totals[1], size);
+	}
+}
+
+void heap_get_stats(heap_t* heap, heap_stats_t* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	//Total and largest free bytes across all pools
+	size_t free_totals[2] = { 0, 0 };
+
+	mutex_lock(heap->mutex);
+	stats->bytes_in_use = heap->bytes_in_use;
+	stats->peak_bytes_in_use = heap->peak_bytes_in_use;
+	stats->pool_count = heap->pool_count;
+	stats->pool_bytes = heap->pool_bytes;
+	stats->large_allocation_count = heap->large_count;
+	stats->large_bytes = heap->large_bytes;
+	for (arena_t* arena = heap->arena; arena; arena = arena->next)
+	{
+		tlsf_walk_pool(arena->pool, free_block_walker, free_totals);
+	}
+
+	//Thread caches are only written by their owners, these reads may be a few allocations stale
+	stats->live_allocation_count = heap->counters.live_count;
+	stats->total_allocation_count = heap->counters.allocation_count;
+	for (heap_thread_cache_t* cache = heap->caches; cache; cache = cache->next)
+	{
+		stats->live_allocation_count += cache->counters.live_count;
+		stats->total_allocation_count += cache->counters.allocation_count;
 	}
 	mutex_unlock(heap->mutex);
+
+	stats->largest_free_block = free_totals[1];
+	stats->fragmentation = free_totals[0] ? 1.0f - (float)free_totals[1] / (float)free_totals[0] : 0.0f;
 }
 
-void free_sub(sub_arena_t* sub) {
-	//If the sub has not been free'd output message
-	if (sub->freed == 0)
+static void print_leak(size_t size, void** callstack)
+{
+	if (!callstack[0])
 	{
 		debug_print(
 			k_print_info,
-			"Memory leak of size %d with call stack:\n%s\n",
-			sub->size, sub->callstack);
-		free(sub->callstack);
+			"Memory leak of size %zu (call stack not sampled)\n",
+			size);
+		return;
 	}
-	//If the sub has a sub need to call this function again on it
-	if (sub->sub)
+
+	debug_print(
+		k_print_info,
+		"Memory leak of size %zu with call stack:\n",
+		size);
+
+	HANDLE process = GetCurrentProcess();
+	char symbol_buffer[sizeof(SYMBOL_INFO) + 256];
+	SYMBOL_INFO* symbol = (SYMBOL_INFO*)symbol_buffer;
+	for (int i = 0; i < k_heap_callstack_depth && callstack[i]; ++i)
 	{
-		free_sub(sub);
+		memset(symbol, 0, sizeof(SYMBOL_INFO));
+		symbol->MaxNameLen = 255;
+		symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+		if (SymFromAddr(process, (DWORD64)callstack[i], 0, symbol))
+		{
+			debug_print(k_print_info, "[%d] %s\n", i, symbol->Name);
+		}
+		else
+		{
+			debug_print(k_print_info, "[%d] %p\n", i, callstack[i]);
+		}
 	}
-
-	VirtualFree(sub, 0, MEM_RELEASE);
 }
 
+//Any block TLSF still considers used once the caches are drained is a leak
 static void leak_check(void* ptr, size_t size, int used, void* user)
 {
-	if (used)
+	heap_t* heap = user;
+	if (!used)
+	{
+		return;
+	}
+	if (!heap->record_size)
 	{
-		//void* callstack = (char*)ptr + (size - 64); 
-		//symbolicate callstack!
-		//print!
+		debug_print(
+			k_print_info,
+			"Memory leak of block size %zu\n",
+			size);
+		return;
 	}
+
+	heap_alloc_record_t* record = heap_record_for_block(ptr, size);
+	print_leak(record->size, record->callstack);
 }
 
 void heap_destroy(heap_t* heap)
 {
-
-	tlsf_destroy(heap->tlsf);
+	//Return every cached block so that only real leaks remain allocated
+	heap_counters_t totals = heap->counters;
+	heap_thread_cache_t* cache = heap->caches;
+	while (cache)
+	{
+		heap_thread_cache_t* next = cache->next;
+		for (int i = 0; i < k_heap_cache_class_count; ++i)
+		{
+			heap_magazine_drain(heap, &cache->magazines[i], 0);
+		}
+		totals.allocation_count += cache->counters.allocation_count;
+		totals.live_count += cache->counters.live_count;
+		totals.live_bytes += cache->counters.live_bytes;
+		heap_backend_free(heap, cache);
+		cache = next;
+	}
+	TlsFree(heap->cache_tls_index);
 
 	arena_t* arena = heap->arena;
-	while (arena)
+	if (heap->tracking != k_heap_tracking_none && totals.live_count)
 	{
-		tlsf_walk_pool(arena->pool, leak_check, NULL);
+		debug_print(
+			k_print_info,
+			"Heap destroyed with %lld of %lld allocations still live (%lld bytes)\n",
+			totals.live_count, totals.allocation_count, totals.live_bytes);
 
-		//If arena isn't free'd output message
-		if (arena->freed == 0)
+		//Symbols are only needed to report leaks, so they are loaded here and nowhere else
+		HANDLE process = GetCurrentProcess();
+		SymInitialize(process, NULL, TRUE);
+		while (arena)
 		{
-			debug_print(
-				k_print_info,
-				"Memory leak of size %d with call stack:\n%s\n",
-				arena->size, arena->callstack);
-			free(arena->callstack);
+			tlsf_walk_pool(arena->pool, leak_check, heap);
+			arena = arena->next;
 		}
-		arena_t* next = arena->next;
-
-		//If arena has a sub, check if a leak, then free it before freeing the arena
-		if (arena->sub)
+		for (heap_large_t* large = heap->large; large; large = large->next)
 		{
-			free_sub(arena->sub);
+			print_leak(large->size, large->callstack);
 		}
+		SymCleanup(process);
+	}
+
+	while (heap->large)
+	{
+		heap_large_free(heap, heap->large);
+	}
+
+	tlsf_destroy(heap->tlsf);
 
-		VirtualFree(arena, 0, MEM_RELEASE);
+	arena = heap->arena;
+	while (arena)
+	{
+		arena_t* next = arena->next;
+		VirtualFree(arena->base, 0, MEM_RELEASE);
 		arena = next;
 	}
 
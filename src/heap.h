@@ -6,14 +6,62 @@
 // 
 // Main object, heap_t, represents a dynamic memory heap.
 // Once created, memory can be allocated and free from the heap.
+//
+// Small allocations are served from per-thread caches without taking
+// the heap lock. Cached blocks move to and from the shared heap in batches.
+
+// Define HEAP_TRACKING to 0 to compile all leak tracking out of the heap.
+// Every heap then behaves as k_heap_tracking_none regardless of the level requested.
+#ifndef HEAP_TRACKING
+#define HEAP_TRACKING 1
+#endif
+
+// How much a heap records about its allocations.
+// Each level includes everything recorded by the levels before it.
+typedef enum heap_tracking_t
+{
+	// No tracking, allocations go straight to the allocator.
+	k_heap_tracking_none,
+	// Count live allocations and bytes. Leaks are reported by size only.
+	k_heap_tracking_counters,
+	// Also capture the callstack of every 64th allocation.
+	k_heap_tracking_sampled_stacks,
+	// Capture the callstack of every allocation.
+	k_heap_tracking_full_stacks,
+} heap_tracking_t;
 
 // Handle to a heap.
 typedef struct heap_t heap_t;
 
+// Snapshot of heap usage. See heap_get_stats().
+typedef struct heap_stats_t
+{
+	// Bytes in blocks handed out by the heap, including blocks held in thread caches and large mappings.
+	size_t bytes_in_use;
+	// Highest bytes_in_use since the heap was created.
+	size_t peak_bytes_in_use;
+	// Live and total heap_alloc calls.
+	// Only counted with k_heap_tracking_counters or above, zero otherwise.
+	long long live_allocation_count;
+	long long total_allocation_count;
+	// Number of OS memory pools backing the heap and their combined size.
+	int pool_count;
+	size_t pool_bytes;
+	// Allocations too large for the pools, each mapped directly from the OS, and their mapped size.
+	int large_allocation_count;
+	size_t large_bytes;
+	// Largest single free block, the biggest allocation that fits without growing.
+	size_t largest_free_block;
+	// 1 - largest_free_block / total free bytes.
+	// Zero when all free memory is contiguous, approaching one as it splinters.
+	float fragmentation;
+} heap_stats_t;
+
 // Creates a new memory heap.
 // The grow increment is the default size with which the heap grows.
 // Should be a multiple of OS page size.
-heap_t* heap_create(size_t grow_increment);
+// Leaks are reported on destroy with as much detail as the tracking level records.
+heap_t* heap_create(size_t grow_increment, heap_tracking_t tracking);
 
 // Destroy a previously created heap.
 void heap_destroy(heap_t* heap);
@@ -23,3 +71,11 @@ void* heap_alloc(heap_t* heap, size_t size, size_t alignment);
 
 // Free memory previously allocated from a heap.
 void heap_free(heap_t* heap, void* address);
+
+// Return all blocks cached by the calling thread to the shared heap.
+// Long-lived threads that stop using a heap should call this before exiting.
+void heap_thread_cache_flush(heap_t* heap);
+
+// Gather usage and fragmentation statistics for a heap.
+// Walks every pool under the heap lock, so call it periodically rather than per allocation.
+void heap_get_stats(heap_t* heap, heap_stats_t* stats);
@@ -0,0 +1,191 @@
+#include "bench.h"
+
+#include "debug.h"
+#include "event.h"
+#include "heap.h"
+#include "mutex.h"
+#include "thread.h"
+#include "timer.h"
+#include "tlsf/tlsf.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+enum
+{
+	k_bench_iterations = 2000,
+	k_bench_blocks = 64,
+	k_bench_mutex_pool_size = 64 * 1024 * 1024,
+};
+
+typedef struct heap_bench_data_t
+{
+	heap_t* heap;
+	tlsf_t tlsf;
+	mutex_t* mutex;
+	event_t* start;
+} heap_bench_data_t;
+
+// Sizes typical of engine traffic: commands, uniform copies, packets.
+static const size_t s_sizes[] = { 16, 24, 48, 64, 200, 256, 1028, 1100 };
+
+static int cached_func(void* user)
+{
+	heap_bench_data_t* data = user;
+	void* blocks[k_bench_blocks];
+	event_wait(data->start);
+
+	uint64_t t0 = timer_get_ticks();
+	for (int i = 0; i < k_bench_iterations; ++i)
+	{
+		for (int b = 0; b < k_bench_blocks; ++b)
+		{
+			blocks[b] = heap_alloc(data->heap, s_sizes[b % _countof(s_sizes)], 8);
+		}
+		for (int b = 0; b < k_bench_blocks; ++b)
+		{
+			heap_free(data->heap, blocks[b]);
+		}
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	heap_thread_cache_flush(data->heap);
+	return (int)timer_ticks_to_us(t1 - t0);
+}
+
+static int mutex_func(void* user)
+{
+	heap_bench_data_t* data = user;
+	void* blocks[k_bench_blocks];
+	event_wait(data->start);
+
+	uint64_t t0 = timer_get_ticks();
+	for (int i = 0; i < k_bench_iterations; ++i)
+	{
+		for (int b = 0; b < k_bench_blocks; ++b)
+		{
+			mutex_lock(data->mutex);
+			blocks[b] = tlsf_memalign(data->tlsf, 8, s_sizes[b % _countof(s_sizes)]);
+			mutex_unlock(data->mutex);
+		}
+		for (int b = 0; b < k_bench_blocks; ++b)
+		{
+			mutex_lock(data->mutex);
+			tlsf_free(data->tlsf, blocks[b]);
+			mutex_unlock(data->mutex);
+		}
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	return (int)timer_ticks_to_us(t1 - t0);
+}
+
+static void run_timed_test(int (*thread_func)(void*), heap_bench_data_t* data, int thread_count, const char* name)
+{
+	data->start = event_create();
+
+	thread_t* threads[8];
+	for (int i = 0; i < thread_count; ++i)
+	{
+		threads[i] = thread_create(thread_func, data);
+	}
+
+	event_signal(data->start);
+
+	int duration_us = 0;
+	for (int i = 0; i < thread_count; ++i)
+	{
+		duration_us = __max(duration_us, thread_destroy(threads[i]));
+	}
+	event_destroy(data->start);
+
+	double ops = 2.0 * k_bench_iterations * k_bench_blocks * thread_count;
+	debug_print(k_print_warning, "heap %s threads=%d duration=%dus ns/op=%.1f\n",
+		name, thread_count, duration_us, duration_us * 1000.0 / ops);
+}
+
+// Frees must cost the same no matter how many allocations are live.
+static void run_live_test(int live_count)
+{
+	heap_t* heap = heap_create(2 * 1024 * 1024, k_heap_tracking_full_stacks);
+	void** live = heap_alloc(heap, sizeof(void*) * live_count, 8);
+
+	uint64_t t0 = timer_get_ticks();
+	for (int i = 0; i < live_count; ++i)
+	{
+		live[i] = heap_alloc(heap, s_sizes[i % _countof(s_sizes)], 8);
+	}
+	uint64_t t1 = timer_get_ticks();
+	for (int i = 0; i < live_count; ++i)
+	{
+		heap_free(heap, live[i]);
+	}
+	uint64_t t2 = timer_get_ticks();
+
+	heap_free(heap, live);
+	heap_destroy(heap);
+
+	debug_print(k_print_warning, "heap tracking live=%d alloc ns/op=%.1f free ns/op=%.1f\n",
+		live_count,
+		timer_ticks_to_us(t1 - t0) * 1000.0 / live_count,
+		timer_ticks_to_us(t2 - t1) * 1000.0 / live_count);
+}
+
+// Cost of the single-threaded alloc/free hot path at each tracking level.
+static void run_tracking_level_test(heap_tracking_t tracking, const char* name)
+{
+	heap_t* heap = heap_create(2 * 1024 * 1024, tracking);
+	void* blocks[k_bench_blocks];
+
+	uint64_t t0 = timer_get_ticks();
+	for (int i = 0; i < k_bench_iterations; ++i)
+	{
+		for (int b = 0; b < k_bench_blocks; ++b)
+		{
+			blocks[b] = heap_alloc(heap, s_sizes[b % _countof(s_sizes)], 8);
+		}
+		for (int b = 0; b < k_bench_blocks; ++b)
+		{
+			heap_free(heap, blocks[b]);
+		}
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	heap_destroy(heap);
+
+	debug_print(k_print_warning, "heap tracking=%s ns/op=%.1f\n",
+		name, timer_ticks_to_us(t1 - t0) * 1000.0 / (2.0 * k_bench_iterations * k_bench_blocks));
+}
+
+void heap_bench_run()
+{
+	run_tracking_level_test(k_heap_tracking_none, "none");
+	run_tracking_level_test(k_heap_tracking_counters, "counters");
+	run_tracking_level_test(k_heap_tracking_sampled_stacks, "sampled_stacks");
+	run_tracking_level_test(k_heap_tracking_full_stacks, "full_stacks");
+
+	for (int live_count = 1000; live_count <= 100000; live_count *= 10)
+	{
+		run_live_test(live_count);
+	}
+
+	void* mutex_pool = VirtualAlloc(NULL, tlsf_size() + k_bench_mutex_pool_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+	for (int thread_count = 1; thread_count <= 8; thread_count *= 2)
+	{
+		heap_bench_data_t data = { .heap = heap_create(2 * 1024 * 1024, k_heap_tracking_none) };
+		run_timed_test(cached_func, &data, thread_count, "cached");
+		heap_destroy(data.heap);
+
+		data = (heap_bench_data_t)
+		{
+			.tlsf = tlsf_create_with_pool(mutex_pool, tlsf_size() + k_bench_mutex_pool_size),
+			.mutex = mutex_create(),
+		};
+		run_timed_test(mutex_func, &data, thread_count, "mutex");
+		mutex_destroy(data.mutex);
+		tlsf_destroy(data.tlsf);
+	}
+
+	VirtualFree(mutex_pool, 0, MEM_RELEASE);
+}
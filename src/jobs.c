@@ -0,0 +1,365 @@
+#include "jobs.h"
+
+#include "atomic.h"
+#include "heap.h"
+#include "queue.h"
+#include "thread.h"
+#include "trace.h"
+
+#include <immintrin.h>
+#include <stdbool.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+enum
+{
+	// Jobs each worker can have queued before further submissions run inline.
+	k_jobs_deque_capacity = 4096,
+
+	// Jobs submitted by threads outside the job system that can be waiting at once.
+	k_jobs_injected_capacity = 1024,
+
+	k_jobs_max_workers = 64,
+
+	// Failed attempts to find work before a thread goes to sleep.
+	k_jobs_spin_count = 256,
+
+	k_jobs_cache_line = 64,
+};
+
+typedef struct job_t
+{
+	void (*function)(void* data);
+	void* data;
+	jobs_counter_t* counter;
+} job_t;
+
+// Chase-Lev deque: the owner pushes and pops at the bottom, thieves take from the top.
+// Jobs are stored by value; a thief reads a job before claiming it, and the claim
+// only succeeds if the slot could not have been reused in between.
+typedef struct jobs_deque_t
+{
+	int top;
+	char pad0[k_jobs_cache_line - sizeof(int)];
+	int bottom;
+	char pad1[k_jobs_cache_line - sizeof(int)];
+	job_t jobs[k_jobs_deque_capacity];
+} jobs_deque_t;
+
+typedef struct jobs_worker_t
+{
+	jobs_t* jobs;
+	thread_t* thread;
+	int index;
+	unsigned int steal_seed;
+} jobs_worker_t;
+
+typedef struct jobs_t
+{
+	heap_t* heap;
+	trace_t* trace;
+	DWORD worker_tls_index;
+	int worker_count;
+	jobs_deque_t* deques;
+	jobs_worker_t workers[k_jobs_max_workers];
+	queue_t* injected;
+
+	// Idle workers sleep on work_epoch, which submitters bump only when sleepers is non-zero.
+	int sleepers;
+	int work_epoch;
+	int quit;
+} jobs_t;
+
+static int jobs_worker_func(void* user);
+
+jobs_t* jobs_create(heap_t* heap, int worker_count, trace_t* trace)
+{
+	if (worker_count <= 0)
+	{
+		worker_count = thread_get_core_count();
+	}
+	worker_count = __min(__max(worker_count, 1), k_jobs_max_workers);
+
+	jobs_t* jobs = heap_alloc(heap, sizeof(jobs_t), 8);
+	jobs->heap = heap;
+	jobs->trace = trace;
+	jobs->worker_count = worker_count;
+	jobs->deques = heap_alloc(heap, sizeof(jobs_deque_t) * worker_count, k_jobs_cache_line);
+	jobs->injected = queue_create(heap, k_jobs_injected_capacity);
+	jobs->sleepers = 0;
+	jobs->work_epoch = 0;
+	jobs->quit = 0;
+
+	//Thread local slot holds the worker index plus one, so zero means not a worker
+	jobs->worker_tls_index = TlsAlloc();
+	TlsSetValue(jobs->worker_tls_index, (void*)(intptr_t)1);
+
+	for (int i = 0; i < worker_count; ++i)
+	{
+		jobs->deques[i].top = 0;
+		jobs->deques[i].bottom = 0;
+		jobs->workers[i].jobs = jobs;
+		jobs->workers[i].thread = NULL;
+		jobs->workers[i].index = i;
+		jobs->workers[i].steal_seed = 0x9e3779b9u * (i + 1);
+	}
+
+	//Worker zero is the creating thread, which only runs jobs while it waits
+	for (int i = 1; i < worker_count; ++i)
+	{
+		jobs->workers[i].thread = thread_create(jobs_worker_func, &jobs->workers[i]);
+	}
+
+	return jobs;
+}
+
+void jobs_destroy(jobs_t* jobs)
+{
+	atomic_store(&jobs->quit, 1);
+	atomic_increment(&jobs->work_epoch);
+	atomic_wake_all(&jobs->work_epoch);
+	for (int i = 1; i < jobs->worker_count; ++i)
+	{
+		thread_destroy(jobs->workers[i].thread);
+	}
+
+	TlsSetValue(jobs->worker_tls_index, NULL);
+	TlsFree(jobs->worker_tls_index);
+	queue_destroy(jobs->injected);
+	heap_free(jobs->heap, jobs->deques);
+	heap_free(jobs->heap, jobs);
+}
+
+int jobs_get_worker_count(jobs_t* jobs)
+{
+	return jobs->worker_count;
+}
+
+//Owner only
+static bool jobs_deque_push(jobs_deque_t* deque, const job_t* job)
+{
+	unsigned int bottom = (unsigned int)deque->bottom;
+	unsigned int top = (unsigned int)atomic_load(&deque->top);
+	if (bottom - top >= k_jobs_deque_capacity)
+	{
+		return false;
+	}
+	deque->jobs[bottom & (k_jobs_deque_capacity - 1)] = *job;
+	//Full barrier, so a submitter's check for sleeping workers cannot be read before the job is visible
+	atomic_exchange(&deque->bottom, (int)(bottom + 1));
+	return true;
+}
+
+//Owner only
+static bool jobs_deque_pop(jobs_deque_t* deque, job_t* job)
+{
+	unsigned int bottom = (unsigned int)deque->bottom - 1;
+	//Full barrier, thieves must see the lowered bottom before top is read
+	atomic_exchange(&deque->bottom, (int)bottom);
+	unsigned int top = (unsigned int)atomic_load(&deque->top);
+
+	int size = (int)(bottom - top);
+	if (size < 0)
+	{
+		atomic_store(&deque->bottom, (int)top);
+		return false;
+	}
+
+	*job = deque->jobs[bottom & (k_jobs_deque_capacity - 1)];
+	if (size > 0)
+	{
+		return true;
+	}
+
+	//Last job, race any thief for it
+	bool won = atomic_compare_and_exchange(&deque->top, (int)top, (int)(top + 1)) == (int)top;
+	atomic_store(&deque->bottom, (int)(top + 1));
+	return won;
+}
+
+//Any thread
+static bool jobs_deque_steal(jobs_deque_t* deque, job_t* job)
+{
+	unsigned int top = (unsigned int)atomic_load(&deque->top);
+	unsigned int bottom = (unsigned int)atomic_load(&deque->bottom);
+	if ((int)(bottom - top) <= 0)
+	{
+		return false;
+	}
+
+	*job = deque->jobs[top & (k_jobs_deque_capacity - 1)];
+	return atomic_compare_and_exchange(&deque->top, (int)top, (int)(top + 1)) == (int)top;
+}
+
+//Returns the calling thread's worker index, or -1 if it is not part of the job system
+static int jobs_get_worker_index(jobs_t* jobs)
+{
+	return (int)(intptr_t)TlsGetValue(jobs->worker_tls_index) - 1;
+}
+
+static bool jobs_find(jobs_t* jobs, int worker_index, unsigned int* steal_seed, job_t* job)
+{
+	if (worker_index >= 0 && jobs_deque_pop(&jobs->deques[worker_index], job))
+	{
+		return true;
+	}
+
+	job_t* injected = queue_try_pop(jobs->injected);
+	if (injected)
+	{
+		*job = *injected;
+		heap_free(jobs->heap, injected);
+		return true;
+	}
+
+	//Start at a random victim so thieves spread out
+	*steal_seed ^= *steal_seed << 13;
+	*steal_seed ^= *steal_seed >> 17;
+	*steal_seed ^= *steal_seed << 5;
+	int start = (int)(*steal_seed % (unsigned int)jobs->worker_count);
+	for (int i = 0; i < jobs->worker_count; ++i)
+	{
+		int victim = (start + i) % jobs->worker_count;
+		if (victim != worker_index && jobs_deque_steal(&jobs->deques[victim], job))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static void jobs_execute(const job_t* job)
+{
+	job->function(job->data);
+	if (job->counter && atomic_decrement(&job->counter->value) == 1)
+	{
+		//The counter may already be gone once it reads zero, waking its address is still harmless
+		atomic_wake_all(&job->counter->value);
+	}
+}
+
+static void jobs_notify(jobs_t* jobs)
+{
+	if (atomic_load(&jobs->sleepers))
+	{
+		atomic_increment(&jobs->work_epoch);
+		atomic_wake_one(&jobs->work_epoch);
+	}
+}
+
+static int jobs_worker_func(void* user)
+{
+	jobs_worker_t* worker = user;
+	jobs_t* jobs = worker->jobs;
+	TlsSetValue(jobs->worker_tls_index, (void*)(intptr_t)(worker->index + 1));
+	TRACE_THREAD_NAME(jobs->trace, "jobs worker");
+
+	job_t job;
+	int idle_count = 0;
+	while (!atomic_load(&jobs->quit))
+	{
+		if (jobs_find(jobs, worker->index, &worker->steal_seed, &job))
+		{
+			jobs_execute(&job);
+			idle_count = 0;
+			continue;
+		}
+		if (++idle_count < k_jobs_spin_count)
+		{
+			_mm_pause();
+			continue;
+		}
+
+		//Register as a sleeper before the final look so a submission in between cannot be missed
+		int epoch = atomic_load(&jobs->work_epoch);
+		atomic_increment(&jobs->sleepers);
+		if (jobs_find(jobs, worker->index, &worker->steal_seed, &job))
+		{
+			atomic_decrement(&jobs->sleepers);
+			jobs_execute(&job);
+			idle_count = 0;
+			continue;
+		}
+		if (!atomic_load(&jobs->quit))
+		{
+			atomic_wait(&jobs->work_epoch, epoch);
+		}
+		atomic_decrement(&jobs->sleepers);
+		idle_count = 0;
+	}
+
+	heap_thread_cache_flush(jobs->heap);
+	return 0;
+}
+
+void jobs_run(jobs_t* jobs, void (*function)(void* data), void* data, jobs_counter_t* counter)
+{
+	job_t job = { function, data, counter };
+	if (counter)
+	{
+		atomic_increment(&counter->value);
+	}
+
+	int worker_index = jobs_get_worker_index(jobs);
+	if (worker_index >= 0)
+	{
+		if (!jobs_deque_push(&jobs->deques[worker_index], &job))
+		{
+			jobs_execute(&job);
+			return;
+		}
+	}
+	else
+	{
+		job_t* injected = heap_alloc(jobs->heap, sizeof(job_t), 8);
+		*injected = job;
+		if (!queue_try_push(jobs->injected, injected))
+		{
+			heap_free(jobs->heap, injected);
+			jobs_execute(&job);
+			return;
+		}
+	}
+	jobs_notify(jobs);
+}
+
+void jobs_wait(jobs_t* jobs, jobs_counter_t* counter)
+{
+	int worker_index = jobs_get_worker_index(jobs);
+	unsigned int steal_seed = (unsigned int)(uintptr_t)counter | 1;
+
+	job_t job;
+	int idle_count = 0;
+	while (true)
+	{
+		int value = atomic_load(&counter->value);
+		if (value == 0)
+		{
+			break;
+		}
+		if (jobs_find(jobs, worker_index, &steal_seed, &job))
+		{
+			jobs_execute(&job);
+			idle_count = 0;
+			continue;
+		}
+		if (++idle_count < k_jobs_spin_count)
+		{
+			_mm_pause();
+			continue;
+		}
+
+		//Nothing left to help with, the remaining jobs are running on other threads
+		//Without worker threads nothing would wake this thread for newly injected jobs, so poll instead
+		if (jobs->worker_count > 1)
+		{
+			atomic_wait(&counter->value, value);
+		}
+		else
+		{
+			thread_sleep(0);
+		}
+		idle_count = 0;
+	}
+}
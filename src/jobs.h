@@ -0,0 +1,44 @@
+#pragma once
+
+// Work-stealing job system.
+
+// A fixed set of worker threads run small jobs.
+// Each worker has its own deque: jobs it submits go on its own deque, and idle
+// workers steal from the others. The thread that creates the job system takes part
+// as a worker whenever it waits. Other threads may submit and wait as well; their
+// jobs go through a shared queue.
+
+// Handle to a job system.
+typedef struct jobs_t jobs_t;
+
+typedef struct heap_t heap_t;
+typedef struct trace_t trace_t;
+
+// Tracks a group of outstanding jobs so they can be waited on.
+// Zero-initialize before first use. May be reused once it has been waited on.
+typedef struct jobs_counter_t
+{
+	int value;
+} jobs_counter_t;
+
+// Create a job system that uses worker_count threads, including the calling thread.
+// A worker_count of zero uses one thread per core.
+// Worker threads are named in trace, which may be NULL.
+jobs_t* jobs_create(heap_t* heap, int worker_count, trace_t* trace);
+
+// Destroy a previously created job system.
+// Every submitted job must have completed.
+void jobs_destroy(jobs_t* jobs);
+
+// Returns the number of threads running jobs, including the creating thread.
+int jobs_get_worker_count(jobs_t* jobs);
+
+// Submit a job that calls function(data) on some worker.
+// If counter is not NULL, it is incremented now and decremented when the job completes.
+// Safe to call from any thread, including from inside a job.
+void jobs_run(jobs_t* jobs, void (*function)(void* data), void* data, jobs_counter_t* counter);
+
+// Wait until every job tracked by counter has completed.
+// The calling thread runs other jobs while it waits.
+// Safe to call from any thread, including from inside a job.
+void jobs_wait(jobs_t* jobs, jobs_counter_t* counter);
@@ -0,0 +1,138 @@
+#include "bench.h"
+
+#include "debug.h"
+#include "heap.h"
+#include "jobs.h"
+#include "thread.h"
+#include "timer.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+enum
+{
+	// Flat fork/join: one parent submits this many leaf jobs and waits on them.
+	k_bench_flat_jobs = 4096,
+	k_bench_flat_work = 2000,
+
+	// Recursive fork/join: every job splits in two until this depth.
+	k_bench_tree_depth = 12,
+	k_bench_tree_work = 2000,
+
+	k_bench_repeats = 8,
+};
+
+typedef struct jobs_bench_leaf_t
+{
+	float result;
+} jobs_bench_leaf_t;
+
+typedef struct jobs_bench_tree_t
+{
+	jobs_t* jobs;
+	int depth;
+	float result;
+} jobs_bench_tree_t;
+
+// Roughly fixed amount of arithmetic that the compiler cannot fold away.
+static float do_work(int iterations, float seed)
+{
+	float value = seed;
+	for (int i = 0; i < iterations; ++i)
+	{
+		value = sqrtf(value * value + 1.0f);
+	}
+	return value;
+}
+
+static void leaf_func(void* data)
+{
+	jobs_bench_leaf_t* leaf = data;
+	leaf->result = do_work(k_bench_flat_work, leaf->result);
+}
+
+static void tree_func(void* data)
+{
+	jobs_bench_tree_t* node = data;
+	if (node->depth == 0)
+	{
+		node->result = do_work(k_bench_tree_work, 1.0f);
+		return;
+	}
+
+	jobs_bench_tree_t children[2] =
+	{
+		{ node->jobs, node->depth - 1, 0.0f },
+		{ node->jobs, node->depth - 1, 0.0f },
+	};
+	jobs_counter_t counter = { 0 };
+	jobs_run(node->jobs, tree_func, &children[0], &counter);
+	tree_func(&children[1]);
+	jobs_wait(node->jobs, &counter);
+	node->result = children[0].result + children[1].result;
+}
+
+static double run_flat_test(heap_t* heap, jobs_t* jobs)
+{
+	jobs_bench_leaf_t* leaves = heap_alloc(heap, sizeof(jobs_bench_leaf_t) * k_bench_flat_jobs, 8);
+
+	uint64_t t0 = timer_get_ticks();
+	for (int r = 0; r < k_bench_repeats; ++r)
+	{
+		jobs_counter_t counter = { 0 };
+		for (int i = 0; i < k_bench_flat_jobs; ++i)
+		{
+			leaves[i].result = (float)i;
+			jobs_run(jobs, leaf_func, &leaves[i], &counter);
+		}
+		jobs_wait(jobs, &counter);
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	heap_free(heap, leaves);
+	return timer_ticks_to_us(t1 - t0) / 1000.0 / k_bench_repeats;
+}
+
+static double run_tree_test(jobs_t* jobs)
+{
+	uint64_t t0 = timer_get_ticks();
+	for (int r = 0; r < k_bench_repeats; ++r)
+	{
+		jobs_bench_tree_t root = { jobs, k_bench_tree_depth, 0.0f };
+		tree_func(&root);
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	return timer_ticks_to_us(t1 - t0) / 1000.0 / k_bench_repeats;
+}
+
+void jobs_bench_run()
+{
+	heap_t* heap = heap_create(2 * 1024 * 1024, k_heap_tracking_none);
+
+	double flat_base_ms = 0.0;
+	double tree_base_ms = 0.0;
+	int core_count = thread_get_core_count();
+	for (int worker_count = 1; ; worker_count = __min(worker_count * 2, core_count))
+	{
+		jobs_t* jobs = jobs_create(heap, worker_count, NULL);
+		double flat_ms = run_flat_test(heap, jobs);
+		double tree_ms = run_tree_test(jobs);
+		jobs_destroy(jobs);
+
+		if (worker_count == 1)
+		{
+			flat_base_ms = flat_ms;
+			tree_base_ms = tree_ms;
+		}
+		debug_print(k_print_warning, "jobs workers=%d flat ms=%.2f speedup=%.2f tree ms=%.2f speedup=%.2f\n",
+			worker_count, flat_ms, flat_base_ms / flat_ms, tree_ms, tree_base_ms / tree_ms);
+
+		if (worker_count >= core_count)
+		{
+			break;
+		}
+	}
+
+	heap_destroy(heap);
+}
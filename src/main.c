@@ -1,13 +1,42 @@
+#include "bench.h"
 #include "debug.h"
+#include "frame_stats.h"
 #include "fs.h"
 #include "heap.h"
+#include "jobs.h"
 #include "render.h"
 #include "frogger_game.h"
 #include "timer.h"
+#include "trace.h"
 #include "wm.h"
 
 #include "cpp_test.h"
 
+#include <string.h>
+
+enum
+{
+	k_heap_grow_increment = 2 * 1024 * 1024,
+	k_heap_stats_interval_ms = 5000,
+	k_frame_stats_interval_ms = 5000,
+
+	// Durations each thread can record between the trace writer's drains.
+	k_trace_event_capacity = 16 * 1024,
+};
+
+// Print heap usage as a single line of JSON, for sizing k_heap_grow_increment from real data.
+// Bytes in use are also traced as a counter.
+static void print_heap_stats(heap_t* heap, trace_t* trace, uint32_t time_ms)
+{
+	heap_stats_t stats;
+	heap_get_stats(heap, &stats);
+	TRACE_COUNTER(trace, "heap bytes in use", (int64_t)stats.bytes_in_use);
+	debug_print(k_print_info,
+		"{\"heap_stats\":{\"ms\":%u,\"in_use\":%zu,\"peak\":%zu,\"live\":%lld,\"pools\":%d,\"pool_bytes\":%zu,\"largest_free\":%zu,\"fragmentation\":%.3f}}\n",
+		time_ms, stats.bytes_in_use, stats.peak_bytes_in_use, stats.live_allocation_count,
+		stats.pool_count, stats.pool_bytes, stats.largest_free_block, stats.fragmentation);
+}
+
 int main(int argc, const char* argv[])
 {
 	debug_set_print_mask(k_print_info | k_print_warning | k_print_error);
@@ -17,25 +46,95 @@ int main(int argc, const char* argv[])
 
 	cpp_test_function(42);
 
-	heap_t* heap = heap_create(2 * 1024 * 1024);
-	fs_t* fs = fs_create(heap, 8);
+	if (argc > 1 && strcmp(argv[1], "-bench") == 0)
+	{
+		heap_bench_run();
+		object_pool_bench_run();
+		queue_bench_run();
+		jobs_bench_run();
+		ecs_bench_run();
+		broadphase_bench_run();
+		collision_bench_run();
+		mat4f_bench_run();
+		transform_bench_run();
+		trace_bench_run();
+		return 0;
+	}
+
+	if (argc > 3 && strcmp(argv[1], "-trace-convert") == 0)
+	{
+		heap_t* heap = heap_create(k_heap_grow_increment, k_heap_tracking_none);
+		bool converted = trace_convert(heap, argv[2], argv[3]);
+		heap_destroy(heap);
+		return converted ? 0 : 1;
+	}
+
+	heap_t* heap = heap_create(k_heap_grow_increment, k_heap_tracking_full_stacks);
+	trace_t* trace = trace_create(heap, k_trace_event_capacity);
+	TRACE_THREAD_NAME(trace, "main");
+	fs_t* fs = fs_create(heap, 8, trace);
+
+	const char* frame_stats_csv_path = NULL;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-trace") == 0)
+		{
+			//Convert with -trace-convert trace.bin trace.json
+			trace_capture_start(trace, fs, "trace.bin", true);
+		}
+		else if (strcmp(argv[i], "-frame-stats-csv") == 0 && i + 1 < argc)
+		{
+			frame_stats_csv_path = argv[++i];
+		}
+	}
+	frame_stats_t* frame_stats = frame_stats_create(heap, fs, frame_stats_csv_path);
+
 	wm_window_t* window = wm_create(heap);
-	render_t* render = render_create(heap, window);
+	render_t* render = render_create(heap, window, trace, frame_stats);
+	jobs_t* jobs = jobs_create(heap, 0, trace);
 
-	frogger_game_t* game = frogger_game_create(heap, fs, window, render);
+	frogger_game_t* game = frogger_game_create(heap, fs, window, render, jobs, trace);
 
+	uint32_t last_stats_ms = 0;
+	uint32_t last_frame_stats_ms = 0;
+	uint64_t frame_start = timer_get_ticks();
 	while (!wm_pump(window))
 	{
+		uint64_t update_start = timer_get_ticks();
 		frogger_game_update(game);
+		frame_stats_record(frame_stats, k_frame_stat_game_update, timer_get_ticks() - update_start);
+
+		uint32_t now_ms = timer_ticks_to_ms(timer_get_ticks());
+		if (now_ms - last_stats_ms >= k_heap_stats_interval_ms)
+		{
+			print_heap_stats(heap, trace, now_ms);
+			last_stats_ms = now_ms;
+		}
+		if (now_ms - last_frame_stats_ms >= k_frame_stats_interval_ms)
+		{
+			frame_stats_report(frame_stats);
+			last_frame_stats_ms = now_ms;
+		}
+
+		uint64_t frame_end = timer_get_ticks();
+		frame_stats_record(frame_stats, k_frame_stat_frame, frame_end - frame_start);
+		frame_start = frame_end;
 	}
+	print_heap_stats(heap, trace, timer_ticks_to_ms(timer_get_ticks()));
+	trace_capture_stop(trace);
 
 	/* XXX: Shutdown render before the game. Render uses game resources. */
 	render_destroy(render);
 
 	frogger_game_destroy(game);
 
+	//After render, whose thread records waits, and before fs, which writes the CSV
+	frame_stats_destroy(frame_stats);
+
+	jobs_destroy(jobs);
 	wm_destroy(window);
 	fs_destroy(fs);
+	trace_destroy(trace);
 	heap_destroy(heap);
 
 	return 0;
@@ -1,11 +1,13 @@
 #include "mat4f.h"
 
+#include "cpu.h"
 #include "quatf.h"
 #include "vec3f.h"
+#include "vec3f_sse.h"
 
 #include <string.h>
 
-#include <xmmintrin.h>
+#include <immintrin.h>
 
 void mat4f_make_identity(mat4f_t* m)
 {
@@ -185,6 +187,196 @@ bool mat4f_invert(mat4f_t* m)
 	return true;
 }
 
+void mat4f_mul_simd(mat4f_aligned_t* result, const mat4f_aligned_t* a, const mat4f_aligned_t* b)
+{
+	//Row i of the result is the sum of b's rows weighted by row i of a
+	if (cpu_has_avx2())
+	{
+		//Two rows of a at once, each 128-bit lane holds one row and in-lane shuffles broadcast its elements
+		__m256 b0 = _mm256_broadcast_ps((const __m128*)b->data[0]);
+		__m256 b1 = _mm256_broadcast_ps((const __m128*)b->data[1]);
+		__m256 b2 = _mm256_broadcast_ps((const __m128*)b->data[2]);
+		__m256 b3 = _mm256_broadcast_ps((const __m128*)b->data[3]);
+		__m256 a01 = _mm256_loadu_ps(a->data[0]);
+		__m256 a23 = _mm256_loadu_ps(a->data[2]);
+
+		__m256 r01 = _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, _MM_SHUFFLE(0, 0, 0, 0)), b0);
+		r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, _MM_SHUFFLE(1, 1, 1, 1)), b1));
+		r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, _MM_SHUFFLE(2, 2, 2, 2)), b2));
+		r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, _MM_SHUFFLE(3, 3, 3, 3)), b3));
+
+		__m256 r23 = _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, _MM_SHUFFLE(0, 0, 0, 0)), b0);
+		r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, _MM_SHUFFLE(1, 1, 1, 1)), b1));
+		r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, _MM_SHUFFLE(2, 2, 2, 2)), b2));
+		r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, _MM_SHUFFLE(3, 3, 3, 3)), b3));
+
+		_mm256_storeu_ps(result->data[0], r01);
+		_mm256_storeu_ps(result->data[2], r23);
+		return;
+	}
+
+	__m128 b0 = _mm_load_ps(b->data[0]);
+	__m128 b1 = _mm_load_ps(b->data[1]);
+	__m128 b2 = _mm_load_ps(b->data[2]);
+	__m128 b3 = _mm_load_ps(b->data[3]);
+
+	//Every row of a is read before result is written, so they may alias
+	__m128 rows[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		__m128 row = _mm_load_ps(a->data[i]);
+		__m128 r = _mm_mul_ps(_mm_shuffle_ps(row, row, _MM_SHUFFLE(0, 0, 0, 0)), b0);
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(row, row, _MM_SHUFFLE(1, 1, 1, 1)), b1));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(row, row, _MM_SHUFFLE(2, 2, 2, 2)), b2));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(row, row, _MM_SHUFFLE(3, 3, 3, 3)), b3));
+		rows[i] = r;
+	}
+	for (int i = 0; i < 4; ++i)
+	{
+		_mm_store_ps(result->data[i], rows[i]);
+	}
+}
+
+void mat4f_transform_simd(const mat4f_aligned_t* m, const vec3f_t* in, vec3f_t* out)
+{
+	__m128 r = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(in->x), _mm_load_ps(m->data[0])), _mm_load_ps(m->data[3]));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(in->y), _mm_load_ps(m->data[1])));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(in->z), _mm_load_ps(m->data[2])));
+
+	//A four float store would write past the end of out
+	_mm_storel_pi((__m64*)&out->x, r);
+	_mm_store_ss(&out->z, _mm_movehl_ps(r, r));
+}
+
+void mat4f_transform_n(const mat4f_aligned_t* m, const vec3f_t* in, vec3f_t* out, int count)
+{
+	int i = 0;
+	if (cpu_has_avx2())
+	{
+		__m256 m00 = _mm256_broadcast_ss(&m->data[0][0]), m01 = _mm256_broadcast_ss(&m->data[0][1]), m02 = _mm256_broadcast_ss(&m->data[0][2]);
+		__m256 m10 = _mm256_broadcast_ss(&m->data[1][0]), m11 = _mm256_broadcast_ss(&m->data[1][1]), m12 = _mm256_broadcast_ss(&m->data[1][2]);
+		__m256 m20 = _mm256_broadcast_ss(&m->data[2][0]), m21 = _mm256_broadcast_ss(&m->data[2][1]), m22 = _mm256_broadcast_ss(&m->data[2][2]);
+		__m256 m30 = _mm256_broadcast_ss(&m->data[3][0]), m31 = _mm256_broadcast_ss(&m->data[3][1]), m32 = _mm256_broadcast_ss(&m->data[3][2]);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128 x0, y0, z0, x1, y1, z1;
+			vec3f_load4(in + i, &x0, &y0, &z0);
+			vec3f_load4(in + i + 4, &x1, &y1, &z1);
+			__m256 x = _mm256_set_m128(x1, x0);
+			__m256 y = _mm256_set_m128(y1, y0);
+			__m256 z = _mm256_set_m128(z1, z0);
+
+			__m256 rx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m00), _mm256_mul_ps(y, m10)), _mm256_add_ps(_mm256_mul_ps(z, m20), m30));
+			__m256 ry = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m01), _mm256_mul_ps(y, m11)), _mm256_add_ps(_mm256_mul_ps(z, m21), m31));
+			__m256 rz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m02), _mm256_mul_ps(y, m12)), _mm256_add_ps(_mm256_mul_ps(z, m22), m32));
+
+			vec3f_store4(out + i, _mm256_castps256_ps128(rx), _mm256_castps256_ps128(ry), _mm256_castps256_ps128(rz));
+			vec3f_store4(out + i + 4, _mm256_extractf128_ps(rx, 1), _mm256_extractf128_ps(ry, 1), _mm256_extractf128_ps(rz, 1));
+		}
+	}
+
+	__m128 m00 = _mm_set1_ps(m->data[0][0]), m01 = _mm_set1_ps(m->data[0][1]), m02 = _mm_set1_ps(m->data[0][2]);
+	__m128 m10 = _mm_set1_ps(m->data[1][0]), m11 = _mm_set1_ps(m->data[1][1]), m12 = _mm_set1_ps(m->data[1][2]);
+	__m128 m20 = _mm_set1_ps(m->data[2][0]), m21 = _mm_set1_ps(m->data[2][1]), m22 = _mm_set1_ps(m->data[2][2]);
+	__m128 m30 = _mm_set1_ps(m->data[3][0]), m31 = _mm_set1_ps(m->data[3][1]), m32 = _mm_set1_ps(m->data[3][2]);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 x, y, z;
+		vec3f_load4(in + i, &x, &y, &z);
+
+		__m128 rx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m00), _mm_mul_ps(y, m10)), _mm_add_ps(_mm_mul_ps(z, m20), m30));
+		__m128 ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m01), _mm_mul_ps(y, m11)), _mm_add_ps(_mm_mul_ps(z, m21), m31));
+		__m128 rz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m02), _mm_mul_ps(y, m12)), _mm_add_ps(_mm_mul_ps(z, m22), m32));
+
+		vec3f_store4(out + i, rx, ry, rz);
+	}
+
+	for (; i < count; ++i)
+	{
+		vec3f_t tmp = in[i];
+		mat4f_transform_simd(m, &tmp, &out[i]);
+	}
+}
+
+//2x2 matrices are packed row by row into one register
+static __m128 mat2f_mul(__m128 a, __m128 b)
+{
+	return _mm_add_ps(
+		_mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 3, 0))),
+		_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 2, 1, 2))));
+}
+
+//Adjugate of a times b
+static __m128 mat2f_adj_mul(__m128 a, __m128 b)
+{
+	return _mm_sub_ps(
+		_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(0, 0, 3, 3)), b),
+		_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 1, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 0, 3, 2))));
+}
+
+//a times adjugate of b
+static __m128 mat2f_mul_adj(__m128 a, __m128 b)
+{
+	return _mm_sub_ps(
+		_mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(0, 3, 0, 3))),
+		_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 2, 1, 2))));
+}
+
+bool mat4f_invert_simd(mat4f_aligned_t* m)
+{
+	//Block inverse: the matrix is split into 2x2 blocks | A B |
+	//                                                   | C D |
+	//and the inverse is built from their adjugates and determinants
+	__m128 row0 = _mm_load_ps(m->data[0]);
+	__m128 row1 = _mm_load_ps(m->data[1]);
+	__m128 row2 = _mm_load_ps(m->data[2]);
+	__m128 row3 = _mm_load_ps(m->data[3]);
+
+	__m128 a = _mm_movelh_ps(row0, row1);
+	__m128 b = _mm_movehl_ps(row1, row0);
+	__m128 c = _mm_movelh_ps(row2, row3);
+	__m128 d = _mm_movehl_ps(row3, row2);
+
+	//Determinants of all four blocks: |A| |B| |C| |D|
+	__m128 det_sub = _mm_sub_ps(
+		_mm_mul_ps(_mm_shuffle_ps(row0, row2, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(row1, row3, _MM_SHUFFLE(3, 1, 3, 1))),
+		_mm_mul_ps(_mm_shuffle_ps(row0, row2, _MM_SHUFFLE(3, 1, 3, 1)), _mm_shuffle_ps(row1, row3, _MM_SHUFFLE(2, 0, 2, 0))));
+	__m128 det_a = _mm_shuffle_ps(det_sub, det_sub, _MM_SHUFFLE(0, 0, 0, 0));
+	__m128 det_b = _mm_shuffle_ps(det_sub, det_sub, _MM_SHUFFLE(1, 1, 1, 1));
+	__m128 det_c = _mm_shuffle_ps(det_sub, det_sub, _MM_SHUFFLE(2, 2, 2, 2));
+	__m128 det_d = _mm_shuffle_ps(det_sub, det_sub, _MM_SHUFFLE(3, 3, 3, 3));
+
+	__m128 d_c = mat2f_adj_mul(d, c);
+	__m128 a_b = mat2f_adj_mul(a, b);
+	__m128 x = _mm_sub_ps(_mm_mul_ps(det_d, a), mat2f_mul(b, d_c));
+	__m128 w = _mm_sub_ps(_mm_mul_ps(det_a, d), mat2f_mul(c, a_b));
+	__m128 y = _mm_sub_ps(_mm_mul_ps(det_b, c), mat2f_mul_adj(d, a_b));
+	__m128 z = _mm_sub_ps(_mm_mul_ps(det_c, b), mat2f_mul_adj(a, d_c));
+
+	//|M| = |A||D| + |B||C| - trace((A#B)(D#C))
+	__m128 tr = _mm_mul_ps(a_b, _mm_shuffle_ps(d_c, d_c, _MM_SHUFFLE(3, 1, 2, 0)));
+	tr = _mm_add_ps(tr, _mm_shuffle_ps(tr, tr, _MM_SHUFFLE(2, 3, 0, 1)));
+	tr = _mm_add_ps(tr, _mm_shuffle_ps(tr, tr, _MM_SHUFFLE(1, 0, 3, 2)));
+	__m128 det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(det_a, det_d), _mm_mul_ps(det_b, det_c)), tr);
+	if (_mm_cvtss_f32(det) == 0.0f)
+	{
+		return false;
+	}
+
+	__m128 inv_det = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), det);
+	x = _mm_mul_ps(x, inv_det);
+	y = _mm_mul_ps(y, inv_det);
+	z = _mm_mul_ps(z, inv_det);
+	w = _mm_mul_ps(w, inv_det);
+
+	//Shuffles apply the final adjugate and put the blocks back in rows
+	_mm_store_ps(m->data[0], _mm_shuffle_ps(x, y, _MM_SHUFFLE(1, 3, 1, 3)));
+	_mm_store_ps(m->data[1], _mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 2, 0, 2)));
+	_mm_store_ps(m->data[2], _mm_shuffle_ps(z, w, _MM_SHUFFLE(1, 3, 1, 3)));
+	_mm_store_ps(m->data[3], _mm_shuffle_ps(z, w, _MM_SHUFFLE(0, 2, 0, 2)));
+	return true;
+}
+
 void mat4f_make_perspective(mat4f_t* m, float angle, float aspect, float z_near, float z_far)
 {
 	if (angle == 0.0f)
@@ -14,6 +14,13 @@ typedef struct mat4f_t
 	float data[4][4];
 } mat4f_t;
 
+// Matrix with the 16-byte alignment the SIMD functions below require.
+// Same layout as mat4f_t, so a pointer to one may be cast to the other if it is aligned.
+typedef __declspec(align(16)) struct mat4f_aligned_t
+{
+	float data[4][4];
+} mat4f_aligned_t;
+
 // Makes the matrix m identity.
 void mat4f_make_identity(mat4f_t* m);
 
@@ -51,6 +58,25 @@ void mat4f_transform_inplace(const mat4f_t* m, vec3f_t* v);
 // Returns true on success, returns false if the determinant is zero.
 bool mat4f_invert(mat4f_t* m);
 
+// SIMD versions of mat4f_mul, mat4f_transform and mat4f_invert.
+// Use SSE, or AVX2 where the processor supports it. Same results as the scalar versions
+// up to rounding. The scalar versions remain the reference implementation.
+
+// Concatenate matrices a and b to get matrix result.
+// result may alias a or b.
+void mat4f_mul_simd(mat4f_aligned_t* result, const mat4f_aligned_t* a, const mat4f_aligned_t* b);
+
+// Multiples vector in by matrix m and stores the result in out.
+void mat4f_transform_simd(const mat4f_aligned_t* m, const vec3f_t* in, vec3f_t* out);
+
+// Multiplies count points in by matrix m and stores the results in out.
+// Works on four or eight points at a time. out may alias in.
+void mat4f_transform_n(const mat4f_aligned_t* m, const vec3f_t* in, vec3f_t* out, int count);
+
+// Attempt to compute a matrix inverse.
+// Returns true on success, returns false and leaves m unchanged if the determinant is zero.
+bool mat4f_invert_simd(mat4f_aligned_t* m);
+
 // Given a field of view angle in radians, width/height aspect ratio, and depth near+far distances, compute a perspective projection matrix.
 void mat4f_make_perspective(mat4f_t* m, float angle, float aspect, float z_near, float z_far);
 
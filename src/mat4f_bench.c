@@ -0,0 +1,204 @@
+#include "bench.h"
+
+#include "cpu.h"
+#include "debug.h"
+#include "heap.h"
+#include "mat4f.h"
+#include "timer.h"
+#include "vec3f.h"
+
+#include <math.h>
+#include <stdbool.h>
+
+enum
+{
+	// Matrices cycled through so every call sees different input.
+	k_bench_matrix_count = 256,
+	k_bench_ops = 1 << 20,
+
+	// Points per mat4f_transform_n call.
+	k_bench_point_count = 4096,
+};
+
+// SIMD results may differ from the scalar ones by rounding, relative to the larger value.
+static const float k_bench_epsilon = 1e-4f;
+
+typedef struct mat4f_bench_t
+{
+	mat4f_aligned_t* matrices;
+	mat4f_aligned_t* results;
+	vec3f_t* points;
+	vec3f_t* transformed;
+} mat4f_bench_t;
+
+static void mat4f_bench_fill(mat4f_bench_t* bench)
+{
+	for (int i = 0; i < k_bench_matrix_count; ++i)
+	{
+		//Diagonally dominant so every matrix is invertible
+		for (int row = 0; row < 4; ++row)
+		{
+			for (int column = 0; column < 4; ++column)
+			{
+				float value = (float)((i + row * 7 + column * 3) % 11) * 0.1f;
+				bench->matrices[i].data[row][column] = row == column ? value + 4.0f : value;
+			}
+		}
+	}
+	for (int i = 0; i < k_bench_point_count; ++i)
+	{
+		bench->points[i] = (vec3f_t){ .x = (float)i, .y = (float)(i % 17), .z = -(float)i };
+	}
+}
+
+static bool mat4f_bench_close(const float* a, const float* b, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		float scale = __max(1.0f, __max(fabsf(a[i]), fabsf(b[i])));
+		if (fabsf(a[i] - b[i]) > k_bench_epsilon * scale)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static double mat4f_bench_ns(uint64_t ticks, int ops)
+{
+	return timer_ticks_to_us(ticks) * 1000.0 / ops;
+}
+
+void mat4f_bench_run()
+{
+	heap_t* heap = heap_create(2 * 1024 * 1024, k_heap_tracking_none);
+
+	mat4f_bench_t bench;
+	bench.matrices = heap_alloc(heap, sizeof(mat4f_aligned_t) * k_bench_matrix_count, 16);
+	bench.results = heap_alloc(heap, sizeof(mat4f_aligned_t) * k_bench_matrix_count, 16);
+	bench.points = heap_alloc(heap, sizeof(vec3f_t) * k_bench_point_count, 16);
+	bench.transformed = heap_alloc(heap, sizeof(vec3f_t) * k_bench_point_count, 16);
+	mat4f_bench_fill(&bench);
+
+	//The scalar functions take the same matrices through a cast, the layout is identical
+	mat4f_t* matrices = (mat4f_t*)bench.matrices;
+	mat4f_t* results = (mat4f_t*)bench.results;
+	const int mask = k_bench_matrix_count - 1;
+
+	uint64_t t0 = timer_get_ticks();
+	for (int i = 0; i < k_bench_ops; ++i)
+	{
+		mat4f_mul(&results[i & mask], &matrices[i & mask], &matrices[(i + 1) & mask]);
+	}
+	uint64_t t1 = timer_get_ticks();
+	for (int i = 0; i < k_bench_ops; ++i)
+	{
+		mat4f_mul_simd(&bench.results[i & mask], &bench.matrices[i & mask], &bench.matrices[(i + 1) & mask]);
+	}
+	uint64_t t2 = timer_get_ticks();
+	double mul_scalar = mat4f_bench_ns(t1 - t0, k_bench_ops);
+	double mul_simd = mat4f_bench_ns(t2 - t1, k_bench_ops);
+
+	//The scalar functions are the reference every SIMD result is checked against
+	bool mul_match = true;
+	for (int i = 0; i < k_bench_matrix_count; ++i)
+	{
+		mat4f_t expected;
+		mat4f_mul(&expected, &matrices[i], &matrices[(i + 1) & mask]);
+		mat4f_mul_simd(&bench.results[i], &bench.matrices[i], &bench.matrices[(i + 1) & mask]);
+		mul_match &= mat4f_bench_close(&expected.data[0][0], &bench.results[i].data[0][0], 16);
+	}
+
+	t0 = timer_get_ticks();
+	for (int i = 0; i < k_bench_ops; ++i)
+	{
+		int p = i & (k_bench_point_count - 1);
+		mat4f_transform(&matrices[i & mask], &bench.points[p], &bench.transformed[p]);
+	}
+	t1 = timer_get_ticks();
+	for (int i = 0; i < k_bench_ops; ++i)
+	{
+		int p = i & (k_bench_point_count - 1);
+		mat4f_transform_simd(&bench.matrices[i & mask], &bench.points[p], &bench.transformed[p]);
+	}
+	t2 = timer_get_ticks();
+	double transform_scalar = mat4f_bench_ns(t1 - t0, k_bench_ops);
+	double transform_simd = mat4f_bench_ns(t2 - t1, k_bench_ops);
+
+	bool transform_match = true;
+	for (int p = 0; p < k_bench_point_count; ++p)
+	{
+		vec3f_t expected;
+		mat4f_transform(&matrices[p & mask], &bench.points[p], &expected);
+		mat4f_transform_simd(&bench.matrices[p & mask], &bench.points[p], &bench.transformed[p]);
+		transform_match &= mat4f_bench_close(expected.a, bench.transformed[p].a, 3);
+	}
+
+	//Batch transform cost is per point
+	t0 = timer_get_ticks();
+	for (int i = 0; i < k_bench_ops; i += k_bench_point_count)
+	{
+		const mat4f_t* m = &matrices[(i / k_bench_point_count) & mask];
+		for (int p = 0; p < k_bench_point_count; ++p)
+		{
+			mat4f_transform(m, &bench.points[p], &bench.transformed[p]);
+		}
+	}
+	t1 = timer_get_ticks();
+	for (int i = 0; i < k_bench_ops; i += k_bench_point_count)
+	{
+		mat4f_transform_n(&bench.matrices[(i / k_bench_point_count) & mask], bench.points, bench.transformed, k_bench_point_count);
+	}
+	t2 = timer_get_ticks();
+	double batch_scalar = mat4f_bench_ns(t1 - t0, k_bench_ops);
+	double batch_simd = mat4f_bench_ns(t2 - t1, k_bench_ops);
+
+	//A count that is not a multiple of the batch width checks the tail as well
+	bool batch_match = true;
+	const int batch_count = k_bench_point_count - 3;
+	mat4f_transform_n(&bench.matrices[0], bench.points, bench.transformed, batch_count);
+	for (int p = 0; p < batch_count; ++p)
+	{
+		vec3f_t expected;
+		mat4f_transform(&matrices[0], &bench.points[p], &expected);
+		batch_match &= mat4f_bench_close(expected.a, bench.transformed[p].a, 3);
+	}
+
+	t0 = timer_get_ticks();
+	for (int i = 0; i < k_bench_ops; ++i)
+	{
+		results[i & mask] = matrices[i & mask];
+		mat4f_invert(&results[i & mask]);
+	}
+	t1 = timer_get_ticks();
+	for (int i = 0; i < k_bench_ops; ++i)
+	{
+		bench.results[i & mask] = bench.matrices[i & mask];
+		mat4f_invert_simd(&bench.results[i & mask]);
+	}
+	t2 = timer_get_ticks();
+	double invert_scalar = mat4f_bench_ns(t1 - t0, k_bench_ops);
+	double invert_simd = mat4f_bench_ns(t2 - t1, k_bench_ops);
+
+	bool invert_match = true;
+	for (int i = 0; i < k_bench_matrix_count; ++i)
+	{
+		mat4f_t expected = matrices[i];
+		bench.results[i] = bench.matrices[i];
+		invert_match &= mat4f_invert(&expected) == mat4f_invert_simd(&bench.results[i]);
+		invert_match &= mat4f_bench_close(&expected.data[0][0], &bench.results[i].data[0][0], 16);
+	}
+
+	debug_print(k_print_warning, "mat4f ns/op using %s: mul scalar=%.2f simd=%.2f%s transform scalar=%.2f simd=%.2f%s transform_n scalar=%.2f simd=%.2f%s invert scalar=%.2f simd=%.2f%s\n",
+		cpu_has_avx2() ? "AVX2" : "SSE",
+		mul_scalar, mul_simd, mul_match ? "" : " MISMATCH",
+		transform_scalar, transform_simd, transform_match ? "" : " MISMATCH",
+		batch_scalar, batch_simd, batch_match ? "" : " MISMATCH",
+		invert_scalar, invert_simd, invert_match ? "" : " MISMATCH");
+
+	heap_free(heap, bench.transformed);
+	heap_free(heap, bench.points);
+	heap_free(heap, bench.results);
+	heap_free(heap, bench.matrices);
+	heap_destroy(heap);
+}
@@ -3,9 +3,11 @@
 #include "debug.h"
 #include "heap.h"
 #include "mutex.h"
-#include "queue.h"
+#include "object_pool.h"
+#include "spsc_queue.h"
 #include "thread.h"
 #include "timer.h"
+#include "trace.h"
 
 #include <stdbool.h>
 
@@ -22,6 +24,7 @@ enum
 	k_max_entity_types = 32,
 	k_max_snapshots = 256,
 	k_max_entities = 32,
+	k_packets_per_slab = 16,
 };
 
 typedef struct entity_type_t
@@ -77,8 +80,8 @@ typedef struct connection_t
 
 	thread_t* send_thread;
 
-	queue_t* send_queue;
-	queue_t* recv_queue;
+	spsc_queue_t* send_queue;
+	spsc_queue_t* recv_queue;
 
 	uint32_t last_recv_ms;
 
@@ -89,12 +92,18 @@ typedef struct net_t
 {
 	heap_t* heap;
 	ecs_t* ecs;
+	trace_t* trace;
 
 	int sequence;
 
 	SOCKET sock;
 	thread_t* recv_thread;
 
+	// Packets built on the main thread and freed by the send threads.
+	object_pool_t* send_packet_pool;
+	// Packets read by the receive thread and freed by the main thread.
+	object_pool_t* recv_packet_pool;
+
 	mutex_t* connections_mutex;
 	connection_t connections[3];
 
@@ -111,12 +120,15 @@ static void snapshot_entities(net_t* net);
 static void packet_send(connection_t* connection);
 static void packet_recv(connection_t* connection);
 
-net_t* net_create(heap_t* heap, ecs_t* ecs)
+net_t* net_create(heap_t* heap, ecs_t* ecs, trace_t* trace)
 {
 	net_t* net = heap_alloc(heap, sizeof(net_t), 8);
 	memset(net, 0, sizeof(net_t));
 	net->heap = heap;
 	net->ecs = ecs;
+	net->trace = trace;
+	net->send_packet_pool = object_pool_create(heap, sizeof(packet_t), 8, k_packets_per_slab, true);
+	net->recv_packet_pool = object_pool_create(heap, sizeof(packet_t), 8, k_packets_per_slab, true);
 
 	WSADATA data;
 	WSAStartup(MAKEWORD(2, 2), &data);
@@ -146,11 +158,14 @@ void net_destroy(net_t* net)
 	thread_destroy(net->recv_thread);
 	WSACleanup();
 	mutex_destroy(net->connections_mutex);
+	object_pool_destroy(net->recv_packet_pool);
+	object_pool_destroy(net->send_packet_pool);
 	heap_free(net->heap, net);
 }
 
 void net_update(net_t* net)
 {
+	TRACE_PUSH(net->trace, "net_update");
 	timeout_old_connections(net);
 	snapshot_entities(net);
 	for (int i = 0; i < _countof(net->connections); ++i)
@@ -158,11 +173,12 @@ void net_update(net_t* net)
 		connection_t* c = &net->connections[i];
 		if (c->address.port)
 		{
-			packet_send(c);
-			packet_recv(c);
+			TRACE_SCOPE(net->trace, "packet_send") packet_send(c);
+			TRACE_SCOPE(net->trace, "packet_recv") packet_recv(c);
 		}
 	}
 	net->sequence++;
+	TRACE_POP(net->trace);
 }
 
 void net_connect(net_t* net, const net_address_t* address)
@@ -179,10 +195,10 @@ void net_disconnect_all(net_t* net)
 		connection_t* c = &net->connections[i];
 		if (c->address.port)
 		{
-			queue_push(c->send_queue, NULL);
+			spsc_queue_push(c->send_queue, NULL);
 			thread_destroy(c->send_thread);
-			queue_destroy(c->send_queue);
-			queue_destroy(c->recv_queue);
+			spsc_queue_destroy(c->send_queue);
+			spsc_queue_destroy(c->recv_queue);
 		}
 	}
 	memset(net->connections, 0, sizeof(net->connections));
@@ -281,19 +297,24 @@ static int send_thread_func(void* user)
 	address.sin_addr.S_un.S_un_b.s_b3 = connection->address.ip[2];
 	address.sin_addr.S_un.S_un_b.s_b4 = connection->address.ip[3];
 
+	TRACE_THREAD_NAME(connection->net->trace, "net send");
 	while (true)
 	{
-		packet_t* packet = queue_pop(connection->send_queue);
+		packet_t* packet = spsc_queue_pop(connection->send_queue);
 		if (!packet)
 		{
 			break;
 		}
 
-		int bytes = sendto(connection->net->sock,
-			packet->data, packet->size, 0,
-			(struct sockaddr*)&address, sizeof(address));
+		int bytes = 0;
+		TRACE_SCOPE(connection->net->trace, "sendto")
+		{
+			bytes = sendto(connection->net->sock,
+				packet->data, packet->size, 0,
+				(struct sockaddr*)&address, sizeof(address));
+		}
 
-		heap_free(connection->net->heap, packet);
+		object_pool_free(connection->net->send_packet_pool, packet);
 
 		if (bytes <= 0)
 		{
@@ -301,6 +322,7 @@ static int send_thread_func(void* user)
 		}
 	}
 
+	heap_thread_cache_flush(connection->net->heap);
 	return 0;
 }
 
@@ -331,8 +353,8 @@ static connection_t* find_or_create_connection(net_t* net, const net_address_t*
 				c->incoming_sequence = -1;
 				c->ack_sequence = -1;
 				c->last_recv_ms = timer_ticks_to_ms(timer_get_ticks());
-				c->send_queue = queue_create(net->heap, 3);
-				c->recv_queue = queue_create(net->heap, 3);
+				c->send_queue = spsc_queue_create(net->heap, 3);
+				c->recv_queue = spsc_queue_create(net->heap, 3);
 				c->send_thread = thread_create(send_thread_func, c);
 
 				result = c;
@@ -350,9 +372,10 @@ static int recv_thread_func(void* user)
 {
 	net_t* net = user;
 
+	TRACE_THREAD_NAME(net->trace, "net recv");
 	while (true)
 	{
-		packet_t* packet = heap_alloc(net->heap, sizeof(packet_t), 8);
+		packet_t* packet = object_pool_alloc(net->recv_packet_pool);
 
 		struct sockaddr_in address;
 		int address_len = sizeof(address);
@@ -361,11 +384,12 @@ static int recv_thread_func(void* user)
 			(struct sockaddr*)&address, &address_len);
 		if (bytes <= 0)
 		{
-			heap_free(net->heap, packet);
+			object_pool_free(net->recv_packet_pool, packet);
 			break;
 		}
 
 		packet->size = bytes;
+		TRACE_PUSH(net->trace, "net receive packet");
 
 		net_address_t net_addr;
 		net_addr.port = ntohs(address.sin_port);
@@ -378,14 +402,20 @@ static int recv_thread_func(void* user)
 		if (!connection)
 		{
 			debug_print(k_print_info, "Too many connections!\n");
-			heap_free(net->heap, packet);
+			object_pool_free(net->recv_packet_pool, packet);
+			TRACE_POP(net->trace);
 			continue;
 		}
 		connection->last_recv_ms = timer_ticks_to_ms(timer_get_ticks());
 
-		queue_try_push(connection->recv_queue, packet);
+		if (!spsc_queue_try_push(connection->recv_queue, packet))
+		{
+			object_pool_free(net->recv_packet_pool, packet);
+		}
+		TRACE_POP(net->trace);
 	}
 
+	heap_thread_cache_flush(net->heap);
 	return 0;
 }
 
@@ -401,10 +431,10 @@ static void timeout_old_connections(net_t* net)
 		{
 			debug_print(k_print_info, "Disconnecting old connection.\n");
 
-			queue_push(c->send_queue, NULL);
+			spsc_queue_push(c->send_queue, NULL);
 			thread_destroy(c->send_thread);
-			queue_destroy(c->send_queue);
-			queue_destroy(c->recv_queue);
+			spsc_queue_destroy(c->send_queue);
+			spsc_queue_destroy(c->recv_queue);
 			memset(c, 0, sizeof(*c));
 		}
 	}
@@ -507,7 +537,7 @@ static void packet_send(connection_t* connection)
 {
 	net_t* net = connection->net;
 
-	packet_t* packet = heap_alloc(net->heap, sizeof(packet_t), 8);
+	packet_t* packet = object_pool_alloc(net->send_packet_pool);
 
 	packet_header_t header =
 	{
@@ -519,7 +549,7 @@ static void packet_send(connection_t* connection)
 	packet->size = sizeof(header);
 	packet->size += (int)packet_add_entities(connection, &packet->data[packet->size], sizeof(packet->data) - packet->size);
 
-	queue_push(connection->send_queue, packet);
+	spsc_queue_push(connection->send_queue, packet);
 }
 
 static void packet_read_entities(connection_t* connection, char* packet, size_t packet_size)
@@ -600,9 +630,14 @@ static void packet_recv(connection_t* connection)
 
 	while (true)
 	{
-		packet_t* packet = queue_try_pop(connection->recv_queue);
-		if (!packet || !packet->size)
+		packet_t* packet = spsc_queue_try_pop(connection->recv_queue);
+		if (!packet)
+		{
+			break;
+		}
+		if (!packet->size)
 		{
+			object_pool_free(net->recv_packet_pool, packet);
 			break;
 		}
 
@@ -610,6 +645,7 @@ static void packet_recv(connection_t* connection)
 		memcpy(&header, packet->data, sizeof(header));
 		if (header.sequence <= connection->incoming_sequence)
 		{
+			object_pool_free(net->recv_packet_pool, packet);
 			continue;
 		}
 
@@ -618,6 +654,6 @@ static void packet_recv(connection_t* connection)
 
 		packet_read_entities(connection, &packet->data[sizeof(header)], packet->size - sizeof(header));
 
-		heap_free(net->heap, packet);
+		object_pool_free(net->recv_packet_pool, packet);
 	}
 }
@@ -0,0 +1,121 @@
+#include "object_pool.h"
+
+#include "atomic.h"
+#include "heap.h"
+
+//Free slots are linked through their own first bytes
+typedef struct object_pool_slot_t
+{
+	struct object_pool_slot_t* next;
+} object_pool_slot_t;
+
+typedef struct object_pool_slab_t
+{
+	struct object_pool_slab_t* next;
+} object_pool_slab_t;
+
+typedef struct object_pool_t
+{
+	heap_t* heap;
+	size_t slot_size;
+	size_t alignment;
+	size_t slab_header_size;
+	int objects_per_slab;
+	bool concurrent_free;
+
+	//Only touched by the allocating thread
+	object_pool_slot_t* free_list;
+	object_pool_slab_t* slabs;
+
+	//Frees from any thread are pushed here and claimed all at once by the allocating thread
+	//Since nothing ever pops a single slot off this list, it is not subject to ABA
+	void* remote_free_list;
+} object_pool_t;
+
+object_pool_t* object_pool_create(heap_t* heap, size_t object_size, size_t alignment, int objects_per_slab, bool concurrent_free)
+{
+	object_pool_t* pool = heap_alloc(heap, sizeof(object_pool_t), 8);
+	pool->heap = heap;
+	pool->alignment = __max(alignment, _Alignof(object_pool_slot_t));
+	pool->slot_size = (__max(object_size, sizeof(object_pool_slot_t)) + (pool->alignment - 1)) & ~(pool->alignment - 1);
+	pool->slab_header_size = (sizeof(object_pool_slab_t) + (pool->alignment - 1)) & ~(pool->alignment - 1);
+	pool->objects_per_slab = objects_per_slab;
+	pool->concurrent_free = concurrent_free;
+	pool->free_list = NULL;
+	pool->slabs = NULL;
+	pool->remote_free_list = NULL;
+	return pool;
+}
+
+void object_pool_destroy(object_pool_t* pool)
+{
+	object_pool_slab_t* slab = pool->slabs;
+	while (slab)
+	{
+		object_pool_slab_t* next = slab->next;
+		heap_free(pool->heap, slab);
+		slab = next;
+	}
+	heap_free(pool->heap, pool);
+}
+
+//Carves a new slab into slots and threads them onto the free list
+static bool object_pool_add_slab(object_pool_t* pool)
+{
+	object_pool_slab_t* slab = heap_alloc(pool->heap,
+		pool->slab_header_size + pool->slot_size * pool->objects_per_slab, pool->alignment);
+	if (!slab)
+	{
+		return false;
+	}
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+
+	char* slots = (char*)slab + pool->slab_header_size;
+	for (int i = pool->objects_per_slab - 1; i >= 0; --i)
+	{
+		object_pool_slot_t* slot = (object_pool_slot_t*)(slots + pool->slot_size * i);
+		slot->next = pool->free_list;
+		pool->free_list = slot;
+	}
+	return true;
+}
+
+void* object_pool_alloc(object_pool_t* pool)
+{
+	if (!pool->free_list && pool->concurrent_free)
+	{
+		pool->free_list = atomic_exchange_pointer(&pool->remote_free_list, NULL);
+	}
+	if (!pool->free_list && !object_pool_add_slab(pool))
+	{
+		return NULL;
+	}
+
+	object_pool_slot_t* slot = pool->free_list;
+	pool->free_list = slot->next;
+	return slot;
+}
+
+void object_pool_free(object_pool_t* pool, void* object)
+{
+	if (!object)
+	{
+		return;
+	}
+
+	object_pool_slot_t* slot = object;
+	if (!pool->concurrent_free)
+	{
+		slot->next = pool->free_list;
+		pool->free_list = slot;
+		return;
+	}
+
+	void* head;
+	do
+	{
+		head = pool->remote_free_list;
+		slot->next = head;
+	} while (atomic_compare_and_exchange_pointer(&pool->remote_free_list, head, slot) != head);
+}
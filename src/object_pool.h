@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Fixed-size Object Pool
+//
+// Hands out objects of a single size in O(1) without fragmenting the heap.
+// Memory is taken from a heap_t in slabs which are carved into slots. Freed
+// slots go on a free list and are reused before any new slab is allocated.
+// Slabs are only returned to the heap when the pool is destroyed.
+//
+// Only one thread may allocate from a pool. If created with concurrent_free,
+// any thread may free objects back to it without taking a lock.
+
+// Handle to an object pool.
+typedef struct object_pool_t object_pool_t;
+
+typedef struct heap_t heap_t;
+
+// Create a pool of objects of object_size bytes with the given alignment.
+// Each slab taken from the heap holds objects_per_slab objects.
+// If concurrent_free is true, object_pool_free may be called from any thread.
+object_pool_t* object_pool_create(heap_t* heap, size_t object_size, size_t alignment, int objects_per_slab, bool concurrent_free);
+
+// Destroy a pool and all of its slabs.
+// Any objects still allocated from the pool become invalid.
+void object_pool_destroy(object_pool_t* pool);
+
+// Allocate an object from the pool.
+// Must only be called from the thread that owns the pool.
+void* object_pool_alloc(object_pool_t* pool);
+
+// Return an object to the pool it was allocated from.
+void object_pool_free(object_pool_t* pool, void* object);
@@ -0,0 +1,87 @@
+#include "bench.h"
+
+#include "debug.h"
+#include "heap.h"
+#include "object_pool.h"
+#include "timer.h"
+
+enum
+{
+	k_bench_iterations = 20000,
+	k_bench_objects = 64,
+};
+
+typedef struct object_type_t
+{
+	const char* name;
+	size_t size;
+} object_type_t;
+
+// Sizes of the engine objects that are churned through the heap today.
+static const object_type_t s_types[] =
+{
+	{ "fs_work_t", 1024 + 64 },
+	{ "packet_t", 1024 + 4 },
+	{ "model_command_t", 56 },
+	{ "trace event_t", 32 },
+};
+
+static double time_heap(heap_t* heap, size_t size)
+{
+	void* objects[k_bench_objects];
+	uint64_t t0 = timer_get_ticks();
+	for (int i = 0; i < k_bench_iterations; ++i)
+	{
+		for (int o = 0; o < k_bench_objects; ++o)
+		{
+			objects[o] = heap_alloc(heap, size, 8);
+		}
+		for (int o = 0; o < k_bench_objects; ++o)
+		{
+			heap_free(heap, objects[o]);
+		}
+	}
+	return (double)timer_ticks_to_us(timer_get_ticks() - t0);
+}
+
+static double time_pool(object_pool_t* pool)
+{
+	void* objects[k_bench_objects];
+	uint64_t t0 = timer_get_ticks();
+	for (int i = 0; i < k_bench_iterations; ++i)
+	{
+		for (int o = 0; o < k_bench_objects; ++o)
+		{
+			objects[o] = object_pool_alloc(pool);
+		}
+		for (int o = 0; o < k_bench_objects; ++o)
+		{
+			object_pool_free(pool, objects[o]);
+		}
+	}
+	return (double)timer_ticks_to_us(timer_get_ticks() - t0);
+}
+
+void object_pool_bench_run()
+{
+	double ops = 2.0 * k_bench_iterations * k_bench_objects;
+	for (int t = 0; t < _countof(s_types); ++t)
+	{
+		heap_t* heap = heap_create(2 * 1024 * 1024, k_heap_tracking_none);
+
+		double heap_us = time_heap(heap, s_types[t].size);
+
+		object_pool_t* pool = object_pool_create(heap, s_types[t].size, 8, k_bench_objects, false);
+		double pool_us = time_pool(pool);
+		object_pool_destroy(pool);
+
+		pool = object_pool_create(heap, s_types[t].size, 8, k_bench_objects, true);
+		double concurrent_us = time_pool(pool);
+		object_pool_destroy(pool);
+
+		heap_destroy(heap);
+
+		debug_print(k_print_warning, "object_pool %s heap ns/op=%.1f pool ns/op=%.1f concurrent_free ns/op=%.1f\n",
+			s_types[t].name, heap_us * 1000.0 / ops, pool_us * 1000.0 / ops, concurrent_us * 1000.0 / ops);
+	}
+}
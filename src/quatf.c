@@ -1,8 +1,92 @@
 #include "quatf.h"
 
+#include "cpu.h"
+#include "vec3f_sse.h"
+
 #define _USE_MATH_DEFINES
 #include <math.h>
 
+//Transposes four quatf_t so each register holds one component of all four
+static void quatf_load4(const quatf_t* q, __m128* x, __m128* y, __m128* z, __m128* w)
+{
+	*x = _mm_loadu_ps(&q[0].x);
+	*y = _mm_loadu_ps(&q[1].x);
+	*z = _mm_loadu_ps(&q[2].x);
+	*w = _mm_loadu_ps(&q[3].x);
+	_MM_TRANSPOSE4_PS(*x, *y, *z, *w);
+}
+
+static void quatf_rotate_vec_sse(const quatf_t* q, const vec3f_t* v, vec3f_t* out)
+{
+	__m128 qx, qy, qz, qw;
+	quatf_load4(q, &qx, &qy, &qz, &qw);
+	__m128 vx, vy, vz;
+	vec3f_load4(v, &vx, &vy, &vz);
+
+	//Same math as quatf_rotate_vec: t = 2 * cross(q, v), v + t * w + cross(q, t)
+	__m128 two = _mm_set1_ps(2.0f);
+	__m128 tx = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(qy, vz), _mm_mul_ps(qz, vy)));
+	__m128 ty = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(qz, vx), _mm_mul_ps(qx, vz)));
+	__m128 tz = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(qx, vy), _mm_mul_ps(qy, vx)));
+
+	__m128 rx = _mm_add_ps(vx, _mm_add_ps(_mm_mul_ps(tx, qw), _mm_sub_ps(_mm_mul_ps(qy, tz), _mm_mul_ps(qz, ty))));
+	__m128 ry = _mm_add_ps(vy, _mm_add_ps(_mm_mul_ps(ty, qw), _mm_sub_ps(_mm_mul_ps(qz, tx), _mm_mul_ps(qx, tz))));
+	__m128 rz = _mm_add_ps(vz, _mm_add_ps(_mm_mul_ps(tz, qw), _mm_sub_ps(_mm_mul_ps(qx, ty), _mm_mul_ps(qy, tx))));
+
+	vec3f_store4(out, rx, ry, rz);
+}
+
+//Eight at a time, each half is loaded and stored as in the SSE version
+static void quatf_rotate_vec_avx(const quatf_t* q, const vec3f_t* v, vec3f_t* out)
+{
+	__m128 qx0, qy0, qz0, qw0, qx1, qy1, qz1, qw1;
+	quatf_load4(q + 0, &qx0, &qy0, &qz0, &qw0);
+	quatf_load4(q + 4, &qx1, &qy1, &qz1, &qw1);
+	__m128 vx0, vy0, vz0, vx1, vy1, vz1;
+	vec3f_load4(v + 0, &vx0, &vy0, &vz0);
+	vec3f_load4(v + 4, &vx1, &vy1, &vz1);
+
+	__m256 qx = _mm256_set_m128(qx1, qx0);
+	__m256 qy = _mm256_set_m128(qy1, qy0);
+	__m256 qz = _mm256_set_m128(qz1, qz0);
+	__m256 qw = _mm256_set_m128(qw1, qw0);
+	__m256 vx = _mm256_set_m128(vx1, vx0);
+	__m256 vy = _mm256_set_m128(vy1, vy0);
+	__m256 vz = _mm256_set_m128(vz1, vz0);
+
+	__m256 two = _mm256_set1_ps(2.0f);
+	__m256 tx = _mm256_mul_ps(two, _mm256_sub_ps(_mm256_mul_ps(qy, vz), _mm256_mul_ps(qz, vy)));
+	__m256 ty = _mm256_mul_ps(two, _mm256_sub_ps(_mm256_mul_ps(qz, vx), _mm256_mul_ps(qx, vz)));
+	__m256 tz = _mm256_mul_ps(two, _mm256_sub_ps(_mm256_mul_ps(qx, vy), _mm256_mul_ps(qy, vx)));
+
+	__m256 rx = _mm256_add_ps(vx, _mm256_add_ps(_mm256_mul_ps(tx, qw), _mm256_sub_ps(_mm256_mul_ps(qy, tz), _mm256_mul_ps(qz, ty))));
+	__m256 ry = _mm256_add_ps(vy, _mm256_add_ps(_mm256_mul_ps(ty, qw), _mm256_sub_ps(_mm256_mul_ps(qz, tx), _mm256_mul_ps(qx, tz))));
+	__m256 rz = _mm256_add_ps(vz, _mm256_add_ps(_mm256_mul_ps(tz, qw), _mm256_sub_ps(_mm256_mul_ps(qx, ty), _mm256_mul_ps(qy, tx))));
+
+	vec3f_store4(out + 0, _mm256_castps256_ps128(rx), _mm256_castps256_ps128(ry), _mm256_castps256_ps128(rz));
+	vec3f_store4(out + 4, _mm256_extractf128_ps(rx, 1), _mm256_extractf128_ps(ry, 1), _mm256_extractf128_ps(rz, 1));
+}
+
+void quatf_rotate_vec_n(const quatf_t* q, const vec3f_t* v, vec3f_t* out, int count)
+{
+	int i = 0;
+	if (cpu_has_avx2())
+	{
+		for (; i + 8 <= count; i += 8)
+		{
+			quatf_rotate_vec_avx(q + i, v + i, out + i);
+		}
+	}
+	for (; i + 4 <= count; i += 4)
+	{
+		quatf_rotate_vec_sse(q + i, v + i, out + i);
+	}
+	for (; i < count; ++i)
+	{
+		out[i] = quatf_rotate_vec(q[i], v[i]);
+	}
+}
+
 vec3f_t quatf_to_eulers(quatf_t q)
 {
 	/* From wikipedia: https://en.wikipedia.org/wiki/Conversion_between_quaternions_and_Euler_angles */
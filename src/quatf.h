@@ -51,6 +51,11 @@ __forceinline vec3f_t quatf_rotate_vec(quatf_t q, vec3f_t v)
 	return vec3f_add(v, vec3f_add(vec3f_scale(t, q.w), vec3f_cross(q.v3, t)));
 }
 
+// Rotates count vectors, v[i] by q[i], and stores the results in out.
+// Works on four or eight vectors at a time with SSE or AVX2, whichever the processor supports.
+// out may alias v.
+void quatf_rotate_vec_n(const quatf_t* q, const vec3f_t* v, vec3f_t* out, int count);
+
 // Converts a quaternion to representation with 3 angles in radians: roll, yaw, pitch.
 vec3f_t quatf_to_eulers(quatf_t q);
 
@@ -1,75 +1,309 @@
+#include "queue.h"
+
 #include "atomic.h"
 #include "heap.h"
-#include "semaphore.h"
+
+#include <immintrin.h>
+#include <stdlib.h>
+
+enum
+{
+	// Failed attempts before a blocking push or pop goes to sleep.
+	k_queue_spin_count = 64,
+
+	// Producer and consumer state are padded apart so they do not share a cache line.
+	k_queue_cache_line = 64,
+};
+
+// Each cell carries a sequence number that tells pushers and poppers whose turn it is.
+// A cell at position p is free for the push of p when sequence == p,
+// and holds the item for the pop of p when sequence == p + 1.
+typedef struct queue_cell_t
+{
+	int sequence;
+	void* item;
+} queue_cell_t;
 
 typedef struct queue_t
 {
 	heap_t* heap;
-	semaphore_t* used_items;
-	semaphore_t* free_items;
-	void** items;
-	int capacity;
-	int head_index;
+	queue_cell_t* cells;
+	unsigned int mask;
+	unsigned int capacity;
+
+	char pad0[k_queue_cache_line];
 	int tail_index;
+	char pad1[k_queue_cache_line - sizeof(int)];
+	int head_index;
+	char pad2[k_queue_cache_line - sizeof(int)];
+
+	// Sleeping poppers wait on push_epoch, which pushers bump only when pop_waiters is non-zero.
+	int pop_waiters;
+	int push_epoch;
+	char pad3[k_queue_cache_line - 2 * sizeof(int)];
+
+	// Sleeping pushers wait on pop_epoch, which poppers bump only when push_waiters is non-zero.
+	int push_waiters;
+	int pop_epoch;
+	char pad4[k_queue_cache_line - 2 * sizeof(int)];
 } queue_t;
 
 queue_t* queue_create(heap_t* heap, int capacity)
 {
-	queue_t* queue = heap_alloc(heap, sizeof(queue_t), 8);
-	queue->items = heap_alloc(heap, sizeof(void*) * capacity, 8);
-	queue->used_items = semaphore_create(0, capacity);
-	queue->free_items = semaphore_create(capacity, capacity);
+	//Cells are a power of two so positions can wrap around 32 bits
+	//When capacity is not a power of two, the extra cells are never used
+	//At least two cells are needed, with one the full and free sequence numbers would collide
+	unsigned int cell_count = 2;
+	while (cell_count < (unsigned int)capacity)
+	{
+		cell_count <<= 1;
+	}
+
+	queue_t* queue = heap_alloc(heap, sizeof(queue_t), k_queue_cache_line);
+	queue->cells = heap_alloc(heap, sizeof(queue_cell_t) * cell_count, k_queue_cache_line);
+	for (unsigned int i = 0; i < cell_count; ++i)
+	{
+		queue->cells[i].sequence = (int)i;
+	}
 	queue->heap = heap;
+	queue->mask = cell_count - 1;
 	queue->capacity = capacity;
-	queue->head_index = 0;
 	queue->tail_index = 0;
+	queue->head_index = 0;
+	queue->pop_waiters = 0;
+	queue->push_epoch = 0;
+	queue->push_waiters = 0;
+	queue->pop_epoch = 0;
 	return queue;
 }
 
 void queue_destroy(queue_t* queue)
 {
-	semaphore_destroy(queue->used_items);
-	semaphore_destroy(queue->free_items);
-	heap_free(queue->heap, queue->items);
+	heap_free(queue->heap, queue->cells);
 	heap_free(queue->heap, queue);
 }
 
+//Claims and fills up to count consecutive cells with a single compare-and-exchange of the tail
+//Returns the number of items pushed, zero when the queue is full
+static int queue_push_internal(queue_t* queue, void** items, int count)
+{
+	unsigned int position = (unsigned int)atomic_load(&queue->tail_index);
+	for (;;)
+	{
+		//Count the run of cells the pops of the previous lap have already released
+		unsigned int available = 0;
+		while (available < (unsigned int)count)
+		{
+			queue_cell_t* cell = &queue->cells[(position + available) & queue->mask];
+			if ((unsigned int)atomic_load(&cell->sequence) != position + available)
+			{
+				break;
+			}
+			++available;
+		}
+
+		//Capacities that are not a power of two have fewer usable slots than cells
+		if (available && queue->capacity != queue->mask + 1)
+		{
+			unsigned int used = position - (unsigned int)atomic_load(&queue->head_index);
+			available = used >= queue->capacity ? 0 : __min(available, queue->capacity - used);
+		}
+
+		if (available == 0)
+		{
+			//Another pusher may have claimed this position while we looked, otherwise the queue is full
+			unsigned int current = (unsigned int)atomic_load(&queue->tail_index);
+			if (current == position)
+			{
+				return 0;
+			}
+			position = current;
+			continue;
+		}
+
+		unsigned int observed = (unsigned int)atomic_compare_and_exchange(&queue->tail_index, (int)position, (int)(position + available));
+		if (observed != position)
+		{
+			position = observed;
+			continue;
+		}
+
+		for (unsigned int i = 0; i < available; ++i)
+		{
+			queue_cell_t* cell = &queue->cells[(position + i) & queue->mask];
+			cell->item = items[i];
+			if (i + 1 < available)
+			{
+				atomic_store(&cell->sequence, (int)(position + i + 1));
+			}
+			else
+			{
+				//Full barrier, so the waiter check below cannot be read before the items are published
+				atomic_exchange(&cell->sequence, (int)(position + i + 1));
+			}
+		}
+		if (atomic_load(&queue->pop_waiters))
+		{
+			atomic_increment(&queue->push_epoch);
+			atomic_wake_all(&queue->push_epoch);
+		}
+		return (int)available;
+	}
+}
+
+//Claims and empties up to max_count consecutive cells with a single compare-and-exchange of the head
+//Returns the number of items popped, zero when the queue is empty
+static int queue_pop_internal(queue_t* queue, void** items, int max_count)
+{
+	unsigned int position = (unsigned int)atomic_load(&queue->head_index);
+	for (;;)
+	{
+		//Count the run of cells whose pushes have been published
+		unsigned int available = 0;
+		while (available < (unsigned int)max_count)
+		{
+			queue_cell_t* cell = &queue->cells[(position + available) & queue->mask];
+			if ((unsigned int)atomic_load(&cell->sequence) != position + available + 1)
+			{
+				break;
+			}
+			++available;
+		}
+
+		if (available == 0)
+		{
+			//Another popper may have claimed this position while we looked, otherwise the queue is empty
+			unsigned int current = (unsigned int)atomic_load(&queue->head_index);
+			if (current == position)
+			{
+				return 0;
+			}
+			position = current;
+			continue;
+		}
+
+		unsigned int observed = (unsigned int)atomic_compare_and_exchange(&queue->head_index, (int)position, (int)(position + available));
+		if (observed != position)
+		{
+			position = observed;
+			continue;
+		}
+
+		for (unsigned int i = 0; i < available; ++i)
+		{
+			queue_cell_t* cell = &queue->cells[(position + i) & queue->mask];
+			items[i] = cell->item;
+			//Hand the cell to the push one lap ahead
+			if (i + 1 < available)
+			{
+				atomic_store(&cell->sequence, (int)(position + i + queue->mask + 1));
+			}
+			else
+			{
+				atomic_exchange(&cell->sequence, (int)(position + i + queue->mask + 1));
+			}
+		}
+		if (atomic_load(&queue->push_waiters))
+		{
+			atomic_increment(&queue->pop_epoch);
+			atomic_wake_all(&queue->pop_epoch);
+		}
+		return (int)available;
+	}
+}
+
+void queue_push_n(queue_t* queue, void** items, int count)
+{
+	while (count > 0)
+	{
+		int pushed = 0;
+		for (int i = 0; i < k_queue_spin_count && !pushed; ++i)
+		{
+			pushed = queue_push_internal(queue, items, count);
+			if (!pushed)
+			{
+				_mm_pause();
+			}
+		}
+		if (!pushed)
+		{
+			//Register as a waiter before the final attempt so a pop in between cannot be missed
+			int epoch = atomic_load(&queue->pop_epoch);
+			atomic_increment(&queue->push_waiters);
+			pushed = queue_push_internal(queue, items, count);
+			if (!pushed)
+			{
+				atomic_wait(&queue->pop_epoch, epoch);
+			}
+			atomic_decrement(&queue->push_waiters);
+		}
+		items += pushed;
+		count -= pushed;
+	}
+}
+
+int queue_pop_n(queue_t* queue, void** items, int max_count)
+{
+	for (;;)
+	{
+		for (int i = 0; i < k_queue_spin_count; ++i)
+		{
+			int popped = queue_pop_internal(queue, items, max_count);
+			if (popped)
+			{
+				return popped;
+			}
+			_mm_pause();
+		}
+
+		//Register as a waiter before the final attempt so a push in between cannot be missed
+		int epoch = atomic_load(&queue->push_epoch);
+		atomic_increment(&queue->pop_waiters);
+		int popped = queue_pop_internal(queue, items, max_count);
+		if (!popped)
+		{
+			atomic_wait(&queue->push_epoch, epoch);
+		}
+		atomic_decrement(&queue->pop_waiters);
+		if (popped)
+		{
+			return popped;
+		}
+	}
+}
+
+int queue_try_push_n(queue_t* queue, void** items, int count)
+{
+	return queue_push_internal(queue, items, count);
+}
+
+int queue_try_pop_n(queue_t* queue, void** items, int max_count)
+{
+	return queue_pop_internal(queue, items, max_count);
+}
+
 void queue_push(queue_t* queue, void* item)
 {
-	semaphore_acquire(queue->free_items);
-	int index = atomic_increment(&queue->tail_index) % queue->capacity;
-	queue->items[index] = item;
-	semaphore_release(queue->used_items);
+	queue_push_n(queue, &item, 1);
 }
 
 void* queue_pop(queue_t* queue)
 {
-	semaphore_acquire(queue->used_items);
-	int index = atomic_increment(&queue->head_index) % queue->capacity;
-	void* item = queue->items[index];
-	semaphore_release(queue->free_items);
+	void* item;
+	queue_pop_n(queue, &item, 1);
 	return item;
 }
 
 bool queue_try_push(queue_t* queue, void* item)
 {
-	if (semaphore_try_acquire(queue->free_items))
-	{
-		int index = atomic_increment(&queue->tail_index) % queue->capacity;
-		queue->items[index] = item;
-		semaphore_release(queue->used_items);
-		return true;
-	}
-	return false;
+	return queue_push_internal(queue, &item, 1) == 1;
 }
 
 void* queue_try_pop(queue_t* queue)
 {
-	if (semaphore_try_acquire(queue->used_items))
+	void* item;
+	if (queue_pop_internal(queue, &item, 1))
 	{
-		int index = atomic_increment(&queue->head_index) % queue->capacity;
-		void* item = queue->items[index];
-		semaphore_release(queue->free_items);
 		return item;
 	}
 	return NULL;
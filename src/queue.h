@@ -3,6 +3,8 @@
 #include <stdbool.h>
 
 // Thread-safe Queue container
+// Bounded and lock-free: pushes and pops only touch shared atomics unless the queue
+// is full or empty, in which case blocking calls spin briefly and then sleep.
 
 // Handle to a thread-safe queue.
 typedef struct queue_t queue_t;
@@ -34,3 +36,26 @@ bool queue_try_push(queue_t* queue, void* item);
 // If the queue is empty, returns NULL.
 // Safe for multiple threads to pop at the same time.
 void* queue_try_pop(queue_t* queue);
+
+// Push count items onto a queue, in order.
+// Consecutive runs of free slots are claimed with a single atomic operation each.
+// If the queue is full, blocks until space is available for the rest.
+// Items from other pushers may be interleaved between runs.
+// Safe for multiple threads to push at the same time.
+void queue_push_n(queue_t* queue, void** items, int count);
+
+// Pop up to max_count items off a queue (FIFO order) with a single atomic operation.
+// If the queue is empty, blocks until at least one item is available.
+// Returns the number of items popped.
+// Safe for multiple threads to pop at the same time.
+int queue_pop_n(queue_t* queue, void** items, int max_count);
+
+// Push as many of count items as there is space for, in order, with a single atomic operation.
+// Returns the number of items pushed, zero if the queue is full.
+// Safe for multiple threads to push at the same time.
+int queue_try_push_n(queue_t* queue, void** items, int count);
+
+// Pop up to max_count items off a queue (FIFO order) with a single atomic operation.
+// Returns the number of items popped, zero if the queue is empty.
+// Safe for multiple threads to pop at the same time.
+int queue_try_pop_n(queue_t* queue, void** items, int max_count);
@@ -0,0 +1,297 @@
+#include "bench.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "event.h"
+#include "heap.h"
+#include "queue.h"
+#include "semaphore.h"
+#include "spsc_queue.h"
+#include "thread.h"
+#include "timer.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+enum
+{
+	k_bench_items = 200000,
+	k_bench_capacity = 256,
+	k_bench_ping_pongs = 20000,
+	k_bench_max_threads = 8,
+	k_bench_max_batch = 512,
+	k_bench_batch_capacity = 1024,
+};
+
+// The semaphore-based queue that queue_t replaced, kept as the baseline.
+typedef struct semaphore_queue_t
+{
+	heap_t* heap;
+	semaphore_t* used_items;
+	semaphore_t* free_items;
+	void** items;
+	int capacity;
+	int head_index;
+	int tail_index;
+} semaphore_queue_t;
+
+static void* semaphore_queue_create(heap_t* heap, int capacity)
+{
+	semaphore_queue_t* queue = heap_alloc(heap, sizeof(semaphore_queue_t), 8);
+	queue->items = heap_alloc(heap, sizeof(void*) * capacity, 8);
+	queue->used_items = semaphore_create(0, capacity);
+	queue->free_items = semaphore_create(capacity, capacity);
+	queue->heap = heap;
+	queue->capacity = capacity;
+	queue->head_index = 0;
+	queue->tail_index = 0;
+	return queue;
+}
+
+static void semaphore_queue_destroy(void* user)
+{
+	semaphore_queue_t* queue = user;
+	semaphore_destroy(queue->used_items);
+	semaphore_destroy(queue->free_items);
+	heap_free(queue->heap, queue->items);
+	heap_free(queue->heap, queue);
+}
+
+static void semaphore_queue_push(void* user, void* item)
+{
+	semaphore_queue_t* queue = user;
+	semaphore_acquire(queue->free_items);
+	int index = atomic_increment(&queue->tail_index) % queue->capacity;
+	queue->items[index] = item;
+	semaphore_release(queue->used_items);
+}
+
+static void* semaphore_queue_pop(void* user)
+{
+	semaphore_queue_t* queue = user;
+	semaphore_acquire(queue->used_items);
+	int index = atomic_increment(&queue->head_index) % queue->capacity;
+	void* item = queue->items[index];
+	semaphore_release(queue->free_items);
+	return item;
+}
+
+static void* ring_queue_create(heap_t* heap, int capacity) { return queue_create(heap, capacity); }
+static void ring_queue_destroy(void* queue) { queue_destroy(queue); }
+static void ring_queue_push(void* queue, void* item) { queue_push(queue, item); }
+static void* ring_queue_pop(void* queue) { return queue_pop(queue); }
+
+static void* spsc_create(heap_t* heap, int capacity) { return spsc_queue_create(heap, capacity); }
+static void spsc_destroy(void* queue) { spsc_queue_destroy(queue); }
+static void spsc_push(void* queue, void* item) { spsc_queue_push(queue, item); }
+static void* spsc_pop(void* queue) { return spsc_queue_pop(queue); }
+
+typedef struct queue_bench_impl_t
+{
+	const char* name;
+	void* (*create)(heap_t* heap, int capacity);
+	void (*destroy)(void* queue);
+	void (*push)(void* queue, void* item);
+	void* (*pop)(void* queue);
+	bool single_producer_consumer;
+} queue_bench_impl_t;
+
+static const queue_bench_impl_t s_impls[] =
+{
+	{ "semaphore", semaphore_queue_create, semaphore_queue_destroy, semaphore_queue_push, semaphore_queue_pop, false },
+	{ "ring", ring_queue_create, ring_queue_destroy, ring_queue_push, ring_queue_pop, false },
+	{ "spsc", spsc_create, spsc_destroy, spsc_push, spsc_pop, true },
+};
+
+typedef struct queue_bench_data_t
+{
+	const queue_bench_impl_t* impl;
+	void* queue;
+	void* reply_queue;
+	event_t* start;
+	int count;
+	int batch;
+} queue_bench_data_t;
+
+static int producer_func(void* user)
+{
+	queue_bench_data_t* data = user;
+	event_wait(data->start);
+	for (int i = 0; i < data->count; ++i)
+	{
+		data->impl->push(data->queue, (void*)(intptr_t)(i + 1));
+	}
+	return 0;
+}
+
+static int consumer_func(void* user)
+{
+	queue_bench_data_t* data = user;
+	event_wait(data->start);
+	for (int i = 0; i < data->count; ++i)
+	{
+		data->impl->pop(data->queue);
+	}
+	return 0;
+}
+
+// Throughput with the given number of producer and consumer threads.
+static void run_throughput_test(heap_t* heap, const queue_bench_impl_t* impl, int producers, int consumers, const char* name)
+{
+	queue_bench_data_t producer_data = { .impl = impl, .queue = impl->create(heap, k_bench_capacity), .start = event_create() };
+	queue_bench_data_t consumer_data = producer_data;
+	producer_data.count = k_bench_items / producers;
+	consumer_data.count = producer_data.count * producers / consumers;
+
+	thread_t* threads[k_bench_max_threads * 2];
+	int thread_count = 0;
+	for (int i = 0; i < producers; ++i)
+	{
+		threads[thread_count++] = thread_create(producer_func, &producer_data);
+	}
+	for (int i = 0; i < consumers; ++i)
+	{
+		threads[thread_count++] = thread_create(consumer_func, &consumer_data);
+	}
+
+	uint64_t t0 = timer_get_ticks();
+	event_signal(producer_data.start);
+	for (int i = 0; i < thread_count; ++i)
+	{
+		thread_destroy(threads[i]);
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	event_destroy(producer_data.start);
+	impl->destroy(producer_data.queue);
+
+	debug_print(k_print_warning, "queue %s %s %dp/%dc ns/item=%.1f\n",
+		impl->name, name, producers, consumers,
+		timer_ticks_to_us(t1 - t0) * 1000.0 / (double)(consumer_data.count * consumers));
+}
+
+static int echo_func(void* user)
+{
+	queue_bench_data_t* data = user;
+	event_wait(data->start);
+	for (int i = 0; i < data->count; ++i)
+	{
+		data->impl->push(data->reply_queue, data->impl->pop(data->queue));
+	}
+	return 0;
+}
+
+// Round-trip latency of a single item bounced between two threads.
+static void run_latency_test(heap_t* heap, const queue_bench_impl_t* impl)
+{
+	queue_bench_data_t data =
+	{
+		.impl = impl,
+		.queue = impl->create(heap, 3),
+		.reply_queue = impl->create(heap, 3),
+		.start = event_create(),
+		.count = k_bench_ping_pongs,
+	};
+	thread_t* thread = thread_create(echo_func, &data);
+
+	event_signal(data.start);
+	uint64_t t0 = timer_get_ticks();
+	for (int i = 0; i < data.count; ++i)
+	{
+		impl->push(data.queue, (void*)(intptr_t)(i + 1));
+		impl->pop(data.reply_queue);
+	}
+	uint64_t t1 = timer_get_ticks();
+	thread_destroy(thread);
+
+	event_destroy(data.start);
+	impl->destroy(data.reply_queue);
+	impl->destroy(data.queue);
+
+	debug_print(k_print_warning, "queue %s round-trip ns=%.1f\n",
+		impl->name, timer_ticks_to_us(t1 - t0) * 1000.0 / (double)data.count);
+}
+
+static int batch_producer_func(void* user)
+{
+	queue_bench_data_t* data = user;
+	void* items[k_bench_max_batch];
+	for (int i = 0; i < data->batch; ++i)
+	{
+		items[i] = (void*)(intptr_t)(i + 1);
+	}
+	event_wait(data->start);
+	for (int i = 0; i < data->count; i += data->batch)
+	{
+		queue_push_n(data->queue, items, data->batch);
+	}
+	return 0;
+}
+
+static int batch_consumer_func(void* user)
+{
+	queue_bench_data_t* data = user;
+	void* items[k_bench_max_batch];
+	event_wait(data->start);
+	for (int i = 0; i < data->count; )
+	{
+		i += queue_pop_n(data->queue, items, __min(data->batch, data->count - i));
+	}
+	return 0;
+}
+
+// Per-item cost of queue_push_n/queue_pop_n when moving items in batches of the given size.
+static void run_batch_test(heap_t* heap, int batch, int producers, int consumers)
+{
+	queue_bench_data_t producer_data = { .queue = queue_create(heap, k_bench_batch_capacity), .start = event_create(), .batch = batch };
+	queue_bench_data_t consumer_data = producer_data;
+	producer_data.count = k_bench_items / producers / batch * batch;
+	consumer_data.count = producer_data.count * producers / consumers;
+
+	thread_t* threads[k_bench_max_threads * 2];
+	int thread_count = 0;
+	for (int i = 0; i < producers; ++i)
+	{
+		threads[thread_count++] = thread_create(batch_producer_func, &producer_data);
+	}
+	for (int i = 0; i < consumers; ++i)
+	{
+		threads[thread_count++] = thread_create(batch_consumer_func, &consumer_data);
+	}
+
+	uint64_t t0 = timer_get_ticks();
+	event_signal(producer_data.start);
+	for (int i = 0; i < thread_count; ++i)
+	{
+		thread_destroy(threads[i]);
+	}
+	uint64_t t1 = timer_get_ticks();
+
+	event_destroy(producer_data.start);
+	queue_destroy(producer_data.queue);
+
+	debug_print(k_print_warning, "queue batch=%d %dp/%dc ns/item=%.1f\n",
+		batch, producers, consumers,
+		timer_ticks_to_us(t1 - t0) * 1000.0 / (double)(consumer_data.count * consumers));
+}
+
+void queue_bench_run()
+{
+	heap_t* heap = heap_create(2 * 1024 * 1024, k_heap_tracking_none);
+	for (int i = 0; i < _countof(s_impls); ++i)
+	{
+		run_throughput_test(heap, &s_impls[i], 1, 1, "spsc");
+		if (!s_impls[i].single_producer_consumer)
+		{
+			run_throughput_test(heap, &s_impls[i], 4, 1, "mpsc");
+			run_throughput_test(heap, &s_impls[i], 4, 4, "mpmc");
+		}
+		run_latency_test(heap, &s_impls[i]);
+	}
+	for (int batch = 1; batch <= k_bench_max_batch; batch *= 8)
+	{
+		run_batch_test(heap, batch, 1, 1);
+		run_batch_test(heap, batch, 4, 4);
+	}
+	heap_destroy(heap);
+}
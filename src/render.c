@@ -1,10 +1,17 @@
 #include "render.h"
 
+#include "debug.h"
 #include "ecs.h"
+#include "event.h"
+#include "frame_arena.h"
+#include "frame_stats.h"
 #include "gpu.h"
 #include "heap.h"
-#include "queue.h"
+#include "semaphore.h"
+#include "spsc_queue.h"
 #include "thread.h"
+#include "timer.h"
+#include "trace.h"
 #include "wm.h"
 
 #include <assert.h>
@@ -13,6 +20,13 @@
 enum
 {
 	k_render_max_drawables = 512,
+
+	// Commands are handed to the render thread a frame at a time.
+	k_render_max_pending_commands = k_render_max_drawables + 1,
+	k_render_queue_capacity = k_render_max_pending_commands * 2,
+
+	// Per-frame space for queued commands and their uniform data.
+	k_render_frame_arena_size = 256 * 1024,
 };
 
 typedef enum command_type_t
@@ -28,6 +42,7 @@ typedef struct model_command_t
 	gpu_mesh_info_t* mesh;
 	gpu_shader_info_t* shader;
 	gpu_uniform_buffer_info_t uniform_buffer;
+	int flow_id;
 } model_command_t;
 
 typedef struct frame_done_command_t
@@ -62,9 +77,22 @@ typedef struct render_t
 {
 	heap_t* heap;
 	wm_window_t* window;
+	trace_t* trace;
+	frame_stats_t* frame_stats;
 	thread_t* thread;
 	gpu_t* gpu;
-	queue_t* queue;
+	spsc_queue_t* queue;
+
+	// Commands pushed this frame, published together by render_push_done.
+	void* pending_commands[k_render_max_pending_commands];
+	int pending_count;
+
+	// Commands are allocated per frame and never freed individually.
+	// The render thread releases a region each time it finishes a frame.
+	frame_arena_t* frame_arena;
+	semaphore_t* free_regions;
+	event_t* ready;
+	int push_frame_counter;
 
 	int frame_counter;
 	int gpu_frame_count;
@@ -83,63 +111,121 @@ static draw_mesh_t* create_or_get_mesh_for_model_command(render_t* render, model
 static draw_instance_t* create_or_get_instance_for_model_command(render_t* render, model_command_t* command, gpu_shader_t* shader);
 static void destroy_stale_data(render_t* render);
 
-render_t* render_create(heap_t* heap, wm_window_t* window)
+render_t* render_create(heap_t* heap, wm_window_t* window, trace_t* trace, frame_stats_t* frame_stats)
 {
 	render_t* render = heap_alloc(heap, sizeof(render_t), 8);
 	render->heap = heap;
 	render->window = window;
-	render->queue = queue_create(heap, 3);
+	render->trace = trace;
+	render->frame_stats = frame_stats;
+	render->queue = spsc_queue_create(heap, k_render_queue_capacity);
+	render->pending_count = 0;
 	render->frame_counter = 0;
 	render->instance_count = 0;
 	render->mesh_count = 0;
 	render->shader_count = 0;
+	render->push_frame_counter = 0;
+
+	// The frame arena is sized by the swapchain, which only exists once the render thread creates the GPU.
+	render->ready = event_create();
 	render->thread = thread_create(render_thread_func, render);
+	event_wait(render->ready);
+	event_destroy(render->ready);
+	render->ready = NULL;
+
 	return render;
 }
 
 void render_destroy(render_t* render)
 {
-	queue_push(render->queue, NULL);
+	spsc_queue_push(render->queue, NULL);
 	thread_destroy(render->thread);
-	queue_destroy(render->queue);
+	spsc_queue_destroy(render->queue);
+
+	frame_arena_stats_t stats;
+	frame_arena_get_stats(render->frame_arena, &stats);
+	debug_print(k_print_info, "Render frame arena: high water %zu bytes, %d overflow frames\n",
+		stats.high_water_bytes, stats.overflow_frames);
+
+	frame_arena_destroy(render->frame_arena);
+	semaphore_destroy(render->free_regions);
 	heap_free(render->heap, render);
 }
 
 void render_push_model(render_t* render, ecs_entity_ref_t* entity, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_uniform_buffer_info_t* uniform)
 {
-	model_command_t* command = heap_alloc(render->heap, sizeof(model_command_t), 8);
+	TRACE_PUSH(render->trace, "render_push_model");
+
+	model_command_t* command = frame_arena_alloc(render->frame_arena, sizeof(model_command_t), 8);
 	command->type = k_command_model;
+	command->flow_id = TRACE_FLOW_BEGIN(render->trace, "model");
 	command->entity = *entity;
 	command->mesh = mesh;
 	command->shader = shader;
 	command->uniform_buffer.size = uniform->size;
-	command->uniform_buffer.data = heap_alloc(render->heap, uniform->size, 8);
+	command->uniform_buffer.data = frame_arena_alloc(render->frame_arena, uniform->size, 16);
 	memcpy(command->uniform_buffer.data, uniform->data, uniform->size);
-	queue_push(render->queue, command);
+
+	//Flush once full so there is always room for the next model or the frame done command
+	render->pending_commands[render->pending_count++] = command;
+	if (render->pending_count == _countof(render->pending_commands))
+	{
+		spsc_queue_push_n(render->queue, render->pending_commands, render->pending_count);
+		render->pending_count = 0;
+	}
+
+	TRACE_POP(render->trace);
 }
 
 void render_push_done(render_t* render)
 {
-	frame_done_command_t* command = heap_alloc(render->heap, sizeof(frame_done_command_t), 8);
+	frame_done_command_t* command = frame_arena_alloc(render->frame_arena, sizeof(frame_done_command_t), 8);
 	command->type = k_command_frame_done;
-	queue_push(render->queue, command);
+	render->pending_commands[render->pending_count++] = command;
+
+	spsc_queue_push_n(render->queue, render->pending_commands, render->pending_count);
+	render->pending_count = 0;
+
+	// Wait until the render thread is done with the region the next frame will reuse.
+	uint64_t wait_start = timer_get_ticks();
+	TRACE_SCOPE(render->trace, "wait for render thread") semaphore_acquire(render->free_regions);
+	frame_stats_record(render->frame_stats, k_frame_stat_render_wait, timer_get_ticks() - wait_start);
+	frame_arena_reset(render->frame_arena, ++render->push_frame_counter);
 }
 
 static int render_thread_func(void* user)
 {
 	render_t* render = user;
+	TRACE_THREAD_NAME(render->trace, "render");
 
-	render->gpu = gpu_create(render->heap, render->window);
+	render->gpu = gpu_create(render->heap, render->window, render->trace);
 	render->gpu_frame_count = gpu_get_frame_count(render->gpu);
 
+	render->frame_arena = frame_arena_create(render->heap, render->gpu_frame_count, k_render_frame_arena_size);
+	render->free_regions = semaphore_create(render->gpu_frame_count - 1, render->gpu_frame_count);
+	event_signal(render->ready);
+
 	gpu_cmd_buffer_t* cmdbuf = NULL;
 	gpu_pipeline_t* last_pipeline = NULL;
 	gpu_mesh_t* last_mesh = NULL;
 	int frame_index = 0;
 
+	void* commands[k_render_max_pending_commands];
+	int command_count = 0;
+	int command_index = 0;
+
 	while (true)
 	{
-		command_type_t* type = queue_pop(render->queue);
+		if (command_index == command_count)
+		{
+			TRACE_SCOPE(render->trace, "wait for commands")
+			{
+				command_count = spsc_queue_pop_n(render->queue, commands, _countof(commands));
+			}
+			command_index = 0;
+			TRACE_COUNTER(render->trace, "render commands popped", command_count);
+		}
+		command_type_t* type = commands[command_index++];
 		if (!type)
 		{
 			break;
@@ -152,24 +238,29 @@ static int render_thread_func(void* user)
 
 		if (*type == k_command_frame_done)
 		{
+			uint64_t frame_end_start = timer_get_ticks();
 			gpu_frame_end(render->gpu);
+			frame_stats_record(render->frame_stats, k_frame_stat_gpu_wait, timer_get_ticks() - frame_end_start);
 			cmdbuf = NULL;
 			last_pipeline = NULL;
 			last_mesh = NULL;
 
-			destroy_stale_data(render);
+			TRACE_SCOPE(render->trace, "destroy_stale_data") destroy_stale_data(render);
 			++render->frame_counter;
 			frame_index = render->frame_counter % render->gpu_frame_count;
+
+			semaphore_release(render->free_regions);
 		}
 		else if (*type == k_command_model)
 		{
 			model_command_t* command = (model_command_t*)type;
+			TRACE_PUSH(render->trace, "draw model");
+			TRACE_FLOW_END(render->trace, "model", command->flow_id);
+
 			draw_shader_t* shader = create_or_get_shader_for_model_command(render, command);
 			draw_mesh_t* mesh = create_or_get_mesh_for_model_command(render, command);
 			draw_instance_t* instance = create_or_get_instance_for_model_command(render, command, shader->shader);
 
-			heap_free(render->heap, command->uniform_buffer.data);
-
 			if (last_pipeline != shader->pipeline)
 			{
 				gpu_cmd_pipeline_bind(render->gpu, cmdbuf, shader->pipeline);
@@ -182,9 +273,8 @@ static int render_thread_func(void* user)
 			}
 			gpu_cmd_descriptor_bind(render->gpu, cmdbuf, instance->descriptors[frame_index]);
 			gpu_cmd_draw(render->gpu, cmdbuf);
+			TRACE_POP(render->trace);
 		}
-
-		heap_free(render->heap, type);
 	}
 
 	gpu_wait_until_idle(render->gpu);
@@ -194,6 +284,8 @@ static int render_thread_func(void* user)
 	gpu_destroy(render->gpu);
 	render->gpu = NULL;
 
+	heap_thread_cache_flush(render->heap);
+
 	return 0;
 }
 
@@ -5,14 +5,18 @@
 typedef struct render_t render_t;
 
 typedef struct ecs_entity_ref_t ecs_entity_ref_t;
+typedef struct frame_stats_t frame_stats_t;
 typedef struct gpu_mesh_info_t gpu_mesh_info_t;
 typedef struct gpu_shader_info_t gpu_shader_info_t;
 typedef struct gpu_uniform_buffer_info_t gpu_uniform_buffer_info_t;
 typedef struct heap_t heap_t;
+typedef struct trace_t trace_t;
 typedef struct wm_window_t wm_window_t;
 
 // Create a render system.
-render_t* render_create(heap_t* heap, wm_window_t* window);
+// Each model is traced as a flow from its push to its draw on the render thread.
+// Waits on the render thread and the GPU are recorded to frame_stats, which may be NULL.
+render_t* render_create(heap_t* heap, wm_window_t* window, trace_t* trace, frame_stats_t* frame_stats);
 
 // Destroy a render system.
 void render_destroy(render_t* render);
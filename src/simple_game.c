@@ -84,14 +84,14 @@ simple_game_t* simple_game_create(heap_t* heap, fs_t* fs, wm_window_t* window, r
 
 	game->timer = timer_object_create(heap, NULL);
 	
-	game->ecs = ecs_create(heap);
+	game->ecs = ecs_create(heap, k_ecs_storage_sparse);
 	game->transform_type = ecs_register_component_type(game->ecs, "transform", sizeof(transform_component_t), _Alignof(transform_component_t));
 	game->camera_type = ecs_register_component_type(game->ecs, "camera", sizeof(camera_component_t), _Alignof(camera_component_t));
 	game->model_type = ecs_register_component_type(game->ecs, "model", sizeof(model_component_t), _Alignof(model_component_t));
 	game->player_type = ecs_register_component_type(game->ecs, "player", sizeof(player_component_t), _Alignof(player_component_t));
 	game->name_type = ecs_register_component_type(game->ecs, "name", sizeof(name_component_t), _Alignof(name_component_t));
 
-	game->net = net_create(heap, game->ecs);
+	game->net = net_create(heap, game->ecs, NULL);
 	if (argc >= 2)
 	{
 		net_address_t server;
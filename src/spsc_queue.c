@@ -0,0 +1,217 @@
+#include "spsc_queue.h"
+
+#include "atomic.h"
+#include "heap.h"
+
+#include <immintrin.h>
+#include <stdlib.h>
+
+enum
+{
+	// Failed attempts before a blocking push or pop goes to sleep.
+	k_spsc_queue_spin_count = 64,
+
+	// Producer and consumer state are padded apart so they do not share a cache line.
+	k_spsc_queue_cache_line = 64,
+};
+
+typedef struct spsc_queue_t
+{
+	heap_t* heap;
+	void** items;
+	unsigned int mask;
+	unsigned int capacity;
+
+	char pad0[k_spsc_queue_cache_line];
+
+	// Written only by the producer.
+	// head_cache is the last head the producer read, only refreshed when the queue looks full.
+	int tail_index;
+	int head_cache;
+	char pad1[k_spsc_queue_cache_line - 2 * sizeof(int)];
+
+	// Written only by the consumer.
+	// tail_cache is the last tail the consumer read, only refreshed when the queue looks empty.
+	int head_index;
+	int tail_cache;
+	char pad2[k_spsc_queue_cache_line - 2 * sizeof(int)];
+
+	// Set by a side that is about to sleep on the other side's index.
+	int producer_waiting;
+	int consumer_waiting;
+	char pad3[k_spsc_queue_cache_line - 2 * sizeof(int)];
+} spsc_queue_t;
+
+spsc_queue_t* spsc_queue_create(heap_t* heap, int capacity)
+{
+	//Slots are a power of two so indices can wrap around 32 bits
+	unsigned int slot_count = 1;
+	while (slot_count < (unsigned int)capacity)
+	{
+		slot_count <<= 1;
+	}
+
+	spsc_queue_t* queue = heap_alloc(heap, sizeof(spsc_queue_t), k_spsc_queue_cache_line);
+	queue->items = heap_alloc(heap, sizeof(void*) * slot_count, k_spsc_queue_cache_line);
+	queue->heap = heap;
+	queue->mask = slot_count - 1;
+	queue->capacity = capacity;
+	queue->tail_index = 0;
+	queue->head_cache = 0;
+	queue->head_index = 0;
+	queue->tail_cache = 0;
+	queue->producer_waiting = 0;
+	queue->consumer_waiting = 0;
+	return queue;
+}
+
+void spsc_queue_destroy(spsc_queue_t* queue)
+{
+	heap_free(queue->heap, queue->items);
+	heap_free(queue->heap, queue);
+}
+
+int spsc_queue_try_push_n(spsc_queue_t* queue, void** items, int count)
+{
+	unsigned int tail = (unsigned int)queue->tail_index;
+	unsigned int free_count = queue->capacity - (tail - (unsigned int)queue->head_cache);
+	if (free_count < (unsigned int)count)
+	{
+		queue->head_cache = atomic_load(&queue->head_index);
+		free_count = queue->capacity - (tail - (unsigned int)queue->head_cache);
+	}
+	if (free_count == 0)
+	{
+		return 0;
+	}
+
+	unsigned int push_count = __min(free_count, (unsigned int)count);
+	for (unsigned int i = 0; i < push_count; ++i)
+	{
+		queue->items[(tail + i) & queue->mask] = items[i];
+	}
+
+	//Publishes the whole run at once
+	//A full barrier rather than a plain store, so the waiting flag below cannot be read early
+	atomic_exchange(&queue->tail_index, (int)(tail + push_count));
+	if (atomic_load(&queue->consumer_waiting))
+	{
+		atomic_wake_all(&queue->tail_index);
+	}
+	return (int)push_count;
+}
+
+int spsc_queue_try_pop_n(spsc_queue_t* queue, void** items, int max_count)
+{
+	unsigned int head = (unsigned int)queue->head_index;
+	unsigned int used_count = (unsigned int)queue->tail_cache - head;
+	if (used_count < (unsigned int)max_count)
+	{
+		queue->tail_cache = atomic_load(&queue->tail_index);
+		used_count = (unsigned int)queue->tail_cache - head;
+	}
+	if (used_count == 0)
+	{
+		return 0;
+	}
+
+	unsigned int pop_count = __min(used_count, (unsigned int)max_count);
+	for (unsigned int i = 0; i < pop_count; ++i)
+	{
+		items[i] = queue->items[(head + i) & queue->mask];
+	}
+
+	atomic_exchange(&queue->head_index, (int)(head + pop_count));
+	if (atomic_load(&queue->producer_waiting))
+	{
+		atomic_wake_all(&queue->head_index);
+	}
+	return (int)pop_count;
+}
+
+void spsc_queue_push_n(spsc_queue_t* queue, void** items, int count)
+{
+	while (count > 0)
+	{
+		int pushed = 0;
+		for (int i = 0; i < k_spsc_queue_spin_count && !pushed; ++i)
+		{
+			pushed = spsc_queue_try_push_n(queue, items, count);
+			if (!pushed)
+			{
+				_mm_pause();
+			}
+		}
+		if (!pushed)
+		{
+			//Raise the flag before the final attempt so a pop in between cannot be missed
+			int head = atomic_load(&queue->head_index);
+			atomic_exchange(&queue->producer_waiting, 1);
+			pushed = spsc_queue_try_push_n(queue, items, count);
+			if (!pushed)
+			{
+				atomic_wait(&queue->head_index, head);
+			}
+			atomic_store(&queue->producer_waiting, 0);
+		}
+		items += pushed;
+		count -= pushed;
+	}
+}
+
+int spsc_queue_pop_n(spsc_queue_t* queue, void** items, int max_count)
+{
+	for (;;)
+	{
+		for (int i = 0; i < k_spsc_queue_spin_count; ++i)
+		{
+			int popped = spsc_queue_try_pop_n(queue, items, max_count);
+			if (popped)
+			{
+				return popped;
+			}
+			_mm_pause();
+		}
+
+		//Raise the flag before the final attempt so a push in between cannot be missed
+		int tail = atomic_load(&queue->tail_index);
+		atomic_exchange(&queue->consumer_waiting, 1);
+		int popped = spsc_queue_try_pop_n(queue, items, max_count);
+		if (!popped)
+		{
+			atomic_wait(&queue->tail_index, tail);
+		}
+		atomic_store(&queue->consumer_waiting, 0);
+		if (popped)
+		{
+			return popped;
+		}
+	}
+}
+
+void spsc_queue_push(spsc_queue_t* queue, void* item)
+{
+	spsc_queue_push_n(queue, &item, 1);
+}
+
+bool spsc_queue_try_push(spsc_queue_t* queue, void* item)
+{
+	return spsc_queue_try_push_n(queue, &item, 1) == 1;
+}
+
+void* spsc_queue_pop(spsc_queue_t* queue)
+{
+	void* item;
+	spsc_queue_pop_n(queue, &item, 1);
+	return item;
+}
+
+void* spsc_queue_try_pop(spsc_queue_t* queue)
+{
+	void* item;
+	if (spsc_queue_try_pop_n(queue, &item, 1))
+	{
+		return item;
+	}
+	return NULL;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Single-producer, single-consumer queue container
+
+// Faster than queue_t when exactly one thread pushes and exactly one thread pops.
+// The producer and consumer indices live on separate cache lines, and each side
+// caches the other's index so most operations touch no shared memory at all.
+// Batched pushes publish any number of items with a single index update.
+
+// Handle to a single-producer, single-consumer queue.
+typedef struct spsc_queue_t spsc_queue_t;
+
+typedef struct heap_t heap_t;
+
+// Create a queue with the defined capacity.
+spsc_queue_t* spsc_queue_create(heap_t* heap, int capacity);
+
+// Destroy a previously created queue.
+void spsc_queue_destroy(spsc_queue_t* queue);
+
+// Push an item onto a queue.
+// If the queue is full, blocks until space is available.
+// Only one thread may push to a queue.
+void spsc_queue_push(spsc_queue_t* queue, void* item);
+
+// Push an item onto a queue if space is available.
+// If the queue is full, returns false.
+// Only one thread may push to a queue.
+bool spsc_queue_try_push(spsc_queue_t* queue, void* item);
+
+// Push count items onto a queue, in order.
+// Items are made visible to the consumer as large runs, a single run when they all fit.
+// Blocks until every item has been pushed.
+// Only one thread may push to a queue.
+void spsc_queue_push_n(spsc_queue_t* queue, void** items, int count);
+
+// Push as many of count items as fit, in order, as a single run.
+// Returns the number of items pushed, zero if the queue is full.
+// Only one thread may push to a queue.
+int spsc_queue_try_push_n(spsc_queue_t* queue, void** items, int count);
+
+// Pop an item off a queue (FIFO order).
+// If the queue is empty, blocks until an item is available.
+// Only one thread may pop from a queue.
+void* spsc_queue_pop(spsc_queue_t* queue);
+
+// Pop an item off a queue (FIFO order).
+// If the queue is empty, returns NULL.
+// Only one thread may pop from a queue.
+void* spsc_queue_try_pop(spsc_queue_t* queue);
+
+// Pop up to max_count items off a queue (FIFO order).
+// If the queue is empty, blocks until at least one item is available.
+// Returns the number of items popped.
+// Only one thread may pop from a queue.
+int spsc_queue_pop_n(spsc_queue_t* queue, void** items, int max_count);
+
+// Pop up to max_count items off a queue (FIFO order).
+// Returns the number of items popped, zero if the queue is empty.
+// Only one thread may pop from a queue.
+int spsc_queue_try_pop_n(spsc_queue_t* queue, void** items, int max_count);
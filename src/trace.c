@@ -1,141 +1,1049 @@
 #include "trace.h"
+
+#include "atomic.h"
 #include "debug.h"
+#include "fs.h"
+#include "heap.h"
+#include "mutex.h"
+#include "thread.h"
 #include "timer.h"
 
+#define LZ4F_STATIC_LINKING_ONLY
+#include "lz4/lz4frame.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
-#include <stddef.h>
-#include <windows.h> 
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+enum
+{
+	// Threads that can record events, each gets a ring on its first event.
+	k_trace_max_threads = 64,
+
+	// Nesting depth tracked per thread, durations nested deeper are dropped.
+	k_trace_max_depth = 64,
+
+	// Thread names kept, including those of threads that have since exited.
+	k_trace_max_thread_names = 256,
+
+	k_trace_max_path = 260,
+
+	// Recording and writing state are padded apart so they do not share a cache line.
+	k_trace_cache_line = 64,
+
+	// How often the writer drains the rings while capturing.
+	k_trace_drain_interval_ms = 5,
+
+	// Encoded events are handed to the file system in chunks of this size.
+	k_trace_chunk_size = 64 * 1024,
+	// Longest name written, longer names are truncated.
+	k_trace_max_name_length = 255,
+	// Room left in a chunk before encoding an event: a thread record, a string record and the event.
+	k_trace_max_record_size = 512,
+	// Chunks handed to the file system that may not have been written yet.
+	k_trace_max_pending_writes = 8,
+
+	k_trace_format_version = 1,
+
+	// The converter reads and writes files in pieces of about this size.
+	k_trace_convert_io_size = 1024 * 1024,
+};
+
+// Binary trace format.
+// A header of "GATR", then the format version, ticks per second and process id.
+// Then a stream of records, each starting with a tag byte:
+//  'T' tid: events that follow are on this thread.
+//  'S' id length bytes: a name, defined before the first event that uses it.
+//  'N' tid name: the name of a thread.
+//  Events are tagged with their Chrome phase and start with the ticks since the thread's
+//  previous event, or since the capture started:
+//  'B' ticks name, 'E' ticks, 'i' ticks name, 'C' ticks name zigzag-value, 's' and 'f' ticks name id.
+// Numbers are unsigned LEB128 varints. The whole file may be one LZ4 frame.
+static const char k_trace_magic[4] = { 'G', 'A', 'T', 'R' };
+
+typedef struct trace_event_t
+{
+	const char* name;
+	uint64_t ticks;
+	// Counter value or flow id.
+	int64_t value;
+	char phase;
+} trace_event_t;
+
+typedef struct trace_thread_name_t
+{
+	int tid;
+	const char* name;
+} trace_thread_name_t;
+
+// Single-producer, single-consumer ring: the owning thread records, the writer drains.
+typedef struct trace_thread_t
+{
+	trace_event_t* events;
+	unsigned int mask;
+	int tid;
+
+	char pad0[k_trace_cache_line];
+
+	// Written only by the owning thread.
+	int tail;
+	int capture;
+	int depth;
+	// Recorded durations that have not ended yet. Their ends always have room reserved.
+	int open_count;
+	// Bit n is set if the duration at depth n was dropped.
+	uint64_t dropped_depths;
+	char pad1[k_trace_cache_line - 4 * sizeof(int) - sizeof(uint64_t)];
+
+	// Written only by the writer.
+	int head;
+	uint64_t last_ticks;
+	char pad2[k_trace_cache_line - sizeof(int) - sizeof(uint64_t)];
+} trace_thread_t;
+
+typedef struct trace_t
+{
+	heap_t* heap;
+	int event_capacity;
+	int pid;
+
+	// Thread local slot holding the calling thread's trace_thread_t.
+	DWORD thread_tls_index;
+	trace_thread_t* threads[k_trace_max_threads];
+	int thread_count;
+	// Serializes adding threads and thread names.
+	mutex_t* mutex;
+
+	trace_thread_name_t thread_names[k_trace_max_thread_names];
+	int thread_name_count;
+
+	int capturing;
+	// Incremented by every capture start, so threads can tell stale state apart.
+	int capture;
+	uint64_t capture_start_ticks;
+	int next_flow_id;
+
+	fs_t* fs;
+	char file_path[k_trace_max_path];
+	bool use_compression;
+	thread_t* writer;
+
+	// Everything below is only touched by the writer.
+	char* chunk;
+	size_t chunk_size;
+	LZ4F_cctx* lz4;
+	bool lz4_begun;
+	bool file_created;
+	trace_thread_t* current_thread;
+	int thread_names_written;
+
+	// Open addressed table of names already written, by pointer.
+	const char** string_keys;
+	int* string_ids;
+	int string_capacity;
+	int string_count;
+
+	// Writes are done in order, so the oldest is always first to finish.
+	fs_work_t* pending_works[k_trace_max_pending_writes];
+	void* pending_buffers[k_trace_max_pending_writes];
+	int pending_count;
+} trace_t;
+
+static const LZ4F_preferences_t k_trace_lz4_preferences =
+{
+	.frameInfo = { .blockSizeID = LZ4F_max64KB },
+	// Each chunk becomes its own block, so nothing is buffered inside lz4.
+	.autoFlush = 1,
+};
 
-// Creates a CPU performance tracing system.
-// Event capacity is the maximum number of durations that can be traced.
 trace_t* trace_create(heap_t* heap, int event_capacity)
 {
 	trace_t* trace = heap_alloc(heap, sizeof(trace_t), 8);
+	memset(trace, 0, sizeof(*trace));
 	trace->heap = heap;
-	trace->trace_queues_count = 100;
-	trace->trace_queues_index = 0;
-	trace->trace_queues = heap_alloc(heap, sizeof(queue_t*)*100, 8); //this
-	trace->tids = heap_alloc(heap, sizeof(int) * trace->trace_queues_count, 8);
-	trace->pids = heap_alloc(heap, sizeof(int) * trace->trace_queues_count, 8);
 	trace->event_capacity = event_capacity;
-	trace->capture_count = 0;
-	trace->buffer = heap_alloc(heap, sizeof(char)*4500, 8);
-	sprintf(trace->buffer, "{\n\t\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
-	trace->capturing = false;
-	trace->first_event = true;
+	trace->pid = GetCurrentProcessId();
+	trace->thread_tls_index = TlsAlloc();
+	trace->mutex = mutex_create();
 	return trace;
 }
 
-// Destroys a CPU performance tracing system.
 void trace_destroy(trace_t* trace)
 {
-	int i = 0;
-	while (i < trace->trace_queues_index) {
-		queue_push(trace->trace_queues[i], NULL);
-		queue_destroy(trace->trace_queues[i]);
-		i++;
+	trace_capture_stop(trace);
+	for (int i = 0; i < trace->thread_count; ++i)
+	{
+		heap_free(trace->heap, trace->threads[i]->events);
+		heap_free(trace->heap, trace->threads[i]);
 	}
-	heap_free(trace->heap, trace->pids);
-	heap_free(trace->heap, trace->tids);
-	heap_free(trace->heap, trace->trace_queues);
-	heap_free(trace->heap, trace->buffer);
+	mutex_destroy(trace->mutex);
+	TlsFree(trace->thread_tls_index);
 	heap_free(trace->heap, trace);
 }
 
-// Begin tracing a named duration on the current thread.
-// It is okay to nest multiple durations at once.
+static trace_thread_t* trace_add_thread(trace_t* trace)
+{
+	//Room for a begin and an end per duration
+	unsigned int slot_count = 1;
+	while (slot_count < 2u * (unsigned int)trace->event_capacity)
+	{
+		slot_count <<= 1;
+	}
+
+	mutex_lock(trace->mutex);
+	trace_thread_t* thread = NULL;
+	if (trace->thread_count < k_trace_max_threads)
+	{
+		thread = heap_alloc(trace->heap, sizeof(trace_thread_t), k_trace_cache_line);
+		memset(thread, 0, sizeof(*thread));
+		thread->events = heap_alloc(trace->heap, sizeof(trace_event_t) * slot_count, k_trace_cache_line);
+		thread->mask = slot_count - 1;
+		thread->tid = GetCurrentThreadId();
+		thread->capture = trace->capture;
+		thread->last_ticks = trace->capture_start_ticks;
+
+		//The writer reads the count, so the thread must be complete before it is published
+		trace->threads[trace->thread_count] = thread;
+		atomic_store(&trace->thread_count, trace->thread_count + 1);
+	}
+	else
+	{
+		debug_print(k_print_warning, "Out of trace threads.\n");
+	}
+	mutex_unlock(trace->mutex);
+
+	TlsSetValue(trace->thread_tls_index, thread);
+	return thread;
+}
+
+//Returns the calling thread's ring, reset if it still holds state from an earlier capture
+static trace_thread_t* trace_get_thread(trace_t* trace)
+{
+	trace_thread_t* thread = TlsGetValue(trace->thread_tls_index);
+	if (!thread)
+	{
+		thread = trace_add_thread(trace);
+		if (!thread)
+		{
+			return NULL;
+		}
+	}
+
+	int capture = atomic_load(&trace->capture);
+	if (thread->capture != capture)
+	{
+		thread->capture = capture;
+		thread->depth = 0;
+		thread->open_count = 0;
+		thread->dropped_depths = 0;
+	}
+	return thread;
+}
+
+static void trace_thread_record(trace_thread_t* thread, char phase, const char* name, int64_t value)
+{
+	unsigned int tail = (unsigned int)thread->tail;
+	trace_event_t* event = &thread->events[tail & thread->mask];
+	event->name = name;
+	event->ticks = timer_get_ticks();
+	event->value = value;
+	event->phase = phase;
+	atomic_store(&thread->tail, (int)(tail + 1));
+}
+
+//Records an event that is not part of a duration, returns false if it was dropped
+static bool trace_record(trace_t* trace, char phase, const char* name, int64_t value)
+{
+	if (!trace || !atomic_load(&trace->capturing))
+	{
+		return false;
+	}
+	trace_thread_t* thread = trace_get_thread(trace);
+	if (!thread)
+	{
+		return false;
+	}
+
+	//Never use the room reserved for the ends of open durations
+	unsigned int used = (unsigned int)thread->tail - (unsigned int)atomic_load(&thread->head);
+	if (used + thread->open_count + 1 > thread->mask + 1)
+	{
+		return false;
+	}
+	trace_thread_record(thread, phase, name, value);
+	return true;
+}
+
 void trace_duration_push(trace_t* trace, const char* name)
 {
-	if (trace->capturing) {
-		if (trace->trace_queues_count < trace->trace_queues_index) {
-			debug_print(
-				k_print_error,
-				"OUT OF TRACE QUEUES!\n");
-			return;
+	if (!trace || !atomic_load(&trace->capturing))
+	{
+		return;
+	}
+	trace_thread_t* thread = trace_get_thread(trace);
+	if (!thread)
+	{
+		return;
+	}
+
+	int depth = thread->depth++;
+	if (depth >= k_trace_max_depth)
+	{
+		return;
+	}
+
+	//A begin needs room for itself and its end, on top of the ends already reserved
+	unsigned int used = (unsigned int)thread->tail - (unsigned int)atomic_load(&thread->head);
+	if (used + thread->open_count + 2 > thread->mask + 1)
+	{
+		thread->dropped_depths |= 1ULL << depth;
+		return;
+	}
+	thread->dropped_depths &= ~(1ULL << depth);
+	thread->open_count++;
+	trace_thread_record(thread, 'B', name, 0);
+}
+
+void trace_duration_pop(trace_t* trace)
+{
+	if (!trace || !atomic_load(&trace->capturing))
+	{
+		return;
+	}
+	trace_thread_t* thread = trace_get_thread(trace);
+	if (!thread || thread->depth == 0)
+	{
+		//The duration began before this capture started
+		return;
+	}
+
+	int depth = --thread->depth;
+	if (depth >= k_trace_max_depth || (thread->dropped_depths & (1ULL << depth)))
+	{
+		return;
+	}
+	thread->open_count--;
+	trace_thread_record(thread, 'E', NULL, 0);
+}
+
+void trace_counter(trace_t* trace, const char* name, int64_t value)
+{
+	trace_record(trace, 'C', name, value);
+}
+
+void trace_instant(trace_t* trace, const char* name)
+{
+	trace_record(trace, 'i', name, 0);
+}
+
+int trace_flow_begin(trace_t* trace, const char* name)
+{
+	if (!trace || !atomic_load(&trace->capturing))
+	{
+		return 0;
+	}
+	int id = atomic_increment(&trace->next_flow_id) + 1;
+	return trace_record(trace, 's', name, id) ? id : 0;
+}
+
+void trace_flow_end(trace_t* trace, const char* name, int id)
+{
+	if (id)
+	{
+		trace_record(trace, 'f', name, id);
+	}
+}
+
+void trace_thread_name(trace_t* trace, const char* name)
+{
+	if (!trace)
+	{
+		return;
+	}
+
+	mutex_lock(trace->mutex);
+	if (trace->thread_name_count < k_trace_max_thread_names)
+	{
+		trace->thread_names[trace->thread_name_count] = (trace_thread_name_t){ GetCurrentThreadId(), name };
+		atomic_store(&trace->thread_name_count, trace->thread_name_count + 1);
+	}
+	mutex_unlock(trace->mutex);
+}
+
+static void* trace_lz4_alloc(void* user, size_t size)
+{
+	return heap_alloc(user, size, 8);
+}
+
+static void trace_lz4_free(void* user, void* address)
+{
+	heap_free(user, address);
+}
+
+static LZ4F_CustomMem trace_lz4_memory(heap_t* heap)
+{
+	LZ4F_CustomMem memory = { trace_lz4_alloc, NULL, trace_lz4_free, heap };
+	return memory;
+}
+
+static void trace_put_byte(trace_t* trace, uint8_t value)
+{
+	trace->chunk[trace->chunk_size++] = (char)value;
+}
+
+static void trace_put_varint(trace_t* trace, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		trace_put_byte(trace, (uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	trace_put_byte(trace, (uint8_t)value);
+}
+
+static void trace_wait_oldest_write(trace_t* trace)
+{
+	fs_work_t* work = trace->pending_works[0];
+	if (fs_work_get_result(work) != 0)
+	{
+		debug_print(k_print_error, "Failed to write trace to %s.\n", trace->file_path);
+	}
+	fs_work_destroy(work);
+	heap_free(trace->heap, trace->pending_buffers[0]);
+
+	--trace->pending_count;
+	memmove(trace->pending_works, trace->pending_works + 1, sizeof(fs_work_t*) * trace->pending_count);
+	memmove(trace->pending_buffers, trace->pending_buffers + 1, sizeof(void*) * trace->pending_count);
+}
+
+//Hands the chunk to the file system, through lz4 when compressing
+static void trace_flush_chunk(trace_t* trace, bool end)
+{
+	void* buffer = trace->chunk;
+	size_t size = trace->chunk_size;
+	if (trace->use_compression)
+	{
+		size_t capacity = LZ4F_HEADER_SIZE_MAX +
+			LZ4F_compressBound(trace->chunk_size, &k_trace_lz4_preferences) +
+			LZ4F_compressBound(0, &k_trace_lz4_preferences);
+		buffer = heap_alloc(trace->heap, capacity, 8);
+		size = 0;
+
+		size_t result = 0;
+		if (!trace->lz4_begun)
+		{
+			result = LZ4F_compressBegin(trace->lz4, buffer, capacity, &k_trace_lz4_preferences);
+			size += LZ4F_isError(result) ? 0 : result;
+			trace->lz4_begun = true;
 		}
-		mutex_lock(trace->mutex);
-		//better implementation is to allocate a lot of events at the start of the program in a single big structure, then use a event_tail to keep track of how many events are left
-		//have a warning if the game gets past the max_size of events that was allocated so that it is known when that limit is reached and it can be asked why
-		event_t* new_event = heap_alloc(trace->heap, sizeof(event_t), 8);
-		new_event->name = name;
-		new_event->pid = GetCurrentProcessId();
-		new_event->tid = GetCurrentThreadId();
-		new_event->start_time = timer_ticks_to_ms(timer_get_ticks());
-		if (trace->first_event) {
-			sprintf((char*)trace->buffer + strlen((char*)trace->buffer), "\t\t{\"name\":\"%s\",\"ph\":\"%s\",\"pid\":%d,\"tid\":\"%d\",\"ts\":\"%ld\"}",
-				new_event->name, "B", new_event->pid, new_event->tid, new_event->start_time);
-			trace->first_event = false;
-		}
-		else {
-			sprintf((char*)trace->buffer + strlen((char*)trace->buffer), ",\n\t\t{\"name\":\"%s\",\"ph\":\"%s\",\"pid\":%d,\"tid\":\"%d\",\"ts\":\"%ld\"}",
-				new_event->name, "B", new_event->pid, new_event->tid, new_event->start_time);
-		}
-		int i = 0;
-		while (i <= trace->trace_queues_index) {
-			if (i == trace->trace_queues_index) {
-				trace->trace_queues[i] = queue_create(trace->heap, trace->event_capacity);
-				trace->tids[i] = new_event->tid;
-				trace->pids[i] = new_event->pid;
-				queue_push(trace->trace_queues[i], new_event);
-				trace->trace_queues_index++;
-				break;
-			}
-			else if (trace->tids[i] == new_event->tid) {
-				if (trace->pids[i] == new_event->pid) {
-					queue_push(trace->trace_queues[i], new_event);
-					break;
-				}
-			}
+		if (!LZ4F_isError(result) && trace->chunk_size)
+		{
+			result = LZ4F_compressUpdate(trace->lz4, (char*)buffer + size, capacity - size, trace->chunk, trace->chunk_size, NULL);
+			size += LZ4F_isError(result) ? 0 : result;
 		}
-		mutex_unlock(trace->mutex);
+		if (!LZ4F_isError(result) && end)
+		{
+			result = LZ4F_compressEnd(trace->lz4, (char*)buffer + size, capacity - size, NULL);
+			size += LZ4F_isError(result) ? 0 : result;
+		}
+		if (LZ4F_isError(result))
+		{
+			debug_print(k_print_error, "Failed to compress trace: %s\n", LZ4F_getErrorName(result));
+		}
+		trace->chunk_size = 0;
+	}
+	else
+	{
+		//The chunk itself is written, encoding continues in a new one
+		trace->chunk = heap_alloc(trace->heap, k_trace_chunk_size, 8);
+		trace->chunk_size = 0;
+	}
+
+	if (!size)
+	{
+		heap_free(trace->heap, buffer);
+		return;
+	}
+
+	//Reap what is already written, then make room if every write is still in flight
+	while (trace->pending_count && fs_work_is_done(trace->pending_works[0]))
+	{
+		trace_wait_oldest_write(trace);
+	}
+	if (trace->pending_count == k_trace_max_pending_writes)
+	{
+		trace_wait_oldest_write(trace);
 	}
+
+	//The first write creates the file, the rest are appended in order
+	fs_work_t* work = trace->file_created ?
+		fs_append(trace->fs, trace->file_path, buffer, size) :
+		fs_write(trace->fs, trace->file_path, buffer, size, false);
+	trace->file_created = true;
+	trace->pending_works[trace->pending_count] = work;
+	trace->pending_buffers[trace->pending_count] = buffer;
+	trace->pending_count++;
 }
 
-// End tracing the currently active duration on the current thread.
-void trace_duration_pop(trace_t* trace)
+static unsigned int trace_hash_name(const char* name)
 {
-	if (trace->capturing) {
-		if (trace->capture_count < trace->event_capacity) {
-			mutex_lock(trace->mutex);
-			event_t* event_popped = NULL;
-			int i = 0;
-			while (i < trace->trace_queues_index) {
-				if (trace->tids[i] == GetCurrentThreadId()) {
-					if (trace->pids[i] == GetCurrentProcessId()) {
-						event_popped = queue_pop(trace->trace_queues[i]);
-						break;
-					}
-				}
+	return (unsigned int)((uintptr_t)name >> 3) * 2654435761u;
+}
+
+static void trace_grow_strings(trace_t* trace)
+{
+	int old_capacity = trace->string_capacity;
+	const char** old_keys = trace->string_keys;
+	int* old_ids = trace->string_ids;
+
+	trace->string_capacity = __max(old_capacity * 2, 256);
+	trace->string_keys = heap_alloc(trace->heap, sizeof(const char*) * trace->string_capacity, 8);
+	trace->string_ids = heap_alloc(trace->heap, sizeof(int) * trace->string_capacity, 8);
+	memset(trace->string_keys, 0, sizeof(const char*) * trace->string_capacity);
+	for (int i = 0; i < old_capacity; ++i)
+	{
+		if (old_keys[i])
+		{
+			unsigned int slot = trace_hash_name(old_keys[i]) & (trace->string_capacity - 1);
+			while (trace->string_keys[slot])
+			{
+				slot = (slot + 1) & (trace->string_capacity - 1);
 			}
-			event_popped->end_time = timer_ticks_to_ms(timer_get_ticks());
-			sprintf((char*)trace->buffer + strlen((char*)trace->buffer), ",\n\t\t{\"name\":\"%s\",\"ph\":\"%s\",\"pid\":%d,\"tid\":\"%d\",\"ts\":\"%ld\"}",
-				event_popped->name, "E", event_popped->pid, event_popped->tid, event_popped->end_time);
-			heap_free(trace->heap, event_popped);
-			trace->capture_count++;
-			mutex_unlock(trace->mutex);
+			trace->string_keys[slot] = old_keys[i];
+			trace->string_ids[slot] = old_ids[i];
+		}
+	}
+	heap_free(trace->heap, old_keys);
+	heap_free(trace->heap, old_ids);
+}
+
+//Returns the id of a name, writing it to the stream the first time it is seen
+static int trace_intern(trace_t* trace, const char* name)
+{
+	if (trace->string_count * 2 >= trace->string_capacity)
+	{
+		trace_grow_strings(trace);
+	}
+
+	unsigned int slot = trace_hash_name(name) & (trace->string_capacity - 1);
+	while (trace->string_keys[slot])
+	{
+		if (trace->string_keys[slot] == name)
+		{
+			return trace->string_ids[slot];
+		}
+		slot = (slot + 1) & (trace->string_capacity - 1);
+	}
+
+	int id = trace->string_count++;
+	trace->string_keys[slot] = name;
+	trace->string_ids[slot] = id;
+
+	size_t length = strnlen(name, k_trace_max_name_length);
+	trace_put_byte(trace, 'S');
+	trace_put_varint(trace, id);
+	trace_put_varint(trace, length);
+	memcpy(trace->chunk + trace->chunk_size, name, length);
+	trace->chunk_size += length;
+	return id;
+}
+
+static void trace_encode_event(trace_t* trace, trace_thread_t* thread, const trace_event_t* event)
+{
+	if (trace->chunk_size + k_trace_max_record_size > k_trace_chunk_size)
+	{
+		trace_flush_chunk(trace, false);
+	}
+
+	if (trace->current_thread != thread)
+	{
+		trace_put_byte(trace, 'T');
+		trace_put_varint(trace, thread->tid);
+		trace->current_thread = thread;
+	}
+	int name_id = event->phase != 'E' ? trace_intern(trace, event->name) : 0;
+
+	uint64_t delta = event->ticks > thread->last_ticks ? event->ticks - thread->last_ticks : 0;
+	thread->last_ticks = event->ticks;
+
+	trace_put_byte(trace, event->phase);
+	trace_put_varint(trace, delta);
+	if (event->phase != 'E')
+	{
+		trace_put_varint(trace, name_id);
+	}
+	if (event->phase == 'C')
+	{
+		trace_put_varint(trace, ((uint64_t)event->value << 1) ^ (uint64_t)(event->value >> 63));
+	}
+	else if (event->phase == 's' || event->phase == 'f')
+	{
+		trace_put_varint(trace, (uint64_t)event->value);
+	}
+}
+
+static void trace_encode_thread_names(trace_t* trace)
+{
+	int name_count = atomic_load(&trace->thread_name_count);
+	for (; trace->thread_names_written < name_count; ++trace->thread_names_written)
+	{
+		if (trace->chunk_size + k_trace_max_record_size > k_trace_chunk_size)
+		{
+			trace_flush_chunk(trace, false);
+		}
+		trace_thread_name_t* thread_name = &trace->thread_names[trace->thread_names_written];
+		int name_id = trace_intern(trace, thread_name->name);
+		trace_put_byte(trace, 'N');
+		trace_put_varint(trace, thread_name->tid);
+		trace_put_varint(trace, name_id);
+	}
+}
+
+static void trace_drain(trace_t* trace)
+{
+	trace_encode_thread_names(trace);
+
+	int thread_count = atomic_load(&trace->thread_count);
+	for (int i = 0; i < thread_count; ++i)
+	{
+		trace_thread_t* thread = trace->threads[i];
+		unsigned int head = (unsigned int)thread->head;
+		unsigned int tail = (unsigned int)atomic_load(&thread->tail);
+		for (; head != tail; ++head)
+		{
+			trace_encode_event(trace, thread, &thread->events[head & thread->mask]);
 		}
+		//Slots are only handed back once their events are encoded
+		atomic_store(&thread->head, (int)head);
 	}
 }
 
-// Start recording trace events.
-// A Chrome trace file will be written to path.
-void trace_capture_start(trace_t* trace, const char* path)
+static int trace_writer_func(void* user)
 {
-	trace->file_path = path;
-	trace->capturing = true;
+	trace_t* trace = user;
+
+	trace->chunk = heap_alloc(trace->heap, k_trace_chunk_size, 8);
+	trace->chunk_size = 0;
+	trace->lz4 = NULL;
+	trace->lz4_begun = false;
+	trace->file_created = false;
+	trace->current_thread = NULL;
+	trace->thread_names_written = 0;
+	if (trace->use_compression)
+	{
+		trace->lz4 = LZ4F_createCompressionContext_advanced(trace_lz4_memory(trace->heap), LZ4F_VERSION);
+		if (!trace->lz4)
+		{
+			debug_print(k_print_warning, "Failed to create trace compression context, writing uncompressed.\n");
+			trace->use_compression = false;
+		}
+	}
+
+	memcpy(trace->chunk, k_trace_magic, sizeof(k_trace_magic));
+	trace->chunk_size = sizeof(k_trace_magic);
+	trace_put_varint(trace, k_trace_format_version);
+	trace_put_varint(trace, timer_get_ticks_per_second());
+	trace_put_varint(trace, trace->pid);
+
+	while (atomic_load(&trace->capturing))
+	{
+		trace_drain(trace);
+		thread_sleep(k_trace_drain_interval_ms);
+	}
+	trace_drain(trace);
+	trace_flush_chunk(trace, true);
+
+	while (trace->pending_count)
+	{
+		trace_wait_oldest_write(trace);
+	}
+
+	heap_free(trace->heap, trace->chunk);
+	trace->chunk = NULL;
+	if (trace->lz4)
+	{
+		LZ4F_freeCompressionContext(trace->lz4);
+		trace->lz4 = NULL;
+	}
+	heap_free(trace->heap, trace->string_keys);
+	heap_free(trace->heap, trace->string_ids);
+	trace->string_keys = NULL;
+	trace->string_ids = NULL;
+	trace->string_capacity = 0;
+	trace->string_count = 0;
+
+	heap_thread_cache_flush(trace->heap);
+	return 0;
+}
+
+void trace_capture_start(trace_t* trace, fs_t* fs, const char* path, bool use_compression)
+{
+	if (atomic_load(&trace->capturing))
+	{
+		return;
+	}
+
+	//Events recorded after the previous capture stopped are left over, skip them
+	trace->capture_start_ticks = timer_get_ticks();
+	int thread_count = atomic_load(&trace->thread_count);
+	for (int i = 0; i < thread_count; ++i)
+	{
+		atomic_store(&trace->threads[i]->head, atomic_load(&trace->threads[i]->tail));
+		trace->threads[i]->last_ticks = trace->capture_start_ticks;
+	}
+
+	trace->fs = fs;
+	strcpy_s(trace->file_path, sizeof(trace->file_path), path);
+	trace->use_compression = use_compression;
+	atomic_increment(&trace->capture);
+	atomic_store(&trace->capturing, 1);
+	trace->writer = thread_create(trace_writer_func, trace);
 }
 
-// Stop recording trace events.
 void trace_capture_stop(trace_t* trace)
 {
-	trace->capturing = false;
+	if (!atomic_exchange(&trace->capturing, 0))
+	{
+		return;
+	}
+	thread_destroy(trace->writer);
+	trace->writer = NULL;
+}
 
-	sprintf((char*)trace->buffer + strlen((char*)trace->buffer), "\n\t]\n}");
+typedef struct trace_buffer_t
+{
+	heap_t* heap;
+	char* data;
+	size_t size;
+	size_t capacity;
+} trace_buffer_t;
 
-	FILE* fp = fopen("homework3_output.json", "w");
+static void trace_buffer_reserve(trace_buffer_t* buffer, size_t size)
+{
+	if (buffer->size + size <= buffer->capacity)
+	{
+		return;
+	}
+	size_t new_capacity = __max(buffer->capacity * 2, buffer->size + size);
+	char* new_data = heap_alloc(buffer->heap, new_capacity, 8);
+	memcpy(new_data, buffer->data, buffer->size);
+	heap_free(buffer->heap, buffer->data);
+	buffer->data = new_data;
+	buffer->capacity = new_capacity;
+}
 
-	fputs(trace->buffer, fp);
-	fputs("\n", fp);
+static void trace_buffer_append(trace_buffer_t* buffer, const char* format, ...)
+{
+	va_list args;
+	for (;;)
+	{
+		va_start(args, format);
+		size_t available = buffer->capacity - buffer->size;
+		int length = vsnprintf(buffer->data + buffer->size, available, format, args);
+		va_end(args);
+		if (length >= 0 && (size_t)length < available)
+		{
+			buffer->size += length;
+			return;
+		}
+		trace_buffer_reserve(buffer, __max((size_t)length + 1, 4096));
+	}
+}
+
+static bool trace_read_varint(const uint8_t** data, const uint8_t* end, uint64_t* value)
+{
+	*value = 0;
+	for (int shift = 0; *data < end && shift < 64; shift += 7)
+	{
+		uint8_t byte = *(*data)++;
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool trace_read_file(const char* path, trace_buffer_t* buffer)
+{
+	FILE* file = NULL;
+	if (fopen_s(&file, path, "rb") != 0 || !file)
+	{
+		return false;
+	}
+	size_t read_size;
+	do
+	{
+		trace_buffer_reserve(buffer, k_trace_convert_io_size);
+		read_size = fread(buffer->data + buffer->size, 1, buffer->capacity - buffer->size, file);
+		buffer->size += read_size;
+	} while (read_size);
+	fclose(file);
+	return true;
+}
+
+static bool trace_decompress(heap_t* heap, const trace_buffer_t* compressed, trace_buffer_t* buffer)
+{
+	LZ4F_dctx* lz4 = LZ4F_createDecompressionContext_advanced(trace_lz4_memory(heap), LZ4F_VERSION);
+	if (!lz4)
+	{
+		return false;
+	}
+
+	size_t offset = 0;
+	size_t result = 1;
+	while (offset < compressed->size && result != 0)
+	{
+		trace_buffer_reserve(buffer, k_trace_convert_io_size);
+		size_t src_size = compressed->size - offset;
+		size_t dst_size = buffer->capacity - buffer->size;
+		result = LZ4F_decompress(lz4, buffer->data + buffer->size, &dst_size, compressed->data + offset, &src_size, NULL);
+		if (LZ4F_isError(result))
+		{
+			debug_print(k_print_error, "Failed to decompress trace: %s\n", LZ4F_getErrorName(result));
+			break;
+		}
+		offset += src_size;
+		buffer->size += dst_size;
+	}
+	LZ4F_freeDecompressionContext(lz4);
+	return !LZ4F_isError(result);
+}
+
+// A name, escaped for JSON, at offset in the converter's buffer of names.
+typedef struct trace_convert_string_t
+{
+	size_t offset;
+	int length;
+} trace_convert_string_t;
+
+typedef struct trace_convert_thread_t
+{
+	int tid;
+	uint64_t ticks;
+} trace_convert_thread_t;
+
+static trace_convert_thread_t* trace_convert_get_thread(trace_convert_thread_t* threads, int* thread_count, int tid)
+{
+	for (int i = 0; i < *thread_count; ++i)
+	{
+		if (threads[i].tid == tid)
+		{
+			return &threads[i];
+		}
+	}
+	if (*thread_count == k_trace_max_threads)
+	{
+		return NULL;
+	}
+	threads[*thread_count] = (trace_convert_thread_t){ .tid = tid };
+	return &threads[(*thread_count)++];
+}
+
+//Decodes records into JSON, writing it to file whenever enough has built up
+static void trace_buffer_append_escaped(trace_buffer_t* buffer, const char* data, size_t length)
+{
+	//Worst case is every character written as a \u escape
+	trace_buffer_reserve(buffer, length * 6 + 1);
+	for (size_t i = 0; i < length; ++i)
+	{
+		unsigned char c = (unsigned char)data[i];
+		if (c == '"' || c == '\\')
+		{
+			buffer->data[buffer->size++] = '\\';
+			buffer->data[buffer->size++] = (char)c;
+		}
+		else if (c < 0x20)
+		{
+			buffer->size += snprintf(buffer->data + buffer->size, buffer->capacity - buffer->size, "\\u%04x", c);
+		}
+		else
+		{
+			buffer->data[buffer->size++] = (char)c;
+		}
+	}
+}
+
+static bool trace_convert_records(heap_t* heap, const uint8_t* data, const uint8_t* end, FILE* file)
+{
+	uint64_t version = 0;
+	uint64_t ticks_per_second = 0;
+	uint64_t pid = 0;
+	if (end - data < (ptrdiff_t)sizeof(k_trace_magic) || memcmp(data, k_trace_magic, sizeof(k_trace_magic)) != 0)
+	{
+		debug_print(k_print_error, "Not a trace file.\n");
+		return false;
+	}
+	data += sizeof(k_trace_magic);
+	if (!trace_read_varint(&data, end, &version) ||
+		!trace_read_varint(&data, end, &ticks_per_second) ||
+		!trace_read_varint(&data, end, &pid) ||
+		version != k_trace_format_version || ticks_per_second == 0)
+	{
+		debug_print(k_print_error, "Unsupported trace file version.\n");
+		return false;
+	}
+	double us_per_tick = 1000000.0 / (double)ticks_per_second;
+
+	trace_buffer_t json = { .heap = heap };
+	trace_buffer_t names = { .heap = heap };
+	trace_convert_string_t* strings = NULL;
+	int string_count = 0;
+	int string_capacity = 0;
+	trace_convert_thread_t threads[k_trace_max_threads];
+	int thread_count = 0;
+	trace_convert_thread_t* thread = NULL;
+	bool first_event = true;
+	bool valid = true;
+
+	trace_buffer_append(&json, "{\n\t\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+	while (valid && data < end)
+	{
+		char tag = (char)*data++;
+		uint64_t values[3] = { 0 };
+		if (tag == 'T')
+		{
+			valid = trace_read_varint(&data, end, &values[0]);
+			thread = valid ? trace_convert_get_thread(threads, &thread_count, (int)values[0]) : NULL;
+			valid = thread != NULL;
+			continue;
+		}
+		if (tag == 'N')
+		{
+			valid = trace_read_varint(&data, end, &values[0]) && trace_read_varint(&data, end, &values[1]) &&
+				values[1] < (uint64_t)string_count;
+			if (valid)
+			{
+				trace_convert_string_t* name = &strings[values[1]];
+				trace_buffer_append(&json, "%s\t\t{\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"%.*s\"}}",
+					first_event ? "" : ",\n", (int)pid, (int)values[0], name->length, names.data + name->offset);
+				first_event = false;
+			}
+			continue;
+		}
+		if (tag == 'S')
+		{
+			valid = trace_read_varint(&data, end, &values[0]) && trace_read_varint(&data, end, &values[1]) &&
+				values[0] == (uint64_t)string_count && values[1] <= (uint64_t)(end - data);
+			if (valid)
+			{
+				if (string_count == string_capacity)
+				{
+					string_capacity = __max(string_capacity * 2, 256);
+					trace_convert_string_t* new_strings = heap_alloc(heap, sizeof(trace_convert_string_t) * string_capacity, 8);
+					memcpy(new_strings, strings, sizeof(trace_convert_string_t) * string_count);
+					heap_free(heap, strings);
+					strings = new_strings;
+				}
+				size_t offset = names.size;
+				trace_buffer_append_escaped(&names, (const char*)data, (size_t)values[1]);
+				strings[string_count++] = (trace_convert_string_t){ offset, (int)(names.size - offset) };
+				data += values[1];
+			}
+			continue;
+		}
+
+		//Events: ticks, then a name unless it is an end, then a value for counters and flows
+		valid = thread && (tag == 'B' || tag == 'E' || tag == 'C' || tag == 'i' || tag == 's' || tag == 'f');
+		int value_count = tag == 'E' ? 1 : (tag == 'C' || tag == 's' || tag == 'f') ? 3 : 2;
+		for (int i = 0; valid && i < value_count; ++i)
+		{
+			valid = trace_read_varint(&data, end, &values[i]);
+		}
+		if (!valid || (tag != 'E' && values[1] >= (uint64_t)string_count))
+		{
+			valid = false;
+			break;
+		}
+
+		thread->ticks += values[0];
+		trace_buffer_append(&json, "%s\t\t{\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f",
+			first_event ? "" : ",\n", tag, (int)pid, thread->tid, (double)thread->ticks * us_per_tick);
+		first_event = false;
+
+		trace_convert_string_t* name = tag != 'E' ? &strings[values[1]] : NULL;
+		const char* name_data = name ? names.data + name->offset : NULL;
+		switch (tag)
+		{
+		case 'B':
+			trace_buffer_append(&json, ",\"name\":\"%.*s\"}", name->length, name_data);
+			break;
+		case 'E':
+			trace_buffer_append(&json, "}");
+			break;
+		case 'C':
+			trace_buffer_append(&json, ",\"name\":\"%.*s\",\"args\":{\"value\":%lld}}", name->length, name_data,
+				(long long)((values[2] >> 1) ^ (0 - (values[2] & 1))));
+			break;
+		case 'i':
+			trace_buffer_append(&json, ",\"name\":\"%.*s\",\"s\":\"t\"}", name->length, name_data);
+			break;
+		case 's':
+			trace_buffer_append(&json, ",\"name\":\"%.*s\",\"cat\":\"flow\",\"id\":%llu}", name->length, name_data,
+				(unsigned long long)values[2]);
+			break;
+		case 'f':
+			//Bind to the enclosing duration rather than the next one to begin
+			trace_buffer_append(&json, ",\"name\":\"%.*s\",\"cat\":\"flow\",\"id\":%llu,\"bp\":\"e\"}", name->length, name_data,
+				(unsigned long long)values[2]);
+			break;
+		}
+
+		if (json.size >= k_trace_convert_io_size)
+		{
+			fwrite(json.data, 1, json.size, file);
+			json.size = 0;
+		}
+	}
+	trace_buffer_append(&json, "\n\t]\n}\n");
+	fwrite(json.data, 1, json.size, file);
+
+	heap_free(heap, json.data);
+	heap_free(heap, names.data);
+	heap_free(heap, strings);
+	if (!valid)
+	{
+		debug_print(k_print_error, "Trace file is corrupt, converted up to the first bad record.\n");
+	}
+	return valid;
+}
+
+bool trace_convert(heap_t* heap, const char* binary_path, const char* json_path)
+{
+	trace_buffer_t input = { .heap = heap };
+	trace_buffer_t decompressed = { .heap = heap };
+	bool result = false;
+
+	//Compressed traces are a single LZ4 frame, which starts with its own magic number
+	static const uint8_t k_lz4_magic[4] = { 0x04, 0x22, 0x4d, 0x18 };
+	bool read = trace_read_file(binary_path, &input);
+	bool compressed = read && input.size >= sizeof(k_lz4_magic) && memcmp(input.data, k_lz4_magic, sizeof(k_lz4_magic)) == 0;
+	if (!read)
+	{
+		debug_print(k_print_error, "Failed to read trace from %s.\n", binary_path);
+	}
+	else if (!compressed || trace_decompress(heap, &input, &decompressed))
+	{
+		trace_buffer_t* records = compressed ? &decompressed : &input;
+		FILE* file = NULL;
+		if (fopen_s(&file, json_path, "wb") == 0 && file)
+		{
+			result = trace_convert_records(heap, (const uint8_t*)records->data, (const uint8_t*)records->data + records->size, file);
+			fclose(file);
+		}
+		else
+		{
+			debug_print(k_print_error, "Failed to write trace to %s.\n", json_path);
+		}
+	}
 
-	fclose(fp);
+	heap_free(heap, input.data);
+	heap_free(heap, decompressed.data);
+	return result;
 }
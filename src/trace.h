@@ -1,42 +1,41 @@
 #pragma once
 
+// CPU performance tracing.
+// Records named durations and other events on any thread and streams them to a compact
+// binary file. trace_convert turns the file into a Chrome trace, viewable in
+// chrome://tracing or ui.perfetto.dev.
+
+// Each thread records into its own ring of raw events: a name pointer, a timestamp,
+// a phase and a value. Recording takes no locks and does no formatting. While capturing,
+// a background thread drains the rings every few milliseconds, encodes the events and
+// writes them out through the file system, so memory stays bounded however long the
+// capture runs. Names are stored by pointer, so they must stay valid until the capture
+// stops. String literals are typical.
+
+// The file interns each name once and stores timestamps as deltas between a thread's
+// events, optionally all inside an LZ4 frame.
+
+// Every recording function accepts a NULL trace and does nothing, so systems can be
+// created without one. Engine code records through the TRACE_ macros at the end of this
+// file, which compile out entirely when TRACE_ENABLED is 0.
+
 #include <stdbool.h>
+#include <stdint.h>
+
+typedef struct fs_t fs_t;
+typedef struct heap_t heap_t;
 
-#include "heap.h"
-#include "queue.h"
-#include "mutex.h"
-
-typedef struct event_t
-{
-	const char* name;
-	long start_time;
-	long end_time;
-	int pid;
-	int tid;
-} event_t;
-
-typedef struct trace_t
-{
-	bool capturing;
-	bool first_event;
-	const char* file_path;
-	int event_capacity;
-	void* buffer;
-	int capture_count;
-	heap_t* heap;
-	int trace_queues_count;
-	int trace_queues_index;
-	queue_t** trace_queues;
-	int* pids;
-	int* tids;
-	mutex_t* mutex;
-} trace_t;
+// Handle to a tracing system.
+typedef struct trace_t trace_t;
 
 // Creates a CPU performance tracing system.
-// Event capacity is the maximum number of durations that can be traced.
+// Event capacity is the number of durations each thread can have recorded but not yet written.
+// Counters, instants and each end of a flow take half the room of a duration.
+// Events recorded once a thread's ring is full are dropped, durations along with their ends.
 trace_t* trace_create(heap_t* heap, int event_capacity);
 
 // Destroys a CPU performance tracing system.
+// Stops any capture still running.
 void trace_destroy(trace_t* trace);
 
 // Begin tracing a named duration on the current thread.
@@ -46,9 +45,75 @@ void trace_duration_push(trace_t* trace, const char* name);
 // End tracing the currently active duration on the current thread.
 void trace_duration_pop(trace_t* trace);
 
+// Record the value of a named counter, such as a queue depth or bytes in use.
+// Counters are drawn as a graph over time, one graph per name.
+void trace_counter(trace_t* trace, const char* name, int64_t value);
+
+// Record a named point in time on the current thread.
+void trace_instant(trace_t* trace, const char* name);
+
+// Start a flow from the current thread's active duration to a duration on any thread.
+// Returns the id to pass to trace_flow_end, or zero if the flow was not recorded.
+int trace_flow_begin(trace_t* trace, const char* name);
+
+// End a flow in the current thread's active duration.
+// Name should match trace_flow_begin. Does nothing for an id of zero.
+void trace_flow_end(trace_t* trace, const char* name, int id);
+
+// Name the current thread. Shown for its events in every later capture.
+void trace_thread_name(trace_t* trace, const char* name);
+
 // Start recording trace events.
-// A Chrome trace file will be written to path.
-void trace_capture_start(trace_t* trace, const char* path);
+// The trace is streamed to the file at path through fs, compressed with LZ4 if use_compression.
+// Does nothing if a capture is already running.
+void trace_capture_start(trace_t* trace, fs_t* fs, const char* path, bool use_compression);
 
 // Stop recording trace events.
+// Blocks until the rest of the trace has been written.
 void trace_capture_stop(trace_t* trace);
+
+// Convert a binary trace file, compressed or not, to a Chrome trace JSON file.
+// Returns false if the binary trace could not be read or is corrupt; what came before
+// a corrupt record is still converted.
+bool trace_convert(heap_t* heap, const char* binary_path, const char* json_path);
+
+// Define TRACE_ENABLED to 0 to compile all engine instrumentation out.
+// The trace functions remain, only the TRACE_ macros become no-ops.
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#if TRACE_ENABLED
+
+#define TRACE_PUSH(trace, name) trace_duration_push((trace), (name))
+#define TRACE_POP(trace) trace_duration_pop((trace))
+
+// Trace the statement or block that follows as a named duration.
+// Leaving it with return, break, continue or goto skips the end of the duration,
+// use TRACE_PUSH and TRACE_POP for code like that.
+#define TRACE_SCOPE(trace, name) \
+	for (int TRACE_CONCAT(trace_scope_, __LINE__) = (trace_duration_push((trace), (name)), 1); \
+		TRACE_CONCAT(trace_scope_, __LINE__); \
+		TRACE_CONCAT(trace_scope_, __LINE__) = (trace_duration_pop((trace)), 0))
+
+#define TRACE_COUNTER(trace, name, value) trace_counter((trace), (name), (value))
+#define TRACE_INSTANT(trace, name) trace_instant((trace), (name))
+#define TRACE_FLOW_BEGIN(trace, name) trace_flow_begin((trace), (name))
+#define TRACE_FLOW_END(trace, name, id) trace_flow_end((trace), (name), (id))
+#define TRACE_THREAD_NAME(trace, name) trace_thread_name((trace), (name))
+
+#else
+
+#define TRACE_PUSH(trace, name) ((void)0)
+#define TRACE_POP(trace) ((void)0)
+#define TRACE_SCOPE(trace, name)
+#define TRACE_COUNTER(trace, name, value) ((void)0)
+#define TRACE_INSTANT(trace, name) ((void)0)
+#define TRACE_FLOW_BEGIN(trace, name) 0
+#define TRACE_FLOW_END(trace, name, id) ((void)0)
+#define TRACE_THREAD_NAME(trace, name) ((void)0)
+
+#endif
@@ -0,0 +1,109 @@
+#include "bench.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "fs.h"
+#include "heap.h"
+#include "thread.h"
+#include "timer.h"
+#include "trace.h"
+
+enum
+{
+	// Push and pop pairs per thread, all of which fit in the trace.
+	k_bench_durations = 1 << 16,
+
+	k_bench_max_threads = 8,
+};
+
+typedef struct trace_bench_thread_t
+{
+	trace_t* trace;
+	int* start;
+	uint64_t ticks;
+} trace_bench_thread_t;
+
+static int trace_bench_thread_func(void* user)
+{
+	trace_bench_thread_t* data = user;
+	while (!atomic_load(data->start))
+	{
+	}
+
+	//Nested like a frame of systems, so both the outer and inner durations are recorded
+	uint64_t t0 = timer_get_ticks();
+	for (int i = 0; i < k_bench_durations; i += 4)
+	{
+		trace_duration_push(data->trace, "outer");
+		trace_duration_push(data->trace, "inner a");
+		trace_duration_pop(data->trace);
+		trace_duration_push(data->trace, "inner b");
+		trace_duration_pop(data->trace);
+		trace_duration_push(data->trace, "inner c");
+		trace_duration_pop(data->trace);
+		trace_duration_pop(data->trace);
+	}
+	data->ticks = timer_get_ticks() - t0;
+	return 0;
+}
+
+//Returns the ticks all threads spent recording
+static uint64_t run_capture(trace_t* trace, fs_t* fs, int thread_count)
+{
+	trace_capture_start(trace, fs, "trace_bench.bin", true);
+
+	int start = 0;
+	trace_bench_thread_t data[k_bench_max_threads];
+	thread_t* threads[k_bench_max_threads];
+	for (int i = 0; i < thread_count; ++i)
+	{
+		data[i] = (trace_bench_thread_t){ .trace = trace, .start = &start };
+		threads[i] = thread_create(trace_bench_thread_func, &data[i]);
+	}
+	atomic_store(&start, 1);
+
+	uint64_t ticks = 0;
+	for (int i = 0; i < thread_count; ++i)
+	{
+		thread_destroy(threads[i]);
+		ticks += data[i].ticks;
+	}
+	return ticks;
+}
+
+static void run_test(heap_t* heap, fs_t* fs, int thread_count)
+{
+	//Rings from a first trace are freed back to the heap, so the measured trace gets memory
+	//that is already paged in, as it would be after a game's first capture
+	trace_t* trace = trace_create(heap, k_bench_durations);
+	run_capture(trace, fs, thread_count);
+	trace_capture_stop(trace);
+	trace_destroy(trace);
+
+	trace = trace_create(heap, k_bench_durations);
+	uint64_t ticks = run_capture(trace, fs, thread_count);
+
+	//Stop waits for the writer to encode and write whatever it has not streamed yet
+	uint64_t t0 = timer_get_ticks();
+	trace_capture_stop(trace);
+	uint64_t t1 = timer_get_ticks();
+	trace_destroy(trace);
+
+	double durations = (double)k_bench_durations * thread_count;
+	debug_print(k_print_warning, "trace threads=%d ns/push+pop=%.1f stop=%.3fms for %d events\n",
+		thread_count, timer_ticks_to_us(ticks) * 1000.0 / durations,
+		timer_ticks_to_us(t1 - t0) / 1000.0, 2 * k_bench_durations * thread_count);
+}
+
+void trace_bench_run()
+{
+	heap_t* heap = heap_create(2 * 1024 * 1024, k_heap_tracking_none);
+	fs_t* fs = fs_create(heap, 16, NULL);
+
+	run_test(heap, fs, 1);
+	run_test(heap, fs, 4);
+	run_test(heap, fs, k_bench_max_threads);
+
+	fs_destroy(fs);
+	heap_destroy(heap);
+}
@@ -1,5 +1,24 @@
 #include "transform.h"
 
+#include "cpu.h"
+
+#include <immintrin.h>
+
+//Four transforms with one register per component
+typedef struct transform4_t
+{
+	__m128 tx, ty, tz;
+	__m128 sx, sy, sz;
+	__m128 qx, qy, qz, qw;
+} transform4_t;
+
+typedef struct transform8_t
+{
+	__m256 tx, ty, tz;
+	__m256 sx, sy, sz;
+	__m256 qx, qy, qz, qw;
+} transform8_t;
+
 void transform_identity(transform_t* transform)
 {
 	transform->translation = vec3f_zero();
@@ -75,3 +94,309 @@ vec3f_t transform_transform_vec3(const transform_t* transform, vec3f_t v)
 	const vec3f_t rotated_translation = quatf_rotate_vec(transform->rotation, scaled_vector);
 	return vec3f_add(rotated_translation, transform->translation);
 }
+
+//A transform_t is ten floats: tx ty tz sx | sy sz qx qy | qz qw
+static void transform_load4(const transform_t* t, transform4_t* out)
+{
+	const float* f0 = &t[0].translation.x;
+	const float* f1 = &t[1].translation.x;
+	const float* f2 = &t[2].translation.x;
+	const float* f3 = &t[3].translation.x;
+
+	out->tx = _mm_loadu_ps(f0);
+	out->ty = _mm_loadu_ps(f1);
+	out->tz = _mm_loadu_ps(f2);
+	out->sx = _mm_loadu_ps(f3);
+	_MM_TRANSPOSE4_PS(out->tx, out->ty, out->tz, out->sx);
+
+	out->sy = _mm_loadu_ps(f0 + 4);
+	out->sz = _mm_loadu_ps(f1 + 4);
+	out->qx = _mm_loadu_ps(f2 + 4);
+	out->qy = _mm_loadu_ps(f3 + 4);
+	_MM_TRANSPOSE4_PS(out->sy, out->sz, out->qx, out->qy);
+
+	//Only two floats are left, loading four would read past the last transform
+	__m128 zero = _mm_setzero_ps();
+	__m128 zw01 = _mm_unpacklo_ps(_mm_loadl_pi(zero, (const __m64*)(f0 + 8)), _mm_loadl_pi(zero, (const __m64*)(f1 + 8)));
+	__m128 zw23 = _mm_unpacklo_ps(_mm_loadl_pi(zero, (const __m64*)(f2 + 8)), _mm_loadl_pi(zero, (const __m64*)(f3 + 8)));
+	out->qz = _mm_movelh_ps(zw01, zw23);
+	out->qw = _mm_movehl_ps(zw23, zw01);
+}
+
+//Inverse of transform_load4
+static void transform_store4(const transform4_t* in, transform_t* t)
+{
+	float* f0 = &t[0].translation.x;
+	float* f1 = &t[1].translation.x;
+	float* f2 = &t[2].translation.x;
+	float* f3 = &t[3].translation.x;
+
+	__m128 r0 = in->tx, r1 = in->ty, r2 = in->tz, r3 = in->sx;
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	_mm_storeu_ps(f0, r0);
+	_mm_storeu_ps(f1, r1);
+	_mm_storeu_ps(f2, r2);
+	_mm_storeu_ps(f3, r3);
+
+	r0 = in->sy, r1 = in->sz, r2 = in->qx, r3 = in->qy;
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	_mm_storeu_ps(f0 + 4, r0);
+	_mm_storeu_ps(f1 + 4, r1);
+	_mm_storeu_ps(f2 + 4, r2);
+	_mm_storeu_ps(f3 + 4, r3);
+
+	__m128 zw01 = _mm_unpacklo_ps(in->qz, in->qw);
+	__m128 zw23 = _mm_unpackhi_ps(in->qz, in->qw);
+	_mm_storel_pi((__m64*)(f0 + 8), zw01);
+	_mm_storeh_pi((__m64*)(f1 + 8), zw01);
+	_mm_storel_pi((__m64*)(f2 + 8), zw23);
+	_mm_storeh_pi((__m64*)(f3 + 8), zw23);
+}
+
+static void transform_load8(const transform_t* t, transform8_t* out)
+{
+	transform4_t lo, hi;
+	transform_load4(t + 0, &lo);
+	transform_load4(t + 4, &hi);
+	out->tx = _mm256_set_m128(hi.tx, lo.tx);
+	out->ty = _mm256_set_m128(hi.ty, lo.ty);
+	out->tz = _mm256_set_m128(hi.tz, lo.tz);
+	out->sx = _mm256_set_m128(hi.sx, lo.sx);
+	out->sy = _mm256_set_m128(hi.sy, lo.sy);
+	out->sz = _mm256_set_m128(hi.sz, lo.sz);
+	out->qx = _mm256_set_m128(hi.qx, lo.qx);
+	out->qy = _mm256_set_m128(hi.qy, lo.qy);
+	out->qz = _mm256_set_m128(hi.qz, lo.qz);
+	out->qw = _mm256_set_m128(hi.qw, lo.qw);
+}
+
+static void transform_store8(const transform8_t* in, transform_t* t)
+{
+	transform4_t lo =
+	{
+		_mm256_castps256_ps128(in->tx), _mm256_castps256_ps128(in->ty), _mm256_castps256_ps128(in->tz),
+		_mm256_castps256_ps128(in->sx), _mm256_castps256_ps128(in->sy), _mm256_castps256_ps128(in->sz),
+		_mm256_castps256_ps128(in->qx), _mm256_castps256_ps128(in->qy), _mm256_castps256_ps128(in->qz), _mm256_castps256_ps128(in->qw),
+	};
+	transform4_t hi =
+	{
+		_mm256_extractf128_ps(in->tx, 1), _mm256_extractf128_ps(in->ty, 1), _mm256_extractf128_ps(in->tz, 1),
+		_mm256_extractf128_ps(in->sx, 1), _mm256_extractf128_ps(in->sy, 1), _mm256_extractf128_ps(in->sz, 1),
+		_mm256_extractf128_ps(in->qx, 1), _mm256_extractf128_ps(in->qy, 1), _mm256_extractf128_ps(in->qz, 1), _mm256_extractf128_ps(in->qw, 1),
+	};
+	transform_store4(&lo, t + 0);
+	transform_store4(&hi, t + 4);
+}
+
+//m[row][column] holds that element of four matrices, the translation row is written as is
+static void mat4f_store4(__m128 m[3][3], __m128 tx, __m128 ty, __m128 tz, mat4f_t* output)
+{
+	__m128 zero = _mm_setzero_ps();
+	for (int row = 0; row < 3; ++row)
+	{
+		__m128 r0 = m[row][0], r1 = m[row][1], r2 = m[row][2], r3 = zero;
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		_mm_storeu_ps(output[0].data[row], r0);
+		_mm_storeu_ps(output[1].data[row], r1);
+		_mm_storeu_ps(output[2].data[row], r2);
+		_mm_storeu_ps(output[3].data[row], r3);
+	}
+
+	__m128 r0 = tx, r1 = ty, r2 = tz, r3 = _mm_set1_ps(1.0f);
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	_mm_storeu_ps(output[0].data[3], r0);
+	_mm_storeu_ps(output[1].data[3], r1);
+	_mm_storeu_ps(output[2].data[3], r2);
+	_mm_storeu_ps(output[3].data[3], r3);
+}
+
+static void transform_to_matrix_sse(const transform_t* transforms, mat4f_t* output)
+{
+	transform4_t t;
+	transform_load4(transforms, &t);
+
+	//Same math as transform_to_matrix
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 two = _mm_set1_ps(2.0f);
+	__m128 xx = _mm_mul_ps(t.qx, t.qx);
+	__m128 yy = _mm_mul_ps(t.qy, t.qy);
+	__m128 zz = _mm_mul_ps(t.qz, t.qz);
+	__m128 xy = _mm_mul_ps(t.qx, t.qy);
+	__m128 xz = _mm_mul_ps(t.qx, t.qz);
+	__m128 yz = _mm_mul_ps(t.qy, t.qz);
+	__m128 xw = _mm_mul_ps(t.qx, t.qw);
+	__m128 yw = _mm_mul_ps(t.qy, t.qw);
+	__m128 zw = _mm_mul_ps(t.qz, t.qw);
+
+	__m128 m[3][3];
+	m[0][0] = _mm_mul_ps(t.sx, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))));
+	m[0][1] = _mm_mul_ps(t.sx, _mm_mul_ps(two, _mm_add_ps(xy, zw)));
+	m[0][2] = _mm_mul_ps(t.sx, _mm_mul_ps(two, _mm_sub_ps(xz, yw)));
+	m[1][0] = _mm_mul_ps(t.sy, _mm_mul_ps(two, _mm_sub_ps(xy, zw)));
+	m[1][1] = _mm_mul_ps(t.sy, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))));
+	m[1][2] = _mm_mul_ps(t.sy, _mm_mul_ps(two, _mm_add_ps(yz, xw)));
+	m[2][0] = _mm_mul_ps(t.sz, _mm_mul_ps(two, _mm_add_ps(xz, yw)));
+	m[2][1] = _mm_mul_ps(t.sz, _mm_mul_ps(two, _mm_sub_ps(yz, xw)));
+	m[2][2] = _mm_mul_ps(t.sz, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))));
+
+	mat4f_store4(m, t.tx, t.ty, t.tz, output);
+}
+
+static void transform_to_matrix_avx(const transform_t* transforms, mat4f_t* output)
+{
+	transform8_t t;
+	transform_load8(transforms, &t);
+
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 two = _mm256_set1_ps(2.0f);
+	__m256 xx = _mm256_mul_ps(t.qx, t.qx);
+	__m256 yy = _mm256_mul_ps(t.qy, t.qy);
+	__m256 zz = _mm256_mul_ps(t.qz, t.qz);
+	__m256 xy = _mm256_mul_ps(t.qx, t.qy);
+	__m256 xz = _mm256_mul_ps(t.qx, t.qz);
+	__m256 yz = _mm256_mul_ps(t.qy, t.qz);
+	__m256 xw = _mm256_mul_ps(t.qx, t.qw);
+	__m256 yw = _mm256_mul_ps(t.qy, t.qw);
+	__m256 zw = _mm256_mul_ps(t.qz, t.qw);
+
+	__m256 m[3][3];
+	m[0][0] = _mm256_mul_ps(t.sx, _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(yy, zz))));
+	m[0][1] = _mm256_mul_ps(t.sx, _mm256_mul_ps(two, _mm256_add_ps(xy, zw)));
+	m[0][2] = _mm256_mul_ps(t.sx, _mm256_mul_ps(two, _mm256_sub_ps(xz, yw)));
+	m[1][0] = _mm256_mul_ps(t.sy, _mm256_mul_ps(two, _mm256_sub_ps(xy, zw)));
+	m[1][1] = _mm256_mul_ps(t.sy, _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, zz))));
+	m[1][2] = _mm256_mul_ps(t.sy, _mm256_mul_ps(two, _mm256_add_ps(yz, xw)));
+	m[2][0] = _mm256_mul_ps(t.sz, _mm256_mul_ps(two, _mm256_add_ps(xz, yw)));
+	m[2][1] = _mm256_mul_ps(t.sz, _mm256_mul_ps(two, _mm256_sub_ps(yz, xw)));
+	m[2][2] = _mm256_mul_ps(t.sz, _mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, yy))));
+
+	__m128 lo[3][3], hi[3][3];
+	for (int row = 0; row < 3; ++row)
+	{
+		for (int column = 0; column < 3; ++column)
+		{
+			lo[row][column] = _mm256_castps256_ps128(m[row][column]);
+			hi[row][column] = _mm256_extractf128_ps(m[row][column], 1);
+		}
+	}
+	mat4f_store4(lo, _mm256_castps256_ps128(t.tx), _mm256_castps256_ps128(t.ty), _mm256_castps256_ps128(t.tz), output + 0);
+	mat4f_store4(hi, _mm256_extractf128_ps(t.tx, 1), _mm256_extractf128_ps(t.ty, 1), _mm256_extractf128_ps(t.tz, 1), output + 4);
+}
+
+void transform_to_matrix_n(const transform_t* transforms, mat4f_t* output, int count)
+{
+	int i = 0;
+	if (cpu_has_avx2())
+	{
+		for (; i + 8 <= count; i += 8)
+		{
+			transform_to_matrix_avx(transforms + i, output + i);
+		}
+	}
+	for (; i + 4 <= count; i += 4)
+	{
+		transform_to_matrix_sse(transforms + i, output + i);
+	}
+	for (; i < count; ++i)
+	{
+		transform_to_matrix(&transforms[i], &output[i]);
+	}
+}
+
+static void transform_multiply_sse(transform_t* results, const transform_t* transforms)
+{
+	transform4_t r, t;
+	transform_load4(results, &r);
+	transform_load4(transforms, &t);
+
+	//Same math as transform_multiply, rotating the scaled translation as quatf_rotate_vec does
+	__m128 vx = _mm_mul_ps(r.tx, t.sx);
+	__m128 vy = _mm_mul_ps(r.ty, t.sy);
+	__m128 vz = _mm_mul_ps(r.tz, t.sz);
+
+	__m128 two = _mm_set1_ps(2.0f);
+	__m128 cx = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(t.qy, vz), _mm_mul_ps(t.qz, vy)));
+	__m128 cy = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(t.qz, vx), _mm_mul_ps(t.qx, vz)));
+	__m128 cz = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(t.qx, vy), _mm_mul_ps(t.qy, vx)));
+	vx = _mm_add_ps(vx, _mm_add_ps(_mm_mul_ps(cx, t.qw), _mm_sub_ps(_mm_mul_ps(t.qy, cz), _mm_mul_ps(t.qz, cy))));
+	vy = _mm_add_ps(vy, _mm_add_ps(_mm_mul_ps(cy, t.qw), _mm_sub_ps(_mm_mul_ps(t.qz, cx), _mm_mul_ps(t.qx, cz))));
+	vz = _mm_add_ps(vz, _mm_add_ps(_mm_mul_ps(cz, t.qw), _mm_sub_ps(_mm_mul_ps(t.qx, cy), _mm_mul_ps(t.qy, cx))));
+
+	//quatf_mul(t.rotation, r.rotation)
+	__m128 qx = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(t.qy, r.qz), _mm_mul_ps(t.qz, r.qy)), _mm_add_ps(_mm_mul_ps(r.qx, t.qw), _mm_mul_ps(t.qx, r.qw)));
+	__m128 qy = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(t.qz, r.qx), _mm_mul_ps(t.qx, r.qz)), _mm_add_ps(_mm_mul_ps(r.qy, t.qw), _mm_mul_ps(t.qy, r.qw)));
+	__m128 qz = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(t.qx, r.qy), _mm_mul_ps(t.qy, r.qx)), _mm_add_ps(_mm_mul_ps(r.qz, t.qw), _mm_mul_ps(t.qz, r.qw)));
+	__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(t.qx, r.qx), _mm_mul_ps(t.qy, r.qy)), _mm_mul_ps(t.qz, r.qz));
+	r.qw = _mm_sub_ps(_mm_mul_ps(t.qw, r.qw), dot);
+	r.qx = qx;
+	r.qy = qy;
+	r.qz = qz;
+
+	r.sx = _mm_mul_ps(r.sx, t.sx);
+	r.sy = _mm_mul_ps(r.sy, t.sy);
+	r.sz = _mm_mul_ps(r.sz, t.sz);
+
+	r.tx = _mm_add_ps(vx, t.tx);
+	r.ty = _mm_add_ps(vy, t.ty);
+	r.tz = _mm_add_ps(vz, t.tz);
+
+	transform_store4(&r, results);
+}
+
+static void transform_multiply_avx(transform_t* results, const transform_t* transforms)
+{
+	transform8_t r, t;
+	transform_load8(results, &r);
+	transform_load8(transforms, &t);
+
+	__m256 vx = _mm256_mul_ps(r.tx, t.sx);
+	__m256 vy = _mm256_mul_ps(r.ty, t.sy);
+	__m256 vz = _mm256_mul_ps(r.tz, t.sz);
+
+	__m256 two = _mm256_set1_ps(2.0f);
+	__m256 cx = _mm256_mul_ps(two, _mm256_sub_ps(_mm256_mul_ps(t.qy, vz), _mm256_mul_ps(t.qz, vy)));
+	__m256 cy = _mm256_mul_ps(two, _mm256_sub_ps(_mm256_mul_ps(t.qz, vx), _mm256_mul_ps(t.qx, vz)));
+	__m256 cz = _mm256_mul_ps(two, _mm256_sub_ps(_mm256_mul_ps(t.qx, vy), _mm256_mul_ps(t.qy, vx)));
+	vx = _mm256_add_ps(vx, _mm256_add_ps(_mm256_mul_ps(cx, t.qw), _mm256_sub_ps(_mm256_mul_ps(t.qy, cz), _mm256_mul_ps(t.qz, cy))));
+	vy = _mm256_add_ps(vy, _mm256_add_ps(_mm256_mul_ps(cy, t.qw), _mm256_sub_ps(_mm256_mul_ps(t.qz, cx), _mm256_mul_ps(t.qx, cz))));
+	vz = _mm256_add_ps(vz, _mm256_add_ps(_mm256_mul_ps(cz, t.qw), _mm256_sub_ps(_mm256_mul_ps(t.qx, cy), _mm256_mul_ps(t.qy, cx))));
+
+	__m256 qx = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(t.qy, r.qz), _mm256_mul_ps(t.qz, r.qy)), _mm256_add_ps(_mm256_mul_ps(r.qx, t.qw), _mm256_mul_ps(t.qx, r.qw)));
+	__m256 qy = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(t.qz, r.qx), _mm256_mul_ps(t.qx, r.qz)), _mm256_add_ps(_mm256_mul_ps(r.qy, t.qw), _mm256_mul_ps(t.qy, r.qw)));
+	__m256 qz = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(t.qx, r.qy), _mm256_mul_ps(t.qy, r.qx)), _mm256_add_ps(_mm256_mul_ps(r.qz, t.qw), _mm256_mul_ps(t.qz, r.qw)));
+	__m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(t.qx, r.qx), _mm256_mul_ps(t.qy, r.qy)), _mm256_mul_ps(t.qz, r.qz));
+	r.qw = _mm256_sub_ps(_mm256_mul_ps(t.qw, r.qw), dot);
+	r.qx = qx;
+	r.qy = qy;
+	r.qz = qz;
+
+	r.sx = _mm256_mul_ps(r.sx, t.sx);
+	r.sy = _mm256_mul_ps(r.sy, t.sy);
+	r.sz = _mm256_mul_ps(r.sz, t.sz);
+
+	r.tx = _mm256_add_ps(vx, t.tx);
+	r.ty = _mm256_add_ps(vy, t.ty);
+	r.tz = _mm256_add_ps(vz, t.tz);
+
+	transform_store8(&r, results);
+}
+
+void transform_multiply_n(transform_t* results, const transform_t* t, int count)
+{
+	int i = 0;
+	if (cpu_has_avx2())
+	{
+		for (; i + 8 <= count; i += 8)
+		{
+			transform_multiply_avx(results + i, t + i);
+		}
+	}
+	for (; i + 4 <= count; i += 4)
+	{
+		transform_multiply_sse(results + i, t + i);
+	}
+	for (; i < count; ++i)
+	{
+		transform_multiply(&results[i], &t[i]);
+	}
+}
@@ -24,6 +24,15 @@ void transform_to_matrix(const transform_t* transform, mat4f_t* output);
 // Combine to transforms -- result and t -- and store the output in result.
 void transform_multiply(transform_t* result, const transform_t* t);
 
+// Batch versions of transform_to_matrix and transform_multiply over count elements.
+// Each works on four or eight transforms at a time with SSE or AVX2, whichever the processor
+// supports, transposing them into one register per component, then finishes any remainder
+// with the single transform functions.
+void transform_to_matrix_n(const transform_t* transforms, mat4f_t* output, int count);
+
+// results[i] is combined with t[i] as in transform_multiply.
+void transform_multiply_n(transform_t* results, const transform_t* t, int count);
+
 // Compute a transform's inverse in translation, scale, and rotation.
 void transform_invert(transform_t* transform);
 
@@ -0,0 +1,190 @@
+#include "bench.h"
+
+#include "cpu.h"
+#include "debug.h"
+#include "heap.h"
+#include "mat4f.h"
+#include "quatf.h"
+#include "timer.h"
+#include "transform.h"
+
+#include <math.h>
+#include <stdbool.h>
+
+enum
+{
+	// Enough work per pass for a stable timing, repeated over smaller arrays.
+	k_bench_elements_per_pass = 1 << 20,
+};
+
+// Batch results may differ from the scalar ones by rounding, relative to the larger value.
+static const float k_bench_epsilon = 1e-4f;
+
+typedef struct transform_bench_t
+{
+	transform_t* transforms;
+	transform_t* parents;
+	transform_t* results;
+	mat4f_t* matrices;
+	vec3f_t* vectors;
+	quatf_t* rotations;
+	int count;
+} transform_bench_t;
+
+static void transform_bench_fill(transform_bench_t* bench)
+{
+	for (int i = 0; i < bench->count; ++i)
+	{
+		float angle = (float)i * 0.01f;
+		transform_t* transform = &bench->transforms[i];
+		transform->translation = (vec3f_t){ .x = (float)i, .y = -(float)i, .z = 0.5f };
+		transform->scale = (vec3f_t){ .x = 1.0f, .y = 2.0f, .z = 0.5f };
+		transform->rotation = (quatf_t){ .x = sinf(angle), .y = 0.0f, .z = 0.0f, .w = cosf(angle) };
+
+		bench->parents[i] = *transform;
+		bench->parents[i].translation.z = 4.0f;
+		bench->vectors[i] = transform->translation;
+		bench->rotations[i] = transform->rotation;
+	}
+}
+
+static bool transform_bench_close(const float* a, const float* b, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		float scale = __max(1.0f, __max(fabsf(a[i]), fabsf(b[i])));
+		if (fabsf(a[i] - b[i]) > k_bench_epsilon * scale)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Returns millions of elements processed per second.
+static double transform_bench_rate(uint64_t ticks)
+{
+	return k_bench_elements_per_pass / (timer_ticks_to_us(ticks) * 1e-6) / 1e6;
+}
+
+static void run_test(heap_t* heap, int count)
+{
+	transform_bench_t bench = { .count = count };
+	bench.transforms = heap_alloc(heap, sizeof(transform_t) * count, 16);
+	bench.parents = heap_alloc(heap, sizeof(transform_t) * count, 16);
+	bench.results = heap_alloc(heap, sizeof(transform_t) * count, 16);
+	bench.matrices = heap_alloc(heap, sizeof(mat4f_t) * count, 16);
+	bench.vectors = heap_alloc(heap, sizeof(vec3f_t) * count, 16);
+	bench.rotations = heap_alloc(heap, sizeof(quatf_t) * count, 16);
+	transform_bench_fill(&bench);
+
+	int passes = k_bench_elements_per_pass / count;
+
+	uint64_t t0 = timer_get_ticks();
+	for (int p = 0; p < passes; ++p)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			transform_to_matrix(&bench.transforms[i], &bench.matrices[i]);
+		}
+	}
+	uint64_t t1 = timer_get_ticks();
+	for (int p = 0; p < passes; ++p)
+	{
+		transform_to_matrix_n(bench.transforms, bench.matrices, count);
+	}
+	uint64_t t2 = timer_get_ticks();
+	double matrix_scalar = transform_bench_rate(t1 - t0);
+	double matrix_batch = transform_bench_rate(t2 - t1);
+
+	//The last batch pass left its output in place, checked against the scalar functions
+	bool matrix_match = true;
+	for (int i = 0; i < count; ++i)
+	{
+		mat4f_t expected;
+		transform_to_matrix(&bench.transforms[i], &expected);
+		matrix_match &= transform_bench_close(&expected.data[0][0], &bench.matrices[i].data[0][0], 16);
+	}
+
+	//Multiply into a copy each pass so the values stay bounded
+	t0 = timer_get_ticks();
+	for (int p = 0; p < passes; ++p)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			bench.results[i] = bench.transforms[i];
+			transform_multiply(&bench.results[i], &bench.parents[i]);
+		}
+	}
+	t1 = timer_get_ticks();
+	for (int p = 0; p < passes; ++p)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			bench.results[i] = bench.transforms[i];
+		}
+		transform_multiply_n(bench.results, bench.parents, count);
+	}
+	t2 = timer_get_ticks();
+	double multiply_scalar = transform_bench_rate(t1 - t0);
+	double multiply_batch = transform_bench_rate(t2 - t1);
+
+	bool multiply_match = true;
+	for (int i = 0; i < count; ++i)
+	{
+		transform_t expected = bench.transforms[i];
+		transform_multiply(&expected, &bench.parents[i]);
+		multiply_match &= transform_bench_close(expected.translation.a, bench.results[i].translation.a, 3);
+		multiply_match &= transform_bench_close(expected.scale.a, bench.results[i].scale.a, 3);
+		multiply_match &= transform_bench_close(&expected.rotation.x, &bench.results[i].rotation.x, 4);
+	}
+
+	vec3f_t* rotated = (vec3f_t*)bench.results;
+	t0 = timer_get_ticks();
+	for (int p = 0; p < passes; ++p)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			rotated[i] = quatf_rotate_vec(bench.rotations[i], bench.vectors[i]);
+		}
+	}
+	t1 = timer_get_ticks();
+	for (int p = 0; p < passes; ++p)
+	{
+		quatf_rotate_vec_n(bench.rotations, bench.vectors, rotated, count);
+	}
+	t2 = timer_get_ticks();
+	double rotate_scalar = transform_bench_rate(t1 - t0);
+	double rotate_batch = transform_bench_rate(t2 - t1);
+
+	bool rotate_match = true;
+	for (int i = 0; i < count; ++i)
+	{
+		vec3f_t expected = quatf_rotate_vec(bench.rotations[i], bench.vectors[i]);
+		rotate_match &= transform_bench_close(expected.a, rotated[i].a, 3);
+	}
+
+	debug_print(k_print_warning, "transform count=%d to_matrix M/s scalar=%.1f batch=%.1f (%.2fx)%s multiply M/s scalar=%.1f batch=%.1f (%.2fx)%s rotate_vec M/s scalar=%.1f batch=%.1f (%.2fx)%s\n",
+		count,
+		matrix_scalar, matrix_batch, matrix_batch / matrix_scalar, matrix_match ? "" : " MISMATCH",
+		multiply_scalar, multiply_batch, multiply_batch / multiply_scalar, multiply_match ? "" : " MISMATCH",
+		rotate_scalar, rotate_batch, rotate_batch / rotate_scalar, rotate_match ? "" : " MISMATCH");
+
+	heap_free(heap, bench.rotations);
+	heap_free(heap, bench.vectors);
+	heap_free(heap, bench.matrices);
+	heap_free(heap, bench.results);
+	heap_free(heap, bench.parents);
+	heap_free(heap, bench.transforms);
+}
+
+void transform_bench_run()
+{
+	heap_t* heap = heap_create(8 * 1024 * 1024, k_heap_tracking_none);
+
+	debug_print(k_print_warning, "transform batch kernels use %s\n", cpu_has_avx2() ? "AVX2" : "SSE");
+	run_test(heap, 1024);
+	run_test(heap, 64 * 1024);
+
+	heap_destroy(heap);
+}
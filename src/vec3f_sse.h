@@ -0,0 +1,44 @@
+#pragma once
+
+// SSE helpers for arrays of vec3f_t.
+// vec3f_t is three floats, so four of them fill exactly three registers.
+
+#include "vec3f.h"
+
+#include <immintrin.h>
+
+// Transposes four vec3f_t so each register holds one component of all four.
+__forceinline void vec3f_load4(const vec3f_t* v, __m128* x, __m128* y, __m128* z)
+{
+	const float* f = &v->x;
+	__m128 a = _mm_loadu_ps(f + 0); // x0 y0 z0 x1
+	__m128 b = _mm_loadu_ps(f + 4); // y1 z1 x2 y2
+	__m128 c = _mm_loadu_ps(f + 8); // z2 x3 y3 z3
+
+	__m128 x23 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2));
+	*x = _mm_shuffle_ps(a, x23, _MM_SHUFFLE(2, 0, 3, 0));
+
+	__m128 y01 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1));
+	__m128 y23 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3));
+	*y = _mm_shuffle_ps(y01, y23, _MM_SHUFFLE(2, 0, 2, 0));
+
+	__m128 z01 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2));
+	*z = _mm_shuffle_ps(z01, c, _MM_SHUFFLE(3, 0, 2, 0));
+}
+
+// Inverse of vec3f_load4.
+__forceinline void vec3f_store4(vec3f_t* v, __m128 x, __m128 y, __m128 z)
+{
+	float* f = &v->x;
+	__m128 x0y0 = _mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 0, 0, 0));
+	__m128 z0x1 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0));
+	_mm_storeu_ps(f + 0, _mm_shuffle_ps(x0y0, z0x1, _MM_SHUFFLE(2, 0, 2, 0)));
+
+	__m128 y1z1 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1));
+	__m128 x2y2 = _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2));
+	_mm_storeu_ps(f + 4, _mm_shuffle_ps(y1z1, x2y2, _MM_SHUFFLE(2, 0, 2, 0)));
+
+	__m128 z2x3 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2));
+	__m128 y3z3 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3));
+	_mm_storeu_ps(f + 8, _mm_shuffle_ps(z2x3, y3z3, _MM_SHUFFLE(2, 0, 2, 0)));
+}